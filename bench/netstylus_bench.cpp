@@ -0,0 +1,844 @@
+/**
+ * Load generator for NetStylus servers
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains netstylus-bench, a tool that simulates many pens drawing
+ * at the same time, to measure how much load a server can take.
+ *
+ * Each pen has its own socket, so the server sees it as a different sender.
+ * Some packets ask for an acknowledgment: the time until it arrives is the
+ * round trip through the server, and the requests that are never acknowledged
+ * are counted as lost.
+ * Servers that send reports also tell the clock offset, and with it the time
+ * from each sample to its arrival (the one-way latency).
+ * Run the server with --output null to measure it without uinput.
+ *
+ * The pens can also drop some of their packets on purpose, to simulate a lossy
+ * link, and thin their samples in the air with the rate controller of the
+ * client.
+ *
+ * To compile:
+ *   g++ -O2 -I../common/ -I../evdev/ netstylus_bench.cpp \
+ *     ../common/clock_sync.cpp ../common/packet_codec.cpp \
+ *     ../common/rate_control.cpp ../evdev/stats.cpp -pthread \
+ *     -o netstylus-bench
+ */
+
+#include <clock.h>
+#include <clock_sync.h>
+#include <packet_codec.h>
+#include <rate_control.h>
+#include <stats.h>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/// The area of the simulated tablets, in mm * 100
+const uint32_t tabletWidth = 30000;
+const uint32_t tabletHeight = 20000;
+const int32_t tabletPressure = 4096;
+
+/// The time the pressure takes to reach its peak and to go back to 0, in µs
+const double pressureRamp = 40000;
+
+/// How long we wait for the last acknowledgments, in µs
+const uint64_t ackDrain = 200000;
+
+/// The acknowledgment requests we remember for each pen
+const size_t maxPendingAcks = 64;
+
+/// The limits of the command line
+const unsigned long maxPens = 1000;
+const unsigned long maxRate = 2000;
+const unsigned long maxSeconds = 3600;
+const unsigned long maxThreads = 64;
+
+struct Settings {
+	sockaddr_in server = {};
+	unsigned int pens = 1;
+	unsigned int rate = 240; ///< Samples per second of each pen
+	unsigned int batch = 1; ///< Samples per packet
+	unsigned int seconds = 10;
+	unsigned int threads = 1;
+	/// Ask for an acknowledgment every this number of packets (0 for never)
+	unsigned int ackEvery = 10;
+	unsigned int redundancy = 0;
+	/// Send version 1 packets, for the older servers
+	bool legacy = false;
+	/// The fraction of packets that the simulated link drops
+	double loss = 0;
+	/// Thin the samples in the air when the link is congested
+	bool adaptive = false;
+};
+
+/// The counters of a thread, the main thread reads them for the progress
+struct Counters {
+	std::atomic<uint64_t> samples{0};
+	std::atomic<uint64_t> packets{0};
+	std::atomic<uint64_t> bytes{0};
+	std::atomic<uint64_t> sendErrors{0};
+	std::atomic<uint64_t> ackRequests{0};
+	std::atomic<uint64_t> acked{0};
+	std::atomic<uint64_t> ackLost{0};
+	std::atomic<uint64_t> linkDropped{0};
+	std::atomic<uint64_t> decimated{0};
+	/// The sum of the congestion levels of the pens, at the end
+	std::atomic<uint64_t> levels{0};
+};
+
+void increment(std::atomic<uint64_t> &counter, uint64_t value = 1)
+{
+	counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t get(const std::atomic<uint64_t> &counter)
+{
+	return counter.load(std::memory_order_relaxed);
+}
+
+/**
+ * Generates synthetic strokes: the pen hovers for a while, then it touches the
+ * surface with a pressure ramp, and finally it lifts.
+ *
+ * The pen follows a Lissajous curve, which changes at every hover, and the
+ * tilt changes slowly all the time.
+ */
+class StrokeGenerator {
+public:
+	explicit StrokeGenerator(uint32_t seed) : mRandom(seed)
+	{
+	}
+
+	/// The sample at the given time, in µs; the time must not go back
+	Sample next(uint64_t time);
+
+private:
+	void newPhase(uint64_t time);
+
+	double uniform(double low, double high)
+	{
+		return std::uniform_real_distribution<double>(low, high)(mRandom);
+	}
+
+	std::mt19937 mRandom;
+
+	/// The first phase is a hover
+	bool mTouching = true;
+	uint64_t mPhaseStart = 0;
+	uint64_t mPhaseEnd = 0;
+
+	/// The time of the start of the curve
+	uint64_t mEpoch = 0;
+	double mCenterX = 0;
+	double mCenterY = 0;
+	double mRadiusX = 0;
+	double mRadiusY = 0;
+	double mFrequencyX = 0;
+	double mFrequencyY = 0;
+	double mPhaseX = 0;
+	double mPhaseY = 0;
+
+	double mPeakPressure = 0;
+};
+
+Sample StrokeGenerator::next(uint64_t time)
+{
+	if (time >= mPhaseEnd) {
+		newPhase(time);
+	}
+
+	const double t = (time - mEpoch) / 1e6;
+	const double x = mCenterX + mRadiusX * sin(2 * M_PI * mFrequencyX * t
+		+ mPhaseX);
+	const double y = mCenterY + mRadiusY * sin(2 * M_PI * mFrequencyY * t
+		+ mPhaseY);
+
+	Sample s;
+	s.timestamp = time;
+	s.status = PacketHasPressure | PacketHasTiltX | PacketHasTiltY;
+	s.x = static_cast<uint32_t>(std::min(std::max(x, 0.0),
+		static_cast<double>(tabletWidth)));
+	s.y = static_cast<uint32_t>(std::min(std::max(y, 0.0),
+		static_cast<double>(tabletHeight)));
+	// In 0.01°, around the vertical
+	s.tiltX = static_cast<uint32_t>(9000 + 3000 * sin(2 * M_PI * 0.3 * t));
+	s.tiltY = static_cast<uint32_t>(9000 + 3000 * cos(2 * M_PI * 0.2 * t));
+
+	if (mTouching) {
+		s.status |= PacketIsTouching;
+		const double ramp = std::min({1.0, (time - mPhaseStart) / pressureRamp,
+			(mPhaseEnd - time) / pressureRamp});
+		// Smoothstep, with a small tremor
+		const double envelope = ramp * ramp * (3 - 2 * ramp);
+		const double pressure = mPeakPressure * envelope
+			* (1 + 0.1 * sin(2 * M_PI * 3 * t));
+		s.pressure = static_cast<uint32_t>(std::min(pressure,
+			static_cast<double>(tabletPressure)));
+	}
+	return s;
+}
+
+void StrokeGenerator::newPhase(uint64_t time)
+{
+	mTouching = !mTouching;
+	mPhaseStart = time;
+	if (mTouching) {
+		mPhaseEnd = time + static_cast<uint64_t>(uniform(200000, 1500000));
+		mPeakPressure = uniform(0.3, 0.9) * tabletPressure;
+		return;
+	}
+
+	// The pen came back in range, maybe somewhere else
+	mPhaseEnd = time + static_cast<uint64_t>(uniform(100000, 400000));
+	mEpoch = time;
+	mRadiusX = uniform(1000, 6000);
+	mRadiusY = uniform(1000, 6000);
+	mCenterX = uniform(mRadiusX, tabletWidth - mRadiusX);
+	mCenterY = uniform(mRadiusY, tabletHeight - mRadiusY);
+	mFrequencyX = uniform(0.3, 1.5);
+	mFrequencyY = uniform(0.3, 1.5);
+	mPhaseX = uniform(0, 2 * M_PI);
+	mPhaseY = uniform(0, 2 * M_PI);
+}
+
+/// A packet that asked for an acknowledgment
+struct PendingAck {
+	uint64_t seqNumber;
+	uint64_t sent;
+};
+
+struct Pen {
+	explicit Pen(uint32_t seed) : strokes(seed)
+	{
+	}
+
+	int socket = -1;
+	StrokeGenerator strokes;
+	PacketEncoder encoder;
+	RateController rate;
+	ClockSync clock;
+
+	uint64_t seqNumber = 0;
+	/// The number of generated samples, for the schedule
+	uint64_t index = 0;
+	/// The offset of this pen in the period, to spread the pens (µs * rate)
+	uint64_t stagger = 0;
+	/// The time of the next sample, in µs
+	uint64_t next = 0;
+
+	Sample batch[PacketEncoder::maxSamples];
+	size_t count = 0;
+	uint64_t packets = 0;
+
+	/// The requests waiting for an acknowledgment, from the oldest
+	PendingAck acks[maxPendingAcks];
+	size_t ackHead = 0;
+	size_t ackCount = 0;
+};
+
+/// A thread that simulates some of the pens
+class Worker {
+public:
+	explicit Worker(const Settings &settings, uint32_t seed)
+		: mSettings(settings), mLinkRandom(seed)
+	{
+	}
+
+	Worker(const Worker &) = delete;
+	Worker &operator=(const Worker &) = delete;
+	~Worker();
+
+	/// Create the sockets of the pens
+	bool setup(unsigned int firstPen, unsigned int pens);
+
+	/// Send the samples from start to end, both in monotonic µs
+	void run(uint64_t start, uint64_t end);
+
+	Counters counters;
+	/// The round trips of the acknowledged packets
+	LatencyHistogram roundTrip;
+	/// From the samples to their arrival, according to the reports
+	LatencyHistogram oneWay;
+	/// How late the samples are generated, if the machine cannot keep up
+	LatencyHistogram lag;
+
+private:
+	uint64_t due(const Pen &pen) const
+	{
+		return mStart + (pen.index * 1000000 + pen.stagger) / mSettings.rate;
+	}
+
+	void generate(Pen &pen, uint64_t now);
+	void send(Pen &pen, uint64_t now);
+	void sendLegacy(Pen &pen, uint64_t now);
+	void transmit(Pen &pen, const void *data, size_t length,
+		uint64_t ackSeqNumber, uint64_t now);
+
+	/// Wait for the timer, and read the acknowledgments in the meantime
+	void wait(uint64_t until);
+	void receive(Pen &pen, uint64_t now);
+	void acknowledged(Pen &pen, uint64_t seqNumber, uint64_t now);
+
+	const Settings &mSettings;
+	std::vector<Pen> mPens;
+	/// Decides which packets the simulated link drops
+	std::mt19937 mLinkRandom;
+	uint64_t mStart = 0;
+
+	int mEpoll = -1;
+	int mTimer = -1;
+};
+
+Worker::~Worker()
+{
+	for (Pen &pen : mPens) {
+		if (pen.socket >= 0) {
+			close(pen.socket);
+		}
+	}
+	if (mTimer >= 0) {
+		close(mTimer);
+	}
+	if (mEpoll >= 0) {
+		close(mEpoll);
+	}
+}
+
+bool Worker::setup(unsigned int firstPen, unsigned int pens)
+{
+	mEpoll = epoll_create1(EPOLL_CLOEXEC);
+	if (mEpoll < 0) {
+		perror("Could not create the epoll instance");
+		return false;
+	}
+	mTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (mTimer < 0) {
+		perror("Could not create the timer");
+		return false;
+	}
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u32 = UINT32_MAX;
+	if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, mTimer, &ev)) {
+		perror("Could not add the timer to epoll");
+		return false;
+	}
+
+	mPens.reserve(pens);
+	for (unsigned int i = 0; i < pens; i++) {
+		const unsigned int id = firstPen + i;
+		mPens.emplace_back(id + 1);
+		Pen &pen = mPens.back();
+		pen.encoder.redundancy = mSettings.redundancy;
+		pen.stagger = uint64_t(id) * 1000000 / mSettings.pens;
+
+		pen.socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			0);
+		if (pen.socket < 0) {
+			perror("Could not open a socket");
+			return false;
+		}
+		// Connected sockets are cheaper, and get the errors of the server
+		if (connect(pen.socket, reinterpret_cast<sockaddr *>(
+				const_cast<sockaddr_in *>(&mSettings.server)),
+				sizeof(mSettings.server))) {
+			perror("Could not connect the socket");
+			return false;
+		}
+		ev.data.u32 = i;
+		if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, pen.socket, &ev)) {
+			perror("Could not add a socket to epoll");
+			return false;
+		}
+	}
+	return true;
+}
+
+void Worker::run(uint64_t start, uint64_t end)
+{
+	mStart = start;
+	for (Pen &pen : mPens) {
+		pen.next = due(pen);
+	}
+
+	uint64_t now = monotonicTime();
+	while (now < end) {
+		uint64_t wake = end;
+		for (Pen &pen : mPens) {
+			while (pen.next <= now) {
+				generate(pen, now);
+			}
+			wake = std::min(wake, pen.next);
+		}
+		wait(wake);
+		now = monotonicTime();
+	}
+
+	wait(now + ackDrain);
+	for (Pen &pen : mPens) {
+		increment(counters.ackLost, pen.ackCount);
+		increment(counters.levels, pen.rate.level());
+	}
+}
+
+void Worker::generate(Pen &pen, uint64_t now)
+{
+	Sample &sample = pen.batch[pen.count];
+	sample = pen.strokes.next(pen.next);
+	lag.record(now - pen.next);
+
+	pen.index++;
+	pen.next = due(pen);
+
+	if (mSettings.adaptive) {
+		pen.rate.update(now);
+		if (!pen.rate.decimate(&sample, 1)) {
+			increment(counters.decimated);
+			return;
+		}
+	}
+	sample.seqNumber = ++pen.seqNumber;
+	pen.count++;
+	increment(counters.samples);
+
+	if (mSettings.legacy) {
+		sendLegacy(pen, now);
+	} else if (pen.count >= mSettings.batch) {
+		send(pen, now);
+	}
+}
+
+void Worker::send(Pen &pen, uint64_t now)
+{
+	const Geometry geometry = {tabletWidth, tabletHeight, tabletPressure};
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+	size_t sent = 0;
+	while (sent < pen.count) {
+		if ((mSettings.ackEvery && !(pen.packets % mSettings.ackEvery))
+				|| (mSettings.adaptive && pen.rate.probeDue(now))) {
+			pen.encoder.ackRequest = true;
+			pen.encoder.sendClockOffset = pen.clock.valid();
+			pen.encoder.clockOffset = pen.clock.offset();
+		}
+		size_t count = pen.count - sent;
+		const size_t length = pen.encoder.encode(pen.batch + sent, count,
+			geometry, buffer, sizeof(buffer));
+		if (!length) {
+			break;
+		}
+		// Transitions ask for an acknowledgment, too
+		const uint64_t ackSeqNumber = ackRequested(buffer, length)
+			? pen.batch[sent + count - 1].seqNumber : 0;
+		transmit(pen, buffer, length, ackSeqNumber, now);
+		sent += count;
+	}
+	pen.count = 0;
+}
+
+void Worker::sendLegacy(Pen &pen, uint64_t now)
+{
+	const Geometry geometry = {tabletWidth, tabletHeight, tabletPressure};
+	uint8_t buffer[PacketV1Size];
+	const size_t length = encodePacketV1(pen.batch[0], geometry, buffer,
+		sizeof(buffer));
+	transmit(pen, buffer, length, 0, now);
+	pen.count = 0;
+}
+
+void Worker::transmit(Pen &pen, const void *data, size_t length,
+	uint64_t ackSeqNumber, uint64_t now)
+{
+	if (mSettings.loss > 0 && std::uniform_real_distribution<double>(0, 1)(
+			mLinkRandom) < mSettings.loss) {
+		// For the pen, the packet went out
+		increment(counters.linkDropped);
+	} else if (::send(pen.socket, data, length, 0) < 0) {
+		// Usually a full socket buffer: the machine cannot keep up
+		increment(counters.sendErrors);
+		return;
+	}
+	pen.packets++;
+	increment(counters.packets);
+	increment(counters.bytes, length);
+
+	if (!ackSeqNumber) {
+		return;
+	}
+	increment(counters.ackRequests);
+	if (mSettings.adaptive) {
+		pen.rate.probeSent(ackSeqNumber, now);
+	}
+	if (pen.ackCount == maxPendingAcks) {
+		// Nothing has been acknowledged for a long time
+		pen.ackHead = (pen.ackHead + 1) % maxPendingAcks;
+		pen.ackCount--;
+		increment(counters.ackLost);
+	}
+	PendingAck &ack = pen.acks[(pen.ackHead + pen.ackCount) % maxPendingAcks];
+	ack.seqNumber = ackSeqNumber;
+	ack.sent = now;
+	pen.ackCount++;
+}
+
+void Worker::wait(uint64_t until)
+{
+	itimerspec spec = {};
+	spec.it_value.tv_sec = until / 1000000;
+	spec.it_value.tv_nsec = (until % 1000000) * 1000;
+	if (timerfd_settime(mTimer, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+		perror("Could not set the timer");
+		return;
+	}
+
+	const int maxEvents = 64;
+	epoll_event events[maxEvents];
+	while (true) {
+		const int n = epoll_wait(mEpoll, events, maxEvents, -1);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait failed");
+			return;
+		}
+		const uint64_t now = monotonicTime();
+		bool expired = false;
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.u32 == UINT32_MAX) {
+				uint64_t expirations;
+				expired = read(mTimer, &expirations, sizeof(expirations)) > 0;
+			} else {
+				receive(mPens[events[i].data.u32], now);
+			}
+		}
+		if (expired) {
+			return;
+		}
+	}
+}
+
+void Worker::receive(Pen &pen, uint64_t now)
+{
+	uint8_t buffer[64];
+	while (true) {
+		const ssize_t length = recv(pen.socket, buffer, sizeof(buffer), 0);
+		if (length < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			// E.g., ECONNREFUSED when the server is not running: recv
+			// consumes the error, so try again
+			increment(counters.sendErrors);
+			continue;
+		}
+		FeedbackReport report;
+		if (!decodeReport(buffer, static_cast<size_t>(length), report)) {
+			continue;
+		}
+		acknowledged(pen, report.highestSeq, now);
+		if (pen.clock.add(report, now)) {
+			const int64_t delay = pen.clock.oneWay(report);
+			oneWay.record(delay > 0 ? static_cast<uint64_t>(delay) : 0);
+			if (mSettings.adaptive) {
+				pen.rate.reported(report, now);
+			}
+		}
+	}
+}
+
+void Worker::acknowledged(Pen &pen, uint64_t seqNumber, uint64_t now)
+{
+	if (mSettings.adaptive) {
+		pen.rate.acknowledged(seqNumber, now);
+	}
+	while (pen.ackCount) {
+		const PendingAck &ack = pen.acks[pen.ackHead];
+		if (ack.seqNumber > seqNumber) {
+			break;
+		}
+		if (ack.seqNumber == seqNumber) {
+			roundTrip.record(now - ack.sent);
+			increment(counters.acked);
+		} else {
+			// A newer packet was acknowledged, but not this one
+			increment(counters.ackLost);
+		}
+		pen.ackHead = (pen.ackHead + 1) % maxPendingAcks;
+		pen.ackCount--;
+	}
+}
+
+void usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+		"Simulate pens that draw on a NetStylus server.\n\n"
+		"  -s, --server ADDR  The IPv4 address of the server (default "
+		"127.0.0.1)\n"
+		"  -p, --port PORT    The port of the server (default 4642)\n"
+		"  -n, --pens N       The number of pens (max %lu; the evdev server "
+		"accepts 64)\n"
+		"  -r, --rate HZ      The samples per second of each pen "
+		"(default 240, max %lu)\n"
+		"  -b, --batch N      The samples per packet (default 1, max %zu)\n"
+		"  -d, --duration S   How long to send, in seconds (default 10)\n"
+		"  -t, --threads N    The threads that send the packets (default 1)\n"
+		"  -a, --ack-every N  Ask for an acknowledgment every N packets "
+		"(default 10,\n"
+		"                     0 only for transitions)\n"
+		"  -R, --redundancy N Repeat the previous N samples in each packet\n"
+		"  -l, --legacy       Send version 1 packets (no acknowledgments)\n"
+		"  -L, --loss PERCENT Drop this percentage of the packets, to "
+		"simulate a lossy\n"
+		"                     link\n"
+		"  -A, --adaptive     Thin the samples in the air when the link is "
+		"congested\n"
+		"  -h, --help         Show this message\n", program, maxPens, maxRate,
+		PacketEncoder::maxSamples);
+}
+
+/// Parse a number in [min, max], return false if it is not valid
+bool parseNumber(const char *arg, unsigned long min, unsigned long max,
+	unsigned int &value)
+{
+	char *end;
+	const unsigned long parsed = strtoul(arg, &end, 10);
+	if (!*arg || *end || parsed < min || parsed > max) {
+		return false;
+	}
+	value = static_cast<unsigned int>(parsed);
+	return true;
+}
+
+bool parse(int argc, char **argv, Settings &settings)
+{
+	static const option longOptions[] = {
+		{"server", required_argument, nullptr, 's'},
+		{"port", required_argument, nullptr, 'p'},
+		{"pens", required_argument, nullptr, 'n'},
+		{"rate", required_argument, nullptr, 'r'},
+		{"batch", required_argument, nullptr, 'b'},
+		{"duration", required_argument, nullptr, 'd'},
+		{"threads", required_argument, nullptr, 't'},
+		{"ack-every", required_argument, nullptr, 'a'},
+		{"redundancy", required_argument, nullptr, 'R'},
+		{"legacy", no_argument, nullptr, 'l'},
+		{"loss", required_argument, nullptr, 'L'},
+		{"adaptive", no_argument, nullptr, 'A'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	settings.server.sin_family = AF_INET;
+	settings.server.sin_port = htons(4642);
+	settings.server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	unsigned int port;
+	unsigned int loss;
+	int opt;
+	const char *shortOptions = "s:p:n:r:b:d:t:a:R:lL:Ah";
+	while ((opt = getopt_long(argc, argv, shortOptions, longOptions,
+			nullptr)) != -1) {
+		bool valid = true;
+		switch (opt) {
+		case 's':
+			valid = inet_pton(AF_INET, optarg,
+				&settings.server.sin_addr) == 1;
+			break;
+		case 'p':
+			valid = parseNumber(optarg, 1, 65535, port);
+			settings.server.sin_port = htons(static_cast<uint16_t>(port));
+			break;
+		case 'n':
+			valid = parseNumber(optarg, 1, maxPens, settings.pens);
+			break;
+		case 'r':
+			valid = parseNumber(optarg, 1, maxRate, settings.rate);
+			break;
+		case 'b':
+			valid = parseNumber(optarg, 1, PacketEncoder::maxSamples,
+				settings.batch);
+			break;
+		case 'd':
+			valid = parseNumber(optarg, 1, maxSeconds, settings.seconds);
+			break;
+		case 't':
+			valid = parseNumber(optarg, 1, maxThreads, settings.threads);
+			break;
+		case 'a':
+			valid = parseNumber(optarg, 0, UINT32_MAX, settings.ackEvery);
+			break;
+		case 'R':
+			valid = parseNumber(optarg, 0, PacketEncoder::maxRedundancy,
+				settings.redundancy);
+			break;
+		case 'l':
+			settings.legacy = true;
+			break;
+		case 'L':
+			valid = parseNumber(optarg, 0, 100, loss);
+			settings.loss = loss / 100.0;
+			break;
+		case 'A':
+			settings.adaptive = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(0);
+		default:
+			usage(argv[0]);
+			return false;
+		}
+		if (!valid) {
+			fprintf(stderr, "Invalid argument: %s\n", optarg);
+			return false;
+		}
+	}
+	if (optind < argc) {
+		usage(argv[0]);
+		return false;
+	}
+	if (settings.legacy && settings.adaptive) {
+		fputs("Version 1 packets cannot measure the link\n", stderr);
+		return false;
+	}
+	settings.threads = std::min(settings.threads, settings.pens);
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Settings settings;
+	if (!parse(argc, argv, settings)) {
+		return 1;
+	}
+
+	char address[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &settings.server.sin_addr, address, sizeof(address));
+	printf("%u pens at %u Hz, %u samples per packet, for %us, to %s:%u\n",
+		settings.pens, settings.rate, settings.legacy ? 1 : settings.batch,
+		settings.seconds, address, ntohs(settings.server.sin_port));
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	unsigned int firstPen = 0;
+	for (unsigned int i = 0; i < settings.threads; i++) {
+		const unsigned int pens = (settings.pens - firstPen)
+			/ (settings.threads - i);
+		workers.push_back(std::make_unique<Worker>(settings, i + 1));
+		if (!workers.back()->setup(firstPen, pens)) {
+			return 1;
+		}
+		firstPen += pens;
+	}
+
+	// Give the threads the time to start
+	const uint64_t start = monotonicTime() + 100000;
+	const uint64_t end = start + settings.seconds * uint64_t(1000000);
+	std::vector<std::thread> threads;
+	for (auto &worker : workers) {
+		threads.emplace_back(&Worker::run, worker.get(), start, end);
+	}
+
+	uint64_t lastPackets = 0;
+	uint64_t lastSamples = 0;
+	for (unsigned int second = 1; second <= settings.seconds; second++) {
+		const uint64_t wake = start + second * uint64_t(1000000);
+		const uint64_t now = monotonicTime();
+		if (wake > now) {
+			usleep(static_cast<useconds_t>(wake - now));
+		}
+		uint64_t packets = 0;
+		uint64_t samples = 0;
+		uint64_t errors = 0;
+		for (auto &worker : workers) {
+			packets += get(worker->counters.packets);
+			samples += get(worker->counters.samples);
+			errors += get(worker->counters.sendErrors);
+		}
+		printf("%3us: %" PRIu64 " packets/s, %" PRIu64 " samples/s, %" PRIu64
+			" errors\n", second, packets - lastPackets, samples - lastSamples,
+			errors);
+		fflush(stdout);
+		lastPackets = packets;
+		lastSamples = samples;
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	uint64_t samples = 0, packets = 0, bytes = 0, errors = 0;
+	uint64_t ackRequests = 0, acked = 0, ackLost = 0;
+	uint64_t linkDropped = 0, decimated = 0, levels = 0;
+	LatencyHistogram roundTrip, oneWay, lag;
+	for (auto &worker : workers) {
+		samples += get(worker->counters.samples);
+		packets += get(worker->counters.packets);
+		bytes += get(worker->counters.bytes);
+		errors += get(worker->counters.sendErrors);
+		ackRequests += get(worker->counters.ackRequests);
+		acked += get(worker->counters.acked);
+		ackLost += get(worker->counters.ackLost);
+		linkDropped += get(worker->counters.linkDropped);
+		decimated += get(worker->counters.decimated);
+		levels += get(worker->counters.levels);
+		roundTrip.merge(worker->roundTrip);
+		oneWay.merge(worker->oneWay);
+		lag.merge(worker->lag);
+	}
+
+	const double seconds = settings.seconds;
+	printf("Sent %" PRIu64 " samples in %" PRIu64 " packets: %.0f packets/s, "
+		"%.0f samples/s, %.1f kB/s, %" PRIu64 " errors\n", samples, packets,
+		packets / seconds, samples / seconds, bytes / seconds / 1000, errors);
+	if (ackRequests) {
+		printf("Acknowledgments: %" PRIu64 " requested, %" PRIu64
+			" received, %" PRIu64 " lost (%.2f%%)\n", ackRequests, acked,
+			ackLost, 100.0 * ackLost / ackRequests);
+	}
+	if (settings.loss > 0) {
+		printf("The simulated link dropped %" PRIu64 " packets\n",
+			linkDropped);
+	}
+	if (settings.adaptive) {
+		printf("Decimated %" PRIu64 " samples in the air (%.1f%%), final "
+			"congestion level %.2f\n", decimated,
+			100.0 * decimated / std::max<uint64_t>(samples + decimated, 1),
+			static_cast<double>(levels) / settings.pens);
+	}
+	roundTrip.print("Round trip");
+	if (oneWay.count()) {
+		oneWay.print("One-way latency");
+	}
+	lag.print("Sender lag");
+	return 0;
+}
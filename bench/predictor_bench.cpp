@@ -0,0 +1,280 @@
+/**
+ * Benchmark of the stroke prediction of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains predictor-bench, a tool that measures how far the
+ * predictions of the server are from the real stroke, and how long they take.
+ *
+ * The strokes are synthetic, so the true position at the predicted time is
+ * known exactly: a straight line, a circle, a scribble that keeps changing
+ * speed and direction, and a line that stops suddenly. The digitizer adds a
+ * uniform jitter to every sample.
+ * For each stroke and horizon, the tool prints the distance of the predictions
+ * from the true position, and the one of the last real sample, which is what
+ * the server injects without prediction.
+ *
+ * To compile and run:
+ *   g++ -O2 -I../common/ -I../evdev/ predictor_bench.cpp \
+ *     ../evdev/predictor.cpp ../evdev/stats.cpp -o predictor-bench \
+ *     && ./predictor-bench
+ */
+
+#include <clock.h>
+#include <predictor.h>
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+/// The strokes, as positions in device units (mm * 100) at a time in seconds
+enum Stroke {
+	Line,
+	Circle,
+	Scribble,
+	Stop,
+	Strokes,
+};
+const char *strokeNames[Strokes] = {"line", "circle", "scribble", "stop"};
+
+/// The length of each stroke, in seconds
+const double strokeLength = 2;
+
+/// The samples predicted to measure the cost
+const uint64_t timedSamples = 20000000;
+
+const Geometry geometry = {60000, 40000, 4096};
+
+void position(Stroke stroke, double t, double &x, double &y)
+{
+	const double pi = 3.141592653589793;
+	switch (stroke) {
+	case Line:
+		// 100 mm/s
+		x = 10000 + 10000 * t;
+		y = 10000 + 5000 * t;
+		break;
+	case Circle:
+		// 20 mm of radius, one turn per second
+		x = 30000 + 2000 * std::cos(2 * pi * t);
+		y = 20000 + 2000 * std::sin(2 * pi * t);
+		break;
+	case Scribble:
+		x = 30000 + 3000 * std::sin(2 * pi * 1.3 * t)
+			+ 1000 * std::sin(2 * pi * 3.7 * t);
+		y = 20000 + 2500 * std::sin(2 * pi * 2.1 * t + 1)
+			+ 800 * std::cos(2 * pi * 4.3 * t);
+		break;
+	case Stop:
+		// 150 mm/s for the first half, then still
+		t = std::min(t, strokeLength / 2);
+		x = 10000 + 15000 * t;
+		y = 20000;
+		break;
+	default:
+		x = y = 0;
+	}
+}
+
+struct Settings {
+	unsigned int rate = 240;
+	/// The largest jitter of the digitizer, in device units
+	double jitter = 2;
+	/// The horizons to measure, in ms
+	std::vector<unsigned int> horizons = {4, 8, 16, 32};
+};
+
+/// The samples of a stroke, with the time in µs
+std::vector<Sample> makeSamples(const Settings &settings, Stroke stroke)
+{
+	std::mt19937 random(12);
+	std::uniform_real_distribution<double> jitter(-settings.jitter,
+		settings.jitter);
+	const size_t count = static_cast<size_t>(strokeLength * settings.rate);
+	std::vector<Sample> samples(count);
+	for (size_t i = 0; i < count; i++) {
+		double x, y;
+		position(stroke, static_cast<double>(i) / settings.rate, x, y);
+		Sample &s = samples[i];
+		s.seqNumber = i + 1;
+		s.status = PacketIsTouching | PacketHasPressure;
+		s.x = static_cast<uint32_t>(std::lround(x + jitter(random)));
+		s.y = static_cast<uint32_t>(std::lround(y + jitter(random)));
+		s.pressure = 2000;
+		s.timestamp = 1000000 + i * 1000000 / settings.rate;
+	}
+	return samples;
+}
+
+/// The distances from the true position, in device units
+struct Errors {
+	std::vector<double> values;
+
+	void add(double error)
+	{
+		values.push_back(error);
+	}
+
+	void print()
+	{
+		std::sort(values.begin(), values.end());
+		double sum = 0;
+		for (double v : values) {
+			sum += v;
+		}
+		const size_t n = values.size();
+		printf(" %7.1f %7.1f %7.1f", n ? sum / n : 0,
+			n ? values[n * 95 / 100] : 0, n ? values.back() : 0);
+	}
+};
+
+void measureErrors(const Settings &settings)
+{
+	printf("                   Predicted               Last sample\n"
+		"Stroke    Ahead    mean     p95     max     mean     p95     max\n");
+	for (int s = 0; s < Strokes; s++) {
+		const Stroke stroke = static_cast<Stroke>(s);
+		const std::vector<Sample> samples = makeSamples(settings, stroke);
+		for (unsigned int ms : settings.horizons) {
+			const uint64_t horizon = ms * 1000;
+			Predictor predictor(horizon);
+			Errors predicted, last;
+			for (const Sample &sample : samples) {
+				const Sample out = predictor.predict(sample, sample.timestamp,
+					geometry);
+				double x, y;
+				position(stroke, (sample.timestamp + horizon - 1000000) * 1e-6,
+					x, y);
+				predicted.add(std::hypot(out.x - x, out.y - y));
+				last.add(std::hypot(sample.x - x, sample.y - y));
+			}
+			printf("%-9s %3ums", strokeNames[s], ms);
+			predicted.print();
+			printf(" ");
+			last.print();
+			printf("\n");
+		}
+	}
+	printf("(device units, i.e. 10 µm)\n");
+}
+
+/// The cost of a prediction, in ns per sample
+double measureCost(const Settings &settings)
+{
+	const std::vector<Sample> samples = makeSamples(settings, Scribble);
+	Predictor predictor(settings.horizons.back() * 1000);
+	const uint64_t strokeTime = samples.back().timestamp
+		- samples.front().timestamp + 1000000 / settings.rate;
+	uint64_t checksum = 0;
+	const uint64_t start = monotonicTime();
+	for (uint64_t i = 0; i < timedSamples; i++) {
+		Sample sample = samples[i % samples.size()];
+		sample.timestamp += i / samples.size() * strokeTime;
+		const Sample out = predictor.predict(sample, sample.timestamp,
+			geometry);
+		checksum += out.x + out.y;
+	}
+	const uint64_t elapsed = monotonicTime() - start;
+	// Do not let the compiler skip the loop
+	if (checksum == 42) {
+		puts("");
+	}
+	return elapsed * 1000.0 / timedSamples;
+}
+
+void usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+		"Measure the predictions of the evdev server on synthetic strokes.\n\n"
+		"  -a, --ahead MS      Measure only this horizon (default 4, 8, 16 "
+		"and 32)\n"
+		"  -r, --rate HZ       The samples per second (default 240)\n"
+		"  -j, --jitter UNITS  The jitter of the digitizer, in device units "
+		"(default 2)\n"
+		"  -h, --help          Show this message\n", program);
+}
+
+bool parse(int argc, char **argv, Settings &settings)
+{
+	static const option longOptions[] = {
+		{"ahead", required_argument, nullptr, 'a'},
+		{"rate", required_argument, nullptr, 'r'},
+		{"jitter", required_argument, nullptr, 'j'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "a:r:j:h", longOptions,
+			nullptr)) != -1) {
+		char *end;
+		double value = 0;
+		if (optarg) {
+			value = strtod(optarg, &end);
+			if (!*optarg || *end || !(value >= 0)) {
+				fprintf(stderr, "Invalid value: %s\n", optarg);
+				return false;
+			}
+		}
+		switch (opt) {
+		case 'a':
+			if (value < 1 || value > 100) {
+				fprintf(stderr, "Invalid horizon: %s\n", optarg);
+				return false;
+			}
+			settings.horizons = {static_cast<unsigned int>(value)};
+			break;
+		case 'r':
+			if (value < 1 || value > 2000) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return false;
+			}
+			settings.rate = static_cast<unsigned int>(value);
+			break;
+		case 'j':
+			settings.jitter = value;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(0);
+		default:
+			usage(argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Settings settings;
+	if (!parse(argc, argv, settings)) {
+		return 1;
+	}
+
+	printf("%u samples per second, jitter ±%g device units\n\n",
+		settings.rate, settings.jitter);
+	measureErrors(settings);
+	printf("\nCost: %.2f ns per sample\n", measureCost(settings));
+	return 0;
+}
@@ -0,0 +1,217 @@
+/**
+ * Benchmark of the conversion of tablet packets of the NetStylus client
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains sample-converter-bench, a tool that measures how long
+ * the client takes to convert the packets of RealTimeStylus to samples.
+ *
+ * It compares SampleConverter with the conversion that the client did before
+ * it: a lookup of the tablet for each batch, then a division in double and a
+ * branch for each optional property of each packet.
+ *
+ * To compile and run:
+ *   g++ -O2 -I../common/ -I../evdev/ sample_converter_bench.cpp \
+ *     ../common/sample_converter.cpp -o sample-converter-bench \
+ *     && ./sample-converter-bench
+ */
+
+#include <clock.h>
+#include <sample_converter.h>
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+/// The packets converted for each measure
+const uint64_t timedPackets = 100000000;
+
+/// The packets of the simulated stroke, they fit the cache
+const size_t strokePackets = 4096;
+
+/// The properties of a Surface pen: x, y, status, pressure, tilt x and y
+const size_t stride = 6;
+
+/// The divisors of the coordinates of a 96 DPI screen
+const double scaleX = 0.2645833;
+const double scaleY = 0.2645833;
+
+/// The tablet as the client kept it before SampleConverter
+struct LegacyTablet {
+	int x;
+	int y;
+	int status;
+	int pressure;
+	int tiltX;
+	int tiltY;
+	int32_t maxPressure;
+};
+
+void convertLegacy(const std::unordered_map<uint32_t, LegacyTablet> &contexts,
+	uint32_t tcid, const int32_t *packets, size_t count, uint64_t seqNumber,
+	Sample *samples)
+{
+	auto it = contexts.find(tcid);
+	if (it == contexts.end()) {
+		return;
+	}
+
+	const uint16_t statusMask = PacketIsTouching | PacketIsEraser
+		| PacketButtonPressed;
+	const LegacyTablet &tablet = it->second;
+	for (size_t i = 0; i < count; i++, packets += stride) {
+		Sample &s = samples[i];
+		s = {};
+		s.status = static_cast<uint16_t>(packets[tablet.status] & statusMask);
+		s.x = static_cast<uint32_t>(packets[tablet.x] / scaleX);
+		s.y = static_cast<uint32_t>(packets[tablet.y] / scaleY);
+		if (tablet.pressure >= 0) {
+			s.status |= PacketHasPressure;
+			s.pressure = static_cast<uint32_t>(packets[tablet.pressure]);
+		}
+		if (tablet.tiltX >= 0) {
+			s.status |= PacketHasTiltX;
+			s.tiltX = static_cast<uint32_t>(packets[tablet.tiltX]);
+		}
+		if (tablet.tiltY >= 0) {
+			s.status |= PacketHasTiltY;
+			s.tiltY = static_cast<uint32_t>(packets[tablet.tiltY]);
+		}
+		s.seqNumber = seqNumber + i;
+	}
+}
+
+std::vector<int32_t> makeStroke()
+{
+	std::mt19937 random(19);
+	std::uniform_int_distribution<int32_t> jitter(-3, 3);
+	std::vector<int32_t> packets(strokePackets * stride);
+	for (size_t i = 0; i < strokePackets; i++) {
+		int32_t *p = &packets[i * stride];
+		p[0] = static_cast<int32_t>(5000 + (i * 7) % 20000) + jitter(random);
+		p[1] = static_cast<int32_t>(3000 + (i * 5) % 15000) + jitter(random);
+		p[2] = i % 500 < 400 ? PacketIsTouching : 0;
+		p[3] = p[2] ? static_cast<int32_t>(i % 4096) : 0;
+		p[4] = static_cast<int32_t>(i % 90) - 45;
+		p[5] = static_cast<int32_t>(i % 60) - 30;
+	}
+	return packets;
+}
+
+/// The cost of a conversion, in ns per packet
+template<typename Convert>
+double measure(const std::vector<int32_t> &stroke, size_t batch,
+	Convert convert)
+{
+	std::vector<Sample> samples(batch);
+	uint64_t checksum = 0;
+	const size_t batches = strokePackets / batch;
+	const uint64_t rounds = timedPackets / (batches * batch);
+	const uint64_t start = monotonicTime();
+	for (uint64_t round = 0; round < rounds; round++) {
+		for (size_t i = 0; i < batches; i++) {
+			convert(&stroke[i * batch * stride], batch, samples.data());
+			checksum += samples[batch - 1].x + samples[0].pressure;
+		}
+	}
+	const uint64_t elapsed = monotonicTime() - start;
+	// Do not let the compiler skip the loop
+	if (checksum == 42) {
+		puts("");
+	}
+	return elapsed * 1000.0 / (rounds * batches * batch);
+}
+
+void usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+		"Measure the conversion of RealTimeStylus packets to samples.\n\n"
+		"  -b, --batch COUNT   The packets of each callback (default 8)\n"
+		"  -h, --help          Show this message\n", program);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	static const option longOptions[] = {
+		{"batch", required_argument, nullptr, 'b'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	size_t batch = 8;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "b:h", longOptions, nullptr))
+			!= -1) {
+		switch (opt) {
+		case 'b': {
+			char *end;
+			const long value = strtol(optarg, &end, 10);
+			if (!*optarg || *end || value < 1
+					|| static_cast<size_t>(value) > strokePackets) {
+				fprintf(stderr, "Invalid batch: %s\n", optarg);
+				return 1;
+			}
+			batch = static_cast<size_t>(value);
+			break;
+		}
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	const std::vector<int32_t> stroke = makeStroke();
+
+	// The client has usually a handful of tablets
+	std::unordered_map<uint32_t, LegacyTablet> contexts;
+	for (uint32_t tcid = 1; tcid <= 4; tcid++) {
+		contexts[tcid] = {0, 1, 2, 3, 4, 5, 4096};
+	}
+	const double legacy = measure(stroke, batch,
+		[&](const int32_t *packets, size_t count, Sample *samples) {
+			convertLegacy(contexts, 3, packets, count, 1, samples);
+		});
+
+	PacketLayout layout;
+	layout.x = 0;
+	layout.y = 1;
+	layout.status = 2;
+	layout.pressure = 3;
+	layout.tiltX = 4;
+	layout.tiltY = 5;
+	layout.maxPressure = 4096;
+	SampleConverter converter(layout);
+	converter.setScale(scaleX, scaleY);
+	const double converted = measure(stroke, batch,
+		[&](const int32_t *packets, size_t count, Sample *samples) {
+			converter.convert(packets, count, stride, 1, 1000000, 4167,
+				samples);
+		});
+
+	printf("Batches of %zu packets\n", batch);
+	printf("Per packet, with branches and double: %6.2f ns\n", legacy);
+	printf("SampleConverter:                      %6.2f ns\n", converted);
+	return 0;
+}
@@ -0,0 +1,293 @@
+/**
+ * Benchmark of the stroke smoothing of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains stroke-filter-bench, a tool that measures the cost of the
+ * One-Euro filter of the server for each sample, and what it does to a
+ * synthetic stroke.
+ *
+ * The stroke repeats four phases: the stylus stops, it rests on a point, then
+ * it moves slowly, then it flicks fast along a line. The first phase is when
+ * the filter settles after the flick. The digitizer adds a uniform jitter to
+ * every sample. For each phase, the tool prints the error from the true
+ * position before and after the filter, and how far the filtered samples are
+ * behind, also as time.
+ *
+ * To compile and run:
+ *   g++ -O2 -I../common/ -I../evdev/ stroke_filter_bench.cpp \
+ *     ../evdev/stroke_filter.cpp -o stroke-filter-bench \
+ *     && ./stroke-filter-bench
+ */
+
+#include <clock.h>
+#include <stroke_filter.h>
+
+#include <getopt.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+/// The phases of the stroke, and their length in seconds
+enum Phase {
+	Settle,
+	Rest,
+	Slow,
+	Fast,
+	Phases,
+};
+const char *phaseNames[Phases] = {"settle", "rest", "slow", "fast"};
+const double phaseLength[Phases] = {0.2, 0.5, 0.5, 0.25};
+
+/// The speeds of the phases, in device units per second
+const double phaseSpeed[Phases] = {0, 0, 2000, 100000};
+
+/// The samples of the stroke used to measure the cost
+const size_t strokeSamples = 1 << 16;
+
+/// The samples filtered to measure the cost
+const uint64_t timedSamples = 50000000;
+
+struct Settings {
+	StrokeFilter::Settings filter;
+	unsigned int rate = 240;
+	/// The largest jitter of the digitizer, in device units
+	double jitter = 4;
+};
+
+/// A sample of the digitizer, with the position without jitter
+struct TrueSample {
+	Sample sample;
+	double x;
+	double y;
+	Phase phase;
+};
+
+std::vector<TrueSample> makeStroke(const Settings &settings, size_t count)
+{
+	std::mt19937 random(42);
+	std::uniform_real_distribution<double> jitter(-settings.jitter,
+		settings.jitter);
+	const double interval = 1.0 / settings.rate;
+
+	std::vector<TrueSample> stroke(count);
+	double x = 10000, y = 10000, direction = 1;
+	Phase phase = Settle;
+	double phaseTime = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (phaseTime >= phaseLength[phase]) {
+			phase = static_cast<Phase>((phase + 1) % Phases);
+			phaseTime = 0;
+			if (phase == Slow) {
+				// Stay inside the device
+				direction = x > 32768 ? -1 : 1;
+			}
+		}
+		x += direction * phaseSpeed[phase] * interval * 0.8;
+		y += direction * phaseSpeed[phase] * interval * 0.6;
+		phaseTime += interval;
+
+		TrueSample &s = stroke[i];
+		s.x = x;
+		s.y = y;
+		s.phase = phase;
+		s.sample = {};
+		s.sample.status = PacketIsTouching | PacketHasPressure;
+		s.sample.x = static_cast<uint32_t>(std::lround(x + jitter(random)));
+		s.sample.y = static_cast<uint32_t>(std::lround(y + jitter(random)));
+		s.sample.pressure = 30000;
+		s.sample.timestamp = static_cast<uint64_t>(std::llround(i * 1e6
+			/ settings.rate));
+	}
+	return stroke;
+}
+
+/// The cost of the filter, in ns per sample
+double measureCost(const Settings &settings,
+	const std::vector<TrueSample> &stroke, bool enabled)
+{
+	StrokeFilter filter(settings.filter);
+	const uint64_t strokeTime = stroke.back().sample.timestamp
+		+ 1000000 / settings.rate;
+	uint64_t checksum = 0;
+	const uint64_t start = monotonicTime();
+	for (uint64_t i = 0; i < timedSamples; i++) {
+		const size_t index = i % stroke.size();
+		Sample sample = stroke[index].sample;
+		sample.timestamp += i / stroke.size() * strokeTime;
+		if (enabled) {
+			filter.apply(sample, sample.timestamp);
+		}
+		checksum += sample.x + sample.y;
+	}
+	const uint64_t elapsed = monotonicTime() - start;
+	// Do not let the compiler skip the loop
+	if (checksum == 42) {
+		puts("");
+	}
+	return elapsed * 1000.0 / timedSamples;
+}
+
+void measureStroke(const Settings &settings,
+	const std::vector<TrueSample> &stroke)
+{
+	struct Errors {
+		double raw = 0; ///< Squared distances from the true positions
+		double filtered = 0;
+		double lag = 0; ///< Along the motion, in device units
+		uint64_t samples = 0;
+	} errors[Phases];
+
+	StrokeFilter filter(settings.filter);
+	for (const TrueSample &s : stroke) {
+		Sample sample = s.sample;
+		filter.apply(sample, sample.timestamp);
+		const double rawX = s.sample.x - s.x, rawY = s.sample.y - s.y;
+		const double dx = sample.x - s.x, dy = sample.y - s.y;
+		Errors &e = errors[s.phase];
+		e.raw += rawX * rawX + rawY * rawY;
+		e.filtered += dx * dx + dy * dy;
+		// The motion is along (0.8, 0.6) or its opposite
+		e.lag += std::fabs(dx * 0.8 + dy * 0.6);
+		e.samples++;
+	}
+
+	printf("Phase   Speed (u/s)  RMS raw  RMS filtered  Lag (u)  Lag (ms)\n");
+	for (int i = 0; i < Phases; i++) {
+		const Errors &e = errors[i];
+		if (!e.samples) {
+			continue;
+		}
+		const double lag = e.lag / e.samples;
+		printf("%-7s %11.0f %8.2f %13.2f %8.2f", phaseNames[i],
+			phaseSpeed[i], std::sqrt(e.raw / e.samples),
+			std::sqrt(e.filtered / e.samples), lag);
+		if (phaseSpeed[i] > 0) {
+			printf(" %9.3f\n", lag / phaseSpeed[i] * 1000);
+		} else {
+			printf("         -\n");
+		}
+	}
+}
+
+void usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+		"Measure the One-Euro filter of the evdev server on a synthetic "
+		"stroke.\n\n"
+		"  -m, --min-cutoff HZ The cutoff at rest (default 1)\n"
+		"  -b, --beta BETA     The growth of the cutoff with the speed "
+		"(default 0.005)\n"
+		"  -d, --dcutoff HZ    The cutoff of the speed (default 1)\n"
+		"  -r, --rate HZ       The samples per second (default 240)\n"
+		"  -j, --jitter UNITS  The jitter of the digitizer, in device units "
+		"(default 4)\n"
+		"  -h, --help          Show this message\n", program);
+}
+
+bool parse(int argc, char **argv, Settings &settings)
+{
+	static const option longOptions[] = {
+		{"min-cutoff", required_argument, nullptr, 'm'},
+		{"beta", required_argument, nullptr, 'b'},
+		{"dcutoff", required_argument, nullptr, 'd'},
+		{"rate", required_argument, nullptr, 'r'},
+		{"jitter", required_argument, nullptr, 'j'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	StrokeFilter::Parameters parameters;
+	parameters.minCutoff = 1;
+	parameters.beta = 0.005;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "m:b:d:r:j:h", longOptions,
+			nullptr)) != -1) {
+		char *end;
+		double value = 0;
+		if (optarg) {
+			value = strtod(optarg, &end);
+			if (!*optarg || *end || !(value >= 0)) {
+				fprintf(stderr, "Invalid value: %s\n", optarg);
+				return false;
+			}
+		}
+		switch (opt) {
+		case 'm':
+			parameters.minCutoff = value;
+			break;
+		case 'b':
+			parameters.beta = value;
+			break;
+		case 'd':
+			parameters.derivativeCutoff = value;
+			break;
+		case 'r':
+			if (value < 1 || value > 2000) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return false;
+			}
+			settings.rate = static_cast<unsigned int>(value);
+			break;
+		case 'j':
+			settings.jitter = value;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(0);
+		default:
+			usage(argv[0]);
+			return false;
+		}
+	}
+
+	if (!parameters.enabled() || !(parameters.derivativeCutoff > 0)) {
+		fputs("The cutoffs must be positive\n", stderr);
+		return false;
+	}
+	settings.filter.x = parameters;
+	settings.filter.y = parameters;
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Settings settings;
+	if (!parse(argc, argv, settings)) {
+		return 1;
+	}
+
+	const StrokeFilter::Parameters &p = settings.filter.x;
+	printf("One-Euro filter on x and y: min cutoff %g Hz, beta %g, "
+		"derivative cutoff %g Hz\n", p.minCutoff, p.beta, p.derivativeCutoff);
+	printf("%u samples per second, jitter ±%g device units\n\n",
+		settings.rate, settings.jitter);
+
+	const std::vector<TrueSample> stroke = makeStroke(settings,
+		strokeSamples);
+	measureStroke(settings, stroke);
+
+	const double base = measureCost(settings, stroke, false);
+	const double cost = measureCost(settings, stroke, true);
+	printf("\nCost: %.2f ns per sample (%.2f ns for the loop without the "
+		"filter)\n", cost - base, base);
+	return 0;
+}
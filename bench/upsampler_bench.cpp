@@ -0,0 +1,211 @@
+/**
+ * Benchmark of the fixed-rate upsampling of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains upsampler-bench, a tool that measures the cost of the
+ * interpolation of the upsampler for each output sample, and how far the
+ * interpolated samples are from the real stroke.
+ *
+ * The stroke is a scribble that keeps changing speed and direction, sampled
+ * by the digitizer at its rate without jitter, so that the error is only the
+ * one of the interpolation. It is lifted every second, so the measure includes
+ * the ends of the strokes, too.
+ *
+ * To compile and run:
+ *   g++ -O2 -I../common/ -I../evdev/ upsampler_bench.cpp \
+ *     ../evdev/upsampler.cpp -o upsampler-bench && ./upsampler-bench
+ */
+
+#include <clock.h>
+#include <upsampler.h>
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+/// The length of the stroke used for the errors, in seconds
+const double strokeLength = 10;
+
+/// The real samples pushed to measure the cost
+const uint64_t timedSamples = 10000000;
+
+const Geometry geometry = {60000, 40000, 4096};
+
+const unsigned int outputRates[] = {250, 500, 1000};
+
+const struct {
+	const char *name;
+	Upsampler::Interpolation interpolation;
+} interpolations[] = {
+	{"linear", Upsampler::Interpolation::Linear},
+	{"catmull-rom", Upsampler::Interpolation::CatmullRom},
+};
+
+/// The true position of the stylus, in device units, at a time in µs
+void position(uint64_t time, double &x, double &y, double &pressure)
+{
+	const double pi = 3.141592653589793;
+	const double t = time * 1e-6;
+	x = 30000 + 3000 * std::sin(2 * pi * 1.3 * t)
+		+ 1000 * std::sin(2 * pi * 3.7 * t);
+	y = 20000 + 2500 * std::sin(2 * pi * 2.1 * t + 1)
+		+ 800 * std::cos(2 * pi * 4.3 * t);
+	pressure = 2000 + 1000 * std::sin(2 * pi * 0.9 * t);
+}
+
+std::vector<Sample> makeStroke(unsigned int rate, double length)
+{
+	const size_t count = static_cast<size_t>(length * rate);
+	std::vector<Sample> samples(count);
+	for (size_t i = 0; i < count; i++) {
+		Sample &s = samples[i];
+		s.seqNumber = i + 1;
+		s.timestamp = 1000000 + i * 1000000 / rate;
+		double x, y, pressure;
+		position(s.timestamp, x, y, pressure);
+		// Lifted for the last tenth of each second
+		const bool touching = (s.timestamp / 1000) % 1000 < 900;
+		s.status = PacketHasPressure | (touching ? PacketIsTouching : 0);
+		s.x = static_cast<uint32_t>(std::lround(x));
+		s.y = static_cast<uint32_t>(std::lround(y));
+		s.pressure = touching ? static_cast<uint32_t>(std::lround(pressure))
+			: 0;
+	}
+	return samples;
+}
+
+/// The error of the interpolated samples, in device units
+void measureErrors(const std::vector<Sample> &stroke,
+	Upsampler::Interpolation interpolation, unsigned int rate)
+{
+	Upsampler upsampler(rate, interpolation);
+	Sample output[Upsampler::maxOutput];
+	std::vector<double> errors;
+	double pressureErrors = 0;
+	for (const Sample &sample : stroke) {
+		const size_t count = upsampler.push(sample, geometry, output);
+		for (size_t i = 0; i < count; i++) {
+			const Sample &s = output[i];
+			if (!(s.status & PacketIsTouching)) {
+				continue;
+			}
+			double x, y, pressure;
+			position(s.timestamp, x, y, pressure);
+			errors.push_back(std::hypot(s.x - x, s.y - y));
+			pressureErrors += std::fabs(s.pressure - pressure);
+		}
+	}
+
+	std::sort(errors.begin(), errors.end());
+	double sum = 0;
+	for (double e : errors) {
+		sum += e;
+	}
+	const size_t n = errors.size();
+	printf(" %7.2f %7.2f %7.2f %9.2f", n ? sum / n : 0,
+		n ? errors[n * 95 / 100] : 0, n ? errors.back() : 0,
+		n ? pressureErrors / n : 0);
+}
+
+/// The cost of push, in ns per output sample
+double measureCost(const std::vector<Sample> &stroke,
+	Upsampler::Interpolation interpolation, unsigned int rate)
+{
+	Upsampler upsampler(rate, interpolation);
+	Sample output[Upsampler::maxOutput];
+	const uint64_t strokeTime = stroke.back().timestamp
+		- stroke.front().timestamp + (stroke[1].timestamp
+			- stroke[0].timestamp);
+	uint64_t produced = 0, checksum = 0;
+	const uint64_t start = monotonicTime();
+	for (uint64_t i = 0; i < timedSamples; i++) {
+		Sample sample = stroke[i % stroke.size()];
+		sample.timestamp += i / stroke.size() * strokeTime;
+		const size_t count = upsampler.push(sample, geometry, output);
+		produced += count;
+		checksum += count ? output[count - 1].x : 0;
+	}
+	const uint64_t elapsed = monotonicTime() - start;
+	// Do not let the compiler skip the loop
+	if (checksum == 42) {
+		puts("");
+	}
+	return produced ? elapsed * 1000.0 / produced : 0;
+}
+
+void usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+		"Measure the upsampler of the evdev server on a synthetic stroke.\n\n"
+		"  -r, --rate HZ  The samples per second of the digitizer "
+		"(default 120)\n"
+		"  -h, --help     Show this message\n", program);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	static const option longOptions[] = {
+		{"rate", required_argument, nullptr, 'r'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	unsigned int inputRate = 120;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "r:h", longOptions, nullptr))
+			!= -1) {
+		switch (opt) {
+		case 'r': {
+			char *end;
+			const long value = strtol(optarg, &end, 10);
+			if (!*optarg || *end || value < 20 || value > 1000) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return 1;
+			}
+			inputRate = static_cast<unsigned int>(value);
+			break;
+		}
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	const std::vector<Sample> stroke = makeStroke(inputRate, strokeLength);
+	printf("Digitizer at %u Hz, errors in device units (10 µm)\n\n",
+		inputRate);
+	printf("                         Position error        Pressure\n"
+		"Interpolation  Output    mean     p95     max     error"
+		"  Cost (ns)\n");
+	for (const auto &i : interpolations) {
+		for (unsigned int rate : outputRates) {
+			printf("%-12s %5u Hz", i.name, rate);
+			measureErrors(stroke, i.interpolation, rate);
+			printf(" %10.2f\n", measureCost(stroke, i.interpolation, rate));
+		}
+	}
+	return 0;
+}
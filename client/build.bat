@@ -2,5 +2,7 @@
 
 clang++ -std=c++17 -Wall -pedantic -fms-extensions -D_CRT_SECURE_NO_WARNINGS ^
 	-I ../common ^
-	window.cpp stylus_plugin.cpp stylus_manager.cpp ^
+	window.cpp stylus_plugin.cpp stylus_manager.cpp ../common/packet_codec.cpp ^
+	../common/clock_sync.cpp ../common/rate_control.cpp ^
+	../common/sample_converter.cpp ../common/sample_ring.cpp ^
 	-luser32 -lgdi32 -lole32 -lws2_32 -O3 -o netstylus.exe
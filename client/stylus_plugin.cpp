@@ -26,18 +26,82 @@
 
 #include <cstdio>
 
+static_assert(sizeof(LONG) == sizeof(int32_t),
+	"The converter reads the packets as 32-bit properties");
+
+/// A longer pause between two batches means that the stylus went away, in µs
+static const uint64_t maxSampleGap = 50000;
+
+/// The previous samples that every packet repeats, against packet loss
+static const unsigned int packetRedundancy = 2;
+
+/// The time after which we send a transition again, in µs
+static const uint64_t retransmitInterval = 20000;
+
+/// After these many retransmissions we let the server watchdog deal with it
+static const unsigned int maxRetransmits = 25;
+
+/// Repeat the state at this interval while touching, or the server will
+/// release the stylus, in µs
+static const uint64_t keepaliveInterval = 100000;
+
+/// The current time, in µs
+static uint64_t monotonicTime()
+{
+	static const LONGLONG frequency = []() {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		return f.QuadPart;
+	}();
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	const LONGLONG seconds = counter.QuadPart / frequency;
+	const LONGLONG rest = counter.QuadPart % frequency;
+	return static_cast<uint64_t>(seconds * 1000000
+		+ rest * 1000000 / frequency);
+}
+
 NetworkStylus::NetworkStylus(IRealTimeStylus *stylus)
 {
 	mRefCount = 1;
 
 	mStylus = stylus;
 
+	mEncoder.redundancy = packetRedundancy;
+
 	mServer = {};
 	mSocket = socket(mServer.sa_family, SOCK_DGRAM, IPPROTO_UDP);
+
+	// Bind now, so that we can wait for acknowledgments before sending
+	sockaddr_in local = {};
+	local.sin_family = AF_INET;
+	if (bind(mSocket, reinterpret_cast<sockaddr *>(&local), sizeof(local))) {
+		printf("Could not bind the socket: %d\n", WSAGetLastError());
+	}
+
+	mFeedbackThread = std::thread(&NetworkStylus::feedbackLoop, this);
+
+	mSender.reset(new SampleSender([this](Sample *samples, size_t count,
+			const Geometry &geometry) {
+		std::lock_guard<std::mutex> lock(mSendMutex);
+		count = mRate.decimate(samples, count);
+		if (count) {
+			sendSamples(samples, count, geometry);
+		}
+	}));
 }
 
 NetworkStylus::~NetworkStylus()
 {
+	// Send what is still queued while the socket is open
+	mSender.reset();
+
+	mStopFeedback = true;
+	if (mFeedbackThread.joinable()) {
+		mFeedbackThread.join();
+	}
+
 	if (mPunkFTMarshaller) {
 		mPunkFTMarshaller->Release();
 	}
@@ -64,11 +128,14 @@ void NetworkStylus::gatherContexts()
 		return;
 	}
 
+	// The map might rehash
+	std::lock_guard<std::mutex> lock(mMappingMutex);
+	mLastContext = nullptr;
 	for(ULONG i = 0; i < nContexts; i++) {
 		IInkTablet *tablet = nullptr;
 		res = mStylus->GetTabletFromTabletContextId(contexts[i], &tablet);
 		if (SUCCEEDED(res)) {
-			Context ctx;
+			PacketLayout ctx;
 			float scaleX, scaleY;
 			ULONG nProperties;
 			PACKET_PROPERTY *properties;
@@ -96,8 +163,10 @@ void NetworkStylus::gatherContexts()
 				}
 			}
 
-			if (ctx.x >= 0 && ctx.y >= 0 && ctx.status >= 0) {
-				mContexts[contexts[i]] = ctx;
+			SampleConverter converter(ctx);
+			if (converter.valid()) {
+				converter.setScale(mScaleX, mScaleY);
+				mContexts[contexts[i]] = converter;
 			}
 
 			CoTaskMemFree(properties);
@@ -116,11 +185,16 @@ bool NetworkStylus::setServer(const char *addr, uint16_t port)
 		return false;
 	}
 
+	// The feedback thread might be sending
+	std::lock_guard<std::mutex> lock(mSendMutex);
 	mServer = *info->ai_addr;
 	sockaddr_in &addrIn = reinterpret_cast<sockaddr_in &>(mServer);
 	addrIn.sin_port = htons(port);
 	freeaddrinfo(info);
 
+	// The new server needs a keyframe and the geometry
+	mEncoder.reset();
+
 	return true;
 }
 
@@ -145,8 +219,14 @@ void NetworkStylus::windowChanged(HWND hWnd)
 		return;
 	}
 
+	// The stylus thread uses them to convert the packets
+	std::lock_guard<std::mutex> lock(mMappingMutex);
+
 	mScaleX = (25.4 / dpmmX) / GetDeviceCaps(dc, LOGPIXELSX);
 	mScaleY = (25.4 / dpmmY) / GetDeviceCaps(dc, LOGPIXELSY);
+	for (auto &context : mContexts) {
+		context.second.setScale(mScaleX, mScaleY);
+	}
 
 	// X and Y are in 10µm, i.e. a mm is 100 units
 	mMaxX = static_cast<uint32_t>(width * 100 + 0.5);
@@ -156,51 +236,167 @@ void NetworkStylus::windowChanged(HWND hWnd)
 void NetworkStylus::sendPackets(const StylusInfo *stylusInfo, ULONG numPackets,
 	ULONG totalLength, LONG *packets)
 {
-	auto it = mContexts.find(stylusInfo->tcid);
-	if (it == mContexts.end()) {
-		puts("Tablet not found");
+	if (!numPackets) {
 		return;
 	}
 
-	const uint16_t statusMask = (PacketIsTouching |PacketIsEraser
-			| PacketButtonPressed);
-	const auto &tablet = it->second;
-	ULONG packetSize = totalLength / numPackets;
-	for (ULONG i = 0; i < numPackets; i++) {
-		Packet p = {};
-		strncpy(p.magic, PACKET_MAGIC, sizeof(p.magic));
-		p.status = packets[tablet.status] & statusMask;
-
-		p.x = static_cast<uint32_t>(packets[tablet.x] / mScaleX);
-		p.maxX = mMaxX;
-		p.y = static_cast<uint32_t>(packets[tablet.y] / mScaleY);
-		p.maxY = mMaxY;
-
-		if (tablet.pressure >= 0) {
-			p.status |=  PacketHasPressure;
-			p.pressure = packets[tablet.pressure];
-			p.maxPressure = tablet.maxPressure;
+	// Only windowChanged competes for this lock, the socket is on the sender
+	// thread
+	std::lock_guard<std::mutex> lock(mMappingMutex);
+	if (!mLastContext || stylusInfo->tcid != mLastContextId) {
+		auto it = mContexts.find(stylusInfo->tcid);
+		if (it == mContexts.end()) {
+			puts("Tablet not found");
+			return;
 		}
+		mLastContextId = it->first;
+		mLastContext = &it->second;
+	}
+
+	const SampleConverter &tablet = *mLastContext;
+	Geometry geometry;
+	geometry.maxX = mMaxX;
+	geometry.maxY = mMaxY;
+	geometry.maxPressure = tablet.maxPressure();
+
+	// RealTimeStylus does not tell when the samples were taken: assume that
+	// they are evenly spaced at the rate we measured, and that the last one has
+	// just been taken.
+	// Only this thread uses the interval state.
+	const uint64_t now = monotonicTime();
+	const uint64_t elapsed = now - mLastBatchTime;
+	if (mLastBatchTime && elapsed < maxSampleGap) {
+		const uint64_t interval = elapsed / numPackets;
+		mSampleInterval = mSampleInterval
+			? (mSampleInterval * 7 + interval) / 8 : interval;
+	}
+	mLastBatchTime = now;
+
+	Sample samples[PacketEncoder::maxSamples];
+	const size_t packetSize = totalLength / numPackets;
+	const int32_t *data = reinterpret_cast<const int32_t *>(packets);
+	size_t left = numPackets;
+	while (left) {
+		const size_t count = left < PacketEncoder::maxSamples
+			? left : PacketEncoder::maxSamples;
+		left -= count;
+		// The sender numbers the samples, as it also sends the feedback ones
+		tablet.convert(data, count, packetSize, 0,
+			now - left * mSampleInterval, mSampleInterval, samples);
+		data += count * packetSize;
+		mSender->push(samples, count, geometry);
+	}
+}
 
-		if (tablet.tiltX >= 0) {
-			p.status |=  PacketHasTiltX;
-			p.tiltX = packets[tablet.tiltX];
+void NetworkStylus::sendSamples(Sample *samples, size_t count,
+	const Geometry &geometry)
+{
+	for (size_t i = 0; i < count; i++) {
+		samples[i].seqNumber = mSeqNumber++;
+		if ((samples[i].status ^ mLastSample.status) & PACKET_TRANSITIONS) {
+			mTransitionSeq = samples[i].seqNumber;
+			mTransitionPending = true;
+			mRetransmits = 0;
 		}
-		if (tablet.tiltY >= 0) {
-			p.status |=  PacketHasTiltY;
-			p.tiltY = packets[tablet.tiltY];
+		mLastSample = samples[i];
+	}
+	mLastGeometry = geometry;
+	mLastSendTime = monotonicTime();
+
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+	while (count) {
+		if (mRate.probeDue(mLastSendTime)) {
+			mEncoder.ackRequest = true;
+			// Only servers that sent reports know this field
+			mEncoder.sendClockOffset = mClock.valid();
+			mEncoder.clockOffset = mClock.offset();
+		}
+		size_t encoded = count;
+		size_t size = mEncoder.encode(samples, encoded, geometry, buffer,
+			sizeof(buffer));
+		if (!size) {
+			puts("Could not encode a sample");
+			return;
+		}
+		// Transitions and retransmissions measure the link, too
+		if (ackRequested(buffer, size)) {
+			mRate.probeSent(samples[encoded - 1].seqNumber, mLastSendTime);
 		}
-
-		p.seqNumber = mSeqNumber++;
 
 		sendto(mSocket,
-			reinterpret_cast<char *>(&p), static_cast<int>(sizeof(p)), 0,
+			reinterpret_cast<char *>(buffer), static_cast<int>(size), 0,
 			&mServer, static_cast<int>(sizeof(mServer)));
 
-		packets += packetSize;
+		samples += encoded;
+		count -= encoded;
+	}
+}
+
+void NetworkStylus::feedbackLoop()
+{
+	while (!mStopFeedback) {
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(mSocket, &readable);
+		timeval timeout = {0, static_cast<long>(retransmitInterval / 2)};
+		int ready = select(0, &readable, nullptr, nullptr, &timeout);
+		if (ready < 0) {
+			Sleep(static_cast<DWORD>(retransmitInterval / 1000));
+		}
+
+		FeedbackReport report;
+		bool hasAck = false;
+		if (ready > 0) {
+			uint8_t buffer[64];
+			int len = recv(mSocket, reinterpret_cast<char *>(buffer),
+				sizeof(buffer), 0);
+			// Errors are ICMP messages of previous packets, ignore them
+			hasAck = len > 0 && decodeReport(buffer, static_cast<size_t>(len),
+				report);
+		}
+		// Before waiting for the lock, it is the arrival of the report
+		const uint64_t now = monotonicTime();
+
+		std::lock_guard<std::mutex> lock(mSendMutex);
+		const uint64_t acked = report.highestSeq;
+		if (hasAck) {
+			mRate.acknowledged(acked, now);
+			if (mClock.add(report, now)) {
+				mRate.reported(report, now);
+			}
+		}
+		mRate.update(now);
+		if (hasAck && mTransitionPending && acked >= mTransitionSeq) {
+			mTransitionPending = false;
+		}
+		if (!mSeqNumber) {
+			// Nothing sent yet
+			continue;
+		}
+
+		const uint64_t elapsed = now - mLastSendTime;
+		if (mTransitionPending && elapsed >= retransmitInterval) {
+			if (++mRetransmits > maxRetransmits) {
+				puts("The server did not acknowledge a transition");
+				mTransitionPending = false;
+			} else {
+				resendState(true);
+			}
+		} else if ((mLastSample.status & PacketIsTouching)
+				&& elapsed >= keepaliveInterval) {
+			resendState(false);
+		}
 	}
 }
 
+void NetworkStylus::resendState(bool ackRequest)
+{
+	Sample sample = mLastSample;
+	sample.timestamp = monotonicTime();
+	mEncoder.ackRequest = ackRequest;
+	sendSamples(&sample, 1, mLastGeometry);
+}
+
 
 STDMETHODIMP NetworkStylus::Packets(IRealTimeStylus *pStylus,
 	const StylusInfo *pStylusInfo, ULONG nPackets, ULONG nPacketBuf,
@@ -14,7 +14,11 @@
 
 #pragma once
 
-#include <netstylus_packet.h>
+#include <clock_sync.h>
+#include <packet_codec.h>
+#include <rate_control.h>
+#include <sample_converter.h>
+#include <sample_ring.h>
 
 #include <winsock2.h>
 
@@ -22,6 +26,9 @@
 #include <RTSCom_i.c>
 
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <cstdint>
 
@@ -98,28 +105,21 @@ public:
 	///@}
 
 private:
-
-	/**
-	 * Information about a tablet
-	 *
-	 * It contains the offset of these properties, with respect to the beginning
-	 * of a stylus packet.
-	 * A negative number means that the tablet does not support that feature.
-	 */
-	struct Context {
-		int x = -1;
-		int y = -1;
-		int pressure = -1;
-		int maxPressure = -1;
-		int tiltX = -1;
-		int tiltY = -1;
-		int status = -1;
-	};
-
-	/// Send received packets through the network
+	/// Convert received packets and queue them for the sender thread
 	void sendPackets(const StylusInfo *stylusInfo, ULONG numPackets,
 		ULONG totalLength, LONG *packets);
 
+	/// Number the samples, encode them in as few datagrams as possible, and
+	/// send them.
+	/// It needs mSendMutex.
+	void sendSamples(Sample *samples, size_t count, const Geometry &geometry);
+
+	/// Receive the acknowledgments and retransmit the transitions
+	void feedbackLoop();
+
+	/// Send the last sample again, with a new sequence number
+	void resendState(bool ackRequest);
+
 	/// COM reference count
 	std::atomic<ULONG> mRefCount;
 
@@ -129,6 +129,9 @@ private:
 	/// The stylus
 	IRealTimeStylus *mStylus;
 
+	/// Protects the size of the window and the scales of the converters
+	std::mutex mMappingMutex;
+
 	/// The maximum X and Y
 	uint32_t mMaxX = 0;
 	uint32_t mMaxY = 0;
@@ -137,8 +140,12 @@ private:
 	double mScaleX = 1;
 	double mScaleY = 1;
 
-	/// The map of available tablets
-	std::unordered_map<TABLET_CONTEXT_ID, Context> mContexts;
+	/// The conversion plans of the available tablets
+	std::unordered_map<TABLET_CONTEXT_ID, SampleConverter> mContexts;
+
+	/// The last tablet that sent packets, to skip the lookup
+	TABLET_CONTEXT_ID mLastContextId = 0;
+	const SampleConverter *mLastContext = nullptr;
 
 	/// The address of the server
 	sockaddr mServer;
@@ -146,6 +153,44 @@ private:
 	/// The socket we use to send data
 	SOCKET mSocket = INVALID_SOCKET;
 
-	/// The sequence number of the next package we will send
+	/// Protects the sending state, shared with the feedback thread and the
+	/// sender thread
+	std::mutex mSendMutex;
+
+	/// Sends the samples, so that the stylus thread never waits for the socket
+	std::unique_ptr<SampleSender> mSender;
+
+	std::thread mFeedbackThread;
+	std::atomic<bool> mStopFeedback{false};
+
+	/// The sequence number of the next sample we will send
 	uint64_t mSeqNumber = 0;
+
+	/// The encoder of the packets, it keeps the state of the stream
+	PacketEncoder mEncoder;
+
+	/// Measures the link, and thins the samples in the air when it is
+	/// congested
+	RateController mRate;
+
+	/// The offset of the clock of the server, from its reports
+	ClockSync mClock;
+
+	/// The time of the last batch of samples, in µs
+	uint64_t mLastBatchTime = 0;
+
+	/// The estimated interval between two samples, in µs
+	uint64_t mSampleInterval = 0;
+
+	/// The last sent sample and its geometry, to send the state again
+	Sample mLastSample;
+	Geometry mLastGeometry;
+	/// When we sent the last packet, in µs
+	uint64_t mLastSendTime = 0;
+
+	/// The sequence number of the last transition
+	uint64_t mTransitionSeq = 0;
+	/// Whether the server still has to acknowledge the last transition
+	bool mTransitionPending = false;
+	unsigned int mRetransmits = 0;
 };
@@ -0,0 +1,53 @@
+/**
+ * NetStylus estimation of the clock of the server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the implementation of the estimation of the clock of the
+ * server.
+ */
+
+#include "clock_sync.h"
+
+bool ClockSync::add(const FeedbackReport &report, uint64_t now)
+{
+	if (!report.complete || !report.echo || now < report.echo
+			|| report.sent < report.arrival
+			|| now - report.echo <= report.sent - report.arrival) {
+		// A round trip must take some time
+		return false;
+	}
+
+	Measure &measure = mWindow[mNext];
+	measure.roundTrip = (now - report.echo) - (report.sent - report.arrival);
+	// The clocks are unrelated, so compute the differences in signed values
+	const int64_t forward = static_cast<int64_t>(report.arrival - report.echo);
+	const int64_t backward = static_cast<int64_t>(report.sent - now);
+	measure.offset = (forward + backward) / 2;
+	mRoundTrip = measure.roundTrip;
+
+	mNext = (mNext + 1) % windowSize;
+	if (mCount < windowSize) {
+		mCount++;
+	}
+
+	const Measure *best = mWindow;
+	for (unsigned int i = 1; i < mCount; i++) {
+		if (mWindow[i].roundTrip < best->roundTrip) {
+			best = mWindow + i;
+		}
+	}
+	mOffset = best->offset;
+	return true;
+}
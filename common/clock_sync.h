@@ -0,0 +1,93 @@
+/**
+ * NetStylus estimation of the clock of the server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the estimation of the offset of the clock of the server
+ * from the reports it sends.
+ *
+ * This code does not depend on any platform.
+ */
+
+#pragma once
+
+#include "packet_codec.h"
+
+#include <cstdint>
+
+/**
+ * Estimates the offset of the clock of the server from ours, like NTP.
+ *
+ * A report tells the time t1 of a sample in our clock, and its arrival t2 and
+ * the time t3 of the report in the clock of the server; t4 is the arrival of
+ * the report in our clock. The round trip is (t4 - t1) - (t3 - t2), and the
+ * offset is ((t2 - t1) + (t3 - t4)) / 2, which is exact when both directions
+ * take the same time.
+ * Queues make the directions asymmetric, so we trust the measure with the
+ * shortest round trip among the last ones.
+ *
+ * t1 is the time the sample was taken, so the round trip also includes the
+ * time the sample waited on our side.
+ */
+class ClockSync {
+public:
+	/// The number of measures among which we choose the best one
+	static const unsigned int windowSize = 8;
+
+	/**
+	 * Add the times of a report.
+	 *
+	 * \param now The arrival of the report, in our clock (µs)
+	 * \return false if the report does not have consistent times, e.g., a
+	 *  round trip that is not positive
+	 */
+	bool add(const FeedbackReport &report, uint64_t now);
+
+	/// Whether we have an estimate
+	bool valid() const
+	{
+		return mCount > 0;
+	}
+
+	/// The clock of the server minus ours, in µs
+	int64_t offset() const
+	{
+		return mOffset;
+	}
+
+	/// The round trip of the last report, in µs
+	uint64_t roundTrip() const
+	{
+		return mRoundTrip;
+	}
+
+	/// The time the newest sample of a report took to reach the server, in µs
+	int64_t oneWay(const FeedbackReport &report) const
+	{
+		return static_cast<int64_t>(report.arrival - report.echo) - mOffset;
+	}
+
+private:
+	struct Measure {
+		uint64_t roundTrip;
+		int64_t offset;
+	};
+
+	Measure mWindow[windowSize];
+	unsigned int mCount = 0;
+	unsigned int mNext = 0;
+
+	int64_t mOffset = 0;
+	uint64_t mRoundTrip = 0;
+};
@@ -29,7 +29,13 @@
 /// The magic string of packets
 static const char PACKET_MAGIC[10] = "NetStylus";
 
-/// The structure of a packet we will send through the network
+/**
+ * The structure of a version 1 packet, as the Windows client lays it out.
+ *
+ * Other compilers and architectures might add a different padding, and the
+ * values are little endian on the network, so the codec does not read or write
+ * this struct directly, but it uses the offsets of PacketV1Layout.
+ */
 struct Packet {
 	char magic[10]; ///< "NetStylus"
 	uint16_t status; ///< The status and available data
@@ -44,6 +50,27 @@ struct Packet {
 	uint32_t tiltY; ///< Tilt Y (not always be available)
 };
 
+/**
+ * The offsets of the fields of version 1 packets.
+ *
+ * All the values are little endian; the packet ends with 4 bytes of padding.
+ */
+enum PacketV1Layout {
+	PacketV1Magic = 0,
+	PacketV1Status = 10,
+	PacketV1Pressure = 12,
+	PacketV1SeqNumber = 16,
+	PacketV1MaxPressure = 24,
+	PacketV1X = 28,
+	PacketV1MaxX = 32,
+	PacketV1Y = 36,
+	PacketV1MaxY = 40,
+	PacketV1TiltX = 44,
+	PacketV1TiltY = 48,
+	PacketV1End = 52, ///< The end of the values, the minimum length we accept
+	PacketV1Size = 56, ///< The size we send, with the padding
+};
+
 /// The masks to check if a feature is in the packet
 enum PacketFeatures {
 	PacketIsTouching = 0x1,
@@ -53,3 +80,118 @@ enum PacketFeatures {
 	PacketHasTiltX = 0x20,
 	PacketHasTiltY = 0x40,
 };
+
+/// The status bits whose changes the server needs to receive for sure
+static const uint16_t PACKET_TRANSITIONS = PacketIsTouching | PacketIsEraser
+	| PacketButtonPressed;
+
+/**
+ * \name Version 2 of the protocol
+ *
+ * Version 2 packets are a stream of bytes without any padding, so they do not
+ * depend on the compiler or on the architecture.
+ * Multi-byte fields are LEB128 varints (zigzag-encoded when signed).
+ *
+ * A packet starts with a 4-byte header: the magic "NS", the version (2) and
+ * the packet flags (PacketV2Flags).
+ * Then come the sequence number of the first sample (varint) and the number of
+ * samples (varint). The samples of a packet have consecutive sequence numbers,
+ * so a single datagram can carry a whole batch of samples.
+ * If PacketV2Timestamp is set, they are followed by the time of the first
+ * sample, in µs from an arbitrary point of a monotonic clock of the sender.
+ * If PacketV2ClockOffset is set, they are followed by the offset of the clock
+ * of the server from the one of the sender, in µs (zigzag).
+ *
+ * Every sample starts with its flags (PacketV2SampleFlags) and its time
+ * distance from the previous sample of the packet in µs (varint, 0 for the
+ * first sample), followed by either:
+ * - a keyframe, when PacketV2Keyframe is set: status, x, y, and then pressure,
+ *   tilt X and tilt Y (zigzag) if the status says they are available;
+ * - a delta, otherwise: the distance to the sequence number of the last
+ *   keyframe, a byte with the PacketV2Delta bits of the changed values, and
+ *   the changed values as zigzag differences from the keyframe.
+ *   The status is the one of the keyframe.
+ *
+ * The first sample of a packet is always a keyframe, and keyframes are also
+ * sent periodically and whenever the status changes. Deltas refer to a
+ * keyframe of their packet, so losing a packet never prevents decoding the
+ * following ones.
+ *
+ * When PacketV2Geometry is set, a keyframe is followed by maxX, maxY and
+ * maxPressure.
+ * The geometry is sent only for a few keyframes after it changes, and then
+ * again every now and then, for receivers that started later.
+ *
+ * If PacketV2Redundant is set, the header continues with copies of the samples
+ * that precede the first one, so that the receiver can recover them when their
+ * packet is lost.
+ * The number of copies (varint) is followed by the copies, from the oldest.
+ * The oldest copy has its time distance from the first sample of the packet and
+ * then its values as in a keyframe; every other copy has its time distance from
+ * the previous copy, a byte with the PacketV2Delta bits of the values that
+ * changed since the previous copy, the status if PacketV2DeltaStatus is set,
+ * and the zigzag differences.
+ * The copies do not depend on any keyframe, so they can be decoded even when
+ * the packets they come from are lost.
+ *
+ * Samples are not retransmitted, but the changes of PACKET_TRANSITIONS must
+ * not be lost: the packets that contain them set PacketV2AckRequest.
+ * The server answers with an acknowledgment: a header with PacketV2Ack,
+ * followed by the highest sequence number it has received (varint).
+ * The client sends the current state again, with a new sequence number, until
+ * the acknowledged number reaches the one of the transition.
+ * While the stylus touches the surface, the client repeats its state also when
+ * it does not move, so that the server can release the stylus when the client
+ * goes silent.
+ *
+ * The server can extend an acknowledgment into a report, setting PacketV2Report
+ * besides PacketV2Ack. It answers the requests with reports, and it sends one
+ * every now and then while a sender is active. After the highest sequence
+ * number, a report contains (as varints):
+ * - the numbers of received and of missing samples, since the start of the
+ *   stream;
+ * - the time of the newest received sample, in the clock of the sender;
+ * - its arrival and, as a difference from it, the moment the report was sent,
+ *   in µs from an arbitrary point of a monotonic clock of the server.
+ * Like NTP, the sender gets the round trip and the clock offset from these
+ * times and the arrival of the report. Senders send the offset back only after
+ * they received a report, so servers that do not know reports never see it.
+ */
+///@{
+
+/// The magic of version 2 packets
+static const char PACKET_V2_MAGIC[2] = {'N', 'S'};
+
+/// The version byte of version 2 packets
+static const uint8_t PACKET_V2_VERSION = 2;
+
+/// The size of the header of version 2 packets
+static const unsigned int PACKET_V2_HEADER_SIZE = 4;
+
+/// The flags in the header of version 2 packets
+enum PacketV2Flags {
+	PacketV2Timestamp = 0x1,
+	PacketV2Redundant = 0x2,
+	PacketV2AckRequest = 0x4,
+	PacketV2ClockOffset = 0x8,
+	PacketV2Report = 0x40, ///< Only with PacketV2Ack
+	PacketV2Ack = 0x80, ///< Sent by the server, it does not contain samples
+};
+
+/// The flags of the samples of version 2 packets
+enum PacketV2SampleFlags {
+	PacketV2Keyframe = 0x1,
+	PacketV2Geometry = 0x2,
+};
+
+/// The values that follow a version 2 delta
+enum PacketV2Delta {
+	PacketV2DeltaX = 0x1,
+	PacketV2DeltaY = 0x2,
+	PacketV2DeltaPressure = 0x4,
+	PacketV2DeltaTiltX = 0x8,
+	PacketV2DeltaTiltY = 0x10,
+	PacketV2DeltaStatus = 0x20, ///< Only for redundant copies
+};
+
+///@}
@@ -0,0 +1,781 @@
+/**
+ * NetStylus packet encoding and decoding
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the implementation of the version 1 and 2 codecs.
+ */
+
+#include "packet_codec.h"
+
+#include <algorithm>
+#include <cstddef> // offsetof
+#include <cstring>
+
+namespace {
+
+/// The number of keyframes that carry a new geometry
+const unsigned int geometryRepeats = 3;
+
+/// Send the geometry at least once in this number of keyframes
+const unsigned int geometryRefresh = 8;
+
+// The layout must match the order and the sizes of the fields of Packet
+static_assert(PacketV1Status >= PacketV1Magic + sizeof(PACKET_MAGIC)
+	&& PacketV1Pressure >= PacketV1Status + 2
+	&& PacketV1SeqNumber >= PacketV1Pressure + 4
+	&& PacketV1MaxPressure >= PacketV1SeqNumber + 8
+	&& PacketV1X >= PacketV1MaxPressure + 4
+	&& PacketV1MaxX >= PacketV1X + 4
+	&& PacketV1Y >= PacketV1MaxX + 4
+	&& PacketV1MaxY >= PacketV1Y + 4
+	&& PacketV1TiltX >= PacketV1MaxY + 4
+	&& PacketV1TiltY >= PacketV1TiltX + 4
+	&& PacketV1End == PacketV1TiltY + 4
+	&& PacketV1Size >= PacketV1End,
+	"The fields of version 1 packets overlap");
+
+// Where 64-bit values are aligned to 8 bytes, as on the Windows client, the
+// struct is the wire layout
+static_assert(alignof(uint64_t) != 8
+	|| (offsetof(Packet, status) == PacketV1Status
+		&& offsetof(Packet, pressure) == PacketV1Pressure
+		&& offsetof(Packet, seqNumber) == PacketV1SeqNumber
+		&& offsetof(Packet, maxPressure) == PacketV1MaxPressure
+		&& offsetof(Packet, x) == PacketV1X
+		&& offsetof(Packet, maxX) == PacketV1MaxX
+		&& offsetof(Packet, y) == PacketV1Y
+		&& offsetof(Packet, maxY) == PacketV1MaxY
+		&& offsetof(Packet, tiltX) == PacketV1TiltX
+		&& offsetof(Packet, tiltY) == PacketV1TiltY
+		&& sizeof(Packet) == PacketV1Size),
+	"Packet does not match the layout of version 1 packets");
+
+/// Read a little endian value, compilers turn it into a single load
+template<typename T>
+inline T load(const uint8_t *src)
+{
+	T value = 0;
+	for (unsigned int i = 0; i < sizeof(T); i++) {
+		value |= static_cast<T>(static_cast<T>(src[i]) << (8 * i));
+	}
+	return value;
+}
+
+/// Write a little endian value
+template<typename T>
+inline void store(uint8_t *dst, T value)
+{
+	for (unsigned int i = 0; i < sizeof(T); i++) {
+		dst[i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+}
+
+/// The magic of version 1 packets, as it is read by load
+const uint64_t magicV1Low = load<uint64_t>(
+	reinterpret_cast<const uint8_t *>(PACKET_MAGIC));
+const uint16_t magicV1High = load<uint16_t>(
+	reinterpret_cast<const uint8_t *>(PACKET_MAGIC) + 8);
+
+/// The first 3 bytes of version 2 packets, as they are read by load
+const uint32_t magicV2 = static_cast<uint8_t>(PACKET_V2_MAGIC[0])
+	| static_cast<uint8_t>(PACKET_V2_MAGIC[1]) << 8
+	| PACKET_V2_VERSION << 16;
+
+/// Appends varints to a buffer, and remembers if it overflowed
+struct ByteWriter {
+	uint8_t *pos;
+	uint8_t *end;
+	bool ok = true;
+
+	ByteWriter(uint8_t *buffer, size_t size) : pos(buffer), end(buffer + size)
+	{
+	}
+
+	void byte(uint8_t value)
+	{
+		if (pos < end) {
+			*pos++ = value;
+		} else {
+			ok = false;
+		}
+	}
+
+	void varint(uint64_t value)
+	{
+		while (value >= 0x80) {
+			byte(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		byte(static_cast<uint8_t>(value));
+	}
+
+	void zigzag(int32_t value)
+	{
+		varint((static_cast<uint32_t>(value) << 1)
+			^ static_cast<uint32_t>(value >> 31));
+	}
+
+	void zigzag64(int64_t value)
+	{
+		varint((static_cast<uint64_t>(value) << 1)
+			^ static_cast<uint64_t>(value >> 63));
+	}
+};
+
+/// Reads varints from a buffer, and remembers if it went past the end
+struct ByteReader {
+	const uint8_t *pos;
+	const uint8_t *end;
+	bool ok = true;
+
+	ByteReader(const uint8_t *data, size_t length)
+		: pos(data), end(data + length)
+	{
+	}
+
+	uint8_t byte()
+	{
+		if (pos < end) {
+			return *pos++;
+		}
+		ok = false;
+		return 0;
+	}
+
+	uint64_t varint()
+	{
+		uint64_t value = 0;
+		for (unsigned int shift = 0; shift < 64; shift += 7) {
+			uint8_t b = byte();
+			value |= static_cast<uint64_t>(b & 0x7f) << shift;
+			if (!(b & 0x80)) {
+				return value;
+			}
+		}
+		ok = false;
+		return 0;
+	}
+
+	uint32_t varint32()
+	{
+		uint64_t value = varint();
+		if (value > UINT32_MAX) {
+			ok = false;
+		}
+		return static_cast<uint32_t>(value);
+	}
+
+	int32_t zigzag()
+	{
+		uint32_t value = varint32();
+		return static_cast<int32_t>((value >> 1) ^ (0 - (value & 1)));
+	}
+
+	int64_t zigzag64()
+	{
+		uint64_t value = varint();
+		return static_cast<int64_t>((value >> 1) ^ (0 - (value & 1)));
+	}
+};
+
+/// The difference of two values, wrapped like the unsigned fields
+inline int32_t delta(uint32_t value, uint32_t base)
+{
+	return static_cast<int32_t>(value - base);
+}
+
+/// The time between two samples, or 0 if it is unknown
+inline uint64_t elapsed(uint64_t from, uint64_t to)
+{
+	return to > from ? to - from : 0;
+}
+
+/// The PacketV2Delta bits of the values, in the order they are sent
+const uint8_t deltaBits[5] = {PacketV2DeltaX, PacketV2DeltaY,
+	PacketV2DeltaPressure, PacketV2DeltaTiltX, PacketV2DeltaTiltY};
+
+/// The values of a sample in the order of deltaBits, 0 if not available
+void getValues(const Sample &s, uint32_t values[5])
+{
+	values[0] = s.x;
+	values[1] = s.y;
+	values[2] = (s.status & PacketHasPressure) ? s.pressure : 0;
+	values[3] = (s.status & PacketHasTiltX) ? s.tiltX : 0;
+	values[4] = (s.status & PacketHasTiltY) ? s.tiltY : 0;
+}
+
+void setValues(Sample &s, const uint32_t values[5])
+{
+	s.x = values[0];
+	s.y = values[1];
+	s.pressure = values[2];
+	s.tiltX = values[3];
+	s.tiltY = values[4];
+}
+
+/// Write the status and the values of a sample, like in a keyframe
+void writeValues(ByteWriter &w, const Sample &s)
+{
+	w.varint(s.status);
+	w.varint(s.x);
+	w.varint(s.y);
+	if (s.status & PacketHasPressure) {
+		w.varint(s.pressure);
+	}
+	if (s.status & PacketHasTiltX) {
+		w.zigzag(static_cast<int32_t>(s.tiltX));
+	}
+	if (s.status & PacketHasTiltY) {
+		w.zigzag(static_cast<int32_t>(s.tiltY));
+	}
+}
+
+void readValues(ByteReader &r, Sample &s)
+{
+	s.status = static_cast<uint16_t>(r.varint32());
+	s.x = r.varint32();
+	s.y = r.varint32();
+	if (s.status & PacketHasPressure) {
+		s.pressure = r.varint32();
+	}
+	if (s.status & PacketHasTiltX) {
+		s.tiltX = static_cast<uint32_t>(r.zigzag());
+	}
+	if (s.status & PacketHasTiltY) {
+		s.tiltY = static_cast<uint32_t>(r.zigzag());
+	}
+}
+
+/**
+ * Write the redundant copies of a packet.
+ *
+ * \param copies The samples that precede the first one, from the oldest
+ */
+void writeRedundant(ByteWriter &w, const Sample *copies, unsigned int count,
+	const Sample &first)
+{
+	w.varint(count);
+	for (unsigned int i = 0; i < count; i++) {
+		const Sample &copy = copies[i];
+		if (!i) {
+			w.varint(elapsed(copy.timestamp, first.timestamp));
+			writeValues(w, copy);
+			continue;
+		}
+
+		const Sample &previous = copies[i - 1];
+		w.varint(elapsed(previous.timestamp, copy.timestamp));
+		uint32_t values[5];
+		uint32_t base[5];
+		getValues(copy, values);
+		getValues(previous, base);
+		uint8_t mask = copy.status != previous.status ? PacketV2DeltaStatus : 0;
+		for (int j = 0; j < 5; j++) {
+			if (values[j] != base[j]) {
+				mask |= deltaBits[j];
+			}
+		}
+		w.byte(mask);
+		if (mask & PacketV2DeltaStatus) {
+			w.varint(copy.status);
+		}
+		for (int j = 0; j < 5; j++) {
+			if (mask & deltaBits[j]) {
+				w.zigzag(delta(values[j], base[j]));
+			}
+		}
+	}
+}
+
+} // namespace
+
+int packetVersion(const uint8_t *data, size_t length)
+{
+	// The magics differ from the second byte, and both versions are longer
+	// than the version 2 header
+	if (length <= PACKET_V2_HEADER_SIZE) {
+		return 0;
+	}
+	if ((load<uint32_t>(data) & 0xffffff) == magicV2) {
+		return 2;
+	}
+	const bool v1 = length >= PacketV1End
+		&& !((load<uint64_t>(data) ^ magicV1Low)
+			| (load<uint16_t>(data + 8) ^ magicV1High));
+	return v1 ? 1 : 0;
+}
+
+bool decodePacketV1(const uint8_t *data, size_t length, Sample &sample,
+	Geometry &geometry)
+{
+	if (length < PacketV1End) {
+		return false;
+	}
+
+	sample.seqNumber = load<uint64_t>(data + PacketV1SeqNumber);
+	sample.status = load<uint16_t>(data + PacketV1Status);
+	sample.pressure = load<uint32_t>(data + PacketV1Pressure);
+	sample.x = load<uint32_t>(data + PacketV1X);
+	sample.y = load<uint32_t>(data + PacketV1Y);
+	sample.tiltX = load<uint32_t>(data + PacketV1TiltX);
+	sample.tiltY = load<uint32_t>(data + PacketV1TiltY);
+
+	geometry.maxX = load<uint32_t>(data + PacketV1MaxX);
+	geometry.maxY = load<uint32_t>(data + PacketV1MaxY);
+	geometry.maxPressure = static_cast<int32_t>(
+		load<uint32_t>(data + PacketV1MaxPressure));
+	return true;
+}
+
+size_t encodePacketV1(const Sample &sample, const Geometry &geometry,
+	uint8_t *buffer, size_t size)
+{
+	if (size < PacketV1Size) {
+		return 0;
+	}
+
+	memset(buffer, 0, PacketV1Size);
+	memcpy(buffer + PacketV1Magic, PACKET_MAGIC, sizeof(PACKET_MAGIC));
+	store<uint16_t>(buffer + PacketV1Status, sample.status);
+	store<uint32_t>(buffer + PacketV1Pressure, sample.pressure);
+	store<uint64_t>(buffer + PacketV1SeqNumber, sample.seqNumber);
+	store<uint32_t>(buffer + PacketV1MaxPressure,
+		static_cast<uint32_t>(geometry.maxPressure));
+	store<uint32_t>(buffer + PacketV1X, sample.x);
+	store<uint32_t>(buffer + PacketV1MaxX, geometry.maxX);
+	store<uint32_t>(buffer + PacketV1Y, sample.y);
+	store<uint32_t>(buffer + PacketV1MaxY, geometry.maxY);
+	store<uint32_t>(buffer + PacketV1TiltX, sample.tiltX);
+	store<uint32_t>(buffer + PacketV1TiltY, sample.tiltY);
+	return PacketV1Size;
+}
+
+bool ackRequested(const uint8_t *data, size_t length)
+{
+	return length >= PACKET_V2_HEADER_SIZE
+		&& (data[3] & (PacketV2AckRequest | PacketV2Ack)) == PacketV2AckRequest;
+}
+
+size_t encodeAck(uint64_t seqNumber, uint8_t *buffer, size_t size)
+{
+	ByteWriter w(buffer, size);
+	w.byte(PACKET_V2_MAGIC[0]);
+	w.byte(PACKET_V2_MAGIC[1]);
+	w.byte(PACKET_V2_VERSION);
+	w.byte(PacketV2Ack);
+	w.varint(seqNumber);
+	return w.ok ? static_cast<size_t>(w.pos - buffer) : 0;
+}
+
+bool decodeAck(const uint8_t *data, size_t length, uint64_t &seqNumber)
+{
+	if (packetVersion(data, length) != 2 || !(data[3] & PacketV2Ack)) {
+		return false;
+	}
+	ByteReader r(data + PACKET_V2_HEADER_SIZE,
+		length - PACKET_V2_HEADER_SIZE);
+	seqNumber = r.varint();
+	return r.ok;
+}
+
+size_t encodeReport(const FeedbackReport &report, uint8_t *buffer,
+	size_t size)
+{
+	ByteWriter w(buffer, size);
+	w.byte(PACKET_V2_MAGIC[0]);
+	w.byte(PACKET_V2_MAGIC[1]);
+	w.byte(PACKET_V2_VERSION);
+	w.byte(PacketV2Ack | PacketV2Report);
+	w.varint(report.highestSeq);
+	w.varint(report.received);
+	w.varint(report.lost);
+	w.varint(report.echo);
+	w.varint(report.arrival);
+	w.varint(elapsed(report.arrival, report.sent));
+	return w.ok ? static_cast<size_t>(w.pos - buffer) : 0;
+}
+
+bool decodeReport(const uint8_t *data, size_t length, FeedbackReport &report)
+{
+	if (!decodeAck(data, length, report.highestSeq)) {
+		return false;
+	}
+	report.complete = false;
+	if (!(data[3] & PacketV2Report)) {
+		return true;
+	}
+
+	ByteReader r(data + PACKET_V2_HEADER_SIZE,
+		length - PACKET_V2_HEADER_SIZE);
+	r.varint();
+	report.received = r.varint();
+	report.lost = r.varint();
+	report.echo = r.varint();
+	report.arrival = r.varint();
+	report.sent = report.arrival + r.varint();
+	// A broken report is still a valid acknowledgment
+	report.complete = r.ok;
+	return true;
+}
+
+size_t PacketEncoder::encode(const Sample *samples, size_t &count,
+	const Geometry &geometry, uint8_t *buffer, size_t size)
+{
+	static_assert(maxSamples < 0x80, "The count must fit a single byte");
+	if (count > maxSamples) {
+		count = maxSamples;
+	}
+
+	if (geometry != mGeometry) {
+		mGeometry = geometry;
+		mState.geometryRepeats = geometryRepeats;
+		mState.hasKeyframe = false;
+	}
+
+	// Repeat the last samples, as long as they are the ones just before these
+	unsigned int copies = 0;
+	if (count) {
+		const unsigned int wanted = std::min(redundancy, mHistoryCount);
+		while (copies < wanted
+				&& mHistory[mHistoryCount - 1 - copies].seqNumber + copies + 1
+					== samples[0].seqNumber) {
+			copies++;
+		}
+	}
+
+	ByteWriter w(buffer, size);
+	w.byte(PACKET_V2_MAGIC[0]);
+	w.byte(PACKET_V2_MAGIC[1]);
+	w.byte(PACKET_V2_VERSION);
+	const bool timestamp = count && samples[0].timestamp;
+	w.byte((timestamp ? PacketV2Timestamp : 0)
+		| (copies ? PacketV2Redundant : 0)
+		| (sendClockOffset ? PacketV2ClockOffset : 0));
+	if (count) {
+		w.varint(samples[0].seqNumber);
+	}
+	uint8_t *countPos = w.pos;
+	w.byte(0);
+	if (timestamp) {
+		w.varint(samples[0].timestamp);
+	}
+	if (sendClockOffset) {
+		w.zigzag64(clockOffset);
+	}
+	if (copies) {
+		writeRedundant(w, mHistory + mHistoryCount - copies, copies,
+			samples[0]);
+	}
+	if (!w.ok) {
+		count = 0;
+		return 0;
+	}
+
+	size_t encoded = 0;
+	for (; encoded < count; encoded++) {
+		const Sample &sample = samples[encoded];
+		const State previous = mState;
+		uint8_t *start = w.pos;
+
+		// Every packet starts with a keyframe, so that its deltas do not
+		// depend on other packets that might be lost
+		const bool keyframe = !encoded || !mState.hasKeyframe
+			|| mState.sinceKeyframe >= keyframeInterval
+			|| sample.status != mState.keyframe.status
+			|| sample.seqNumber < mState.keyframe.seqNumber;
+		bool withGeometry = false;
+		if (keyframe) {
+			withGeometry = mState.geometryRepeats > 0
+				|| mState.keyframesWithoutGeometry + 1 >= geometryRefresh;
+		}
+
+		w.byte((keyframe ? PacketV2Keyframe : 0)
+			| (withGeometry ? PacketV2Geometry : 0));
+		w.varint(encoded
+			? elapsed(samples[encoded - 1].timestamp, sample.timestamp) : 0);
+
+		if (keyframe) {
+			writeValues(w, sample);
+			if (withGeometry) {
+				w.varint(geometry.maxX);
+				w.varint(geometry.maxY);
+				w.zigzag(geometry.maxPressure);
+			}
+
+			mState.hasKeyframe = true;
+			mState.keyframe = sample;
+			mState.sinceKeyframe = 0;
+			if (withGeometry) {
+				mState.keyframesWithoutGeometry = 0;
+				if (mState.geometryRepeats) {
+					mState.geometryRepeats--;
+				}
+			} else {
+				mState.keyframesWithoutGeometry++;
+			}
+		} else {
+			const Sample &key = mState.keyframe;
+			const int32_t dx = delta(sample.x, key.x);
+			const int32_t dy = delta(sample.y, key.y);
+			const int32_t dp = delta(sample.pressure, key.pressure);
+			const int32_t dtx = delta(sample.tiltX, key.tiltX);
+			const int32_t dty = delta(sample.tiltY, key.tiltY);
+			const uint16_t status = key.status;
+
+			uint8_t mask = (dx ? PacketV2DeltaX : 0)
+				| (dy ? PacketV2DeltaY : 0);
+			if ((status & PacketHasPressure) && dp) {
+				mask |= PacketV2DeltaPressure;
+			}
+			if ((status & PacketHasTiltX) && dtx) {
+				mask |= PacketV2DeltaTiltX;
+			}
+			if ((status & PacketHasTiltY) && dty) {
+				mask |= PacketV2DeltaTiltY;
+			}
+
+			w.varint(sample.seqNumber - key.seqNumber);
+			w.byte(mask);
+			if (mask & PacketV2DeltaX) {
+				w.zigzag(dx);
+			}
+			if (mask & PacketV2DeltaY) {
+				w.zigzag(dy);
+			}
+			if (mask & PacketV2DeltaPressure) {
+				w.zigzag(dp);
+			}
+			if (mask & PacketV2DeltaTiltX) {
+				w.zigzag(dtx);
+			}
+			if (mask & PacketV2DeltaTiltY) {
+				w.zigzag(dty);
+			}
+
+			mState.sinceKeyframe++;
+		}
+
+		if (!w.ok) {
+			// This sample goes to the next packet
+			mState = previous;
+			w.pos = start;
+			w.ok = true;
+			break;
+		}
+	}
+
+	count = encoded;
+	if (!encoded) {
+		return 0;
+	}
+	*countPos = static_cast<uint8_t>(encoded);
+
+	bool transition = ackRequest;
+	for (size_t i = 0; i < encoded; i++) {
+		transition |= ((samples[i].status ^ mLastStatus) & PACKET_TRANSITIONS)
+			!= 0;
+		mLastStatus = samples[i].status;
+	}
+	if (transition) {
+		buffer[3] |= PacketV2AckRequest;
+	}
+	ackRequest = false;
+	sendClockOffset = false;
+
+	if (redundancy) {
+		// Keep the last samples for the copies of the next packets
+		const unsigned int keep = static_cast<unsigned int>(
+			std::min<size_t>(encoded, maxRedundancy));
+		const unsigned int old = std::min(mHistoryCount, maxRedundancy - keep);
+		std::copy(mHistory + mHistoryCount - old, mHistory + mHistoryCount,
+			mHistory);
+		std::copy(samples + encoded - keep, samples + encoded, mHistory + old);
+		mHistoryCount = old + keep;
+	}
+
+	return static_cast<size_t>(w.pos - buffer);
+}
+
+void PacketEncoder::reset()
+{
+	mState.hasKeyframe = false;
+	mState.geometryRepeats = geometryRepeats;
+	mHistoryCount = 0;
+}
+
+size_t PacketDecoder::decode(const uint8_t *data, size_t length,
+	Sample *samples)
+{
+	if (length < PACKET_V2_HEADER_SIZE) {
+		mStats.malformed++;
+		return 0;
+	}
+	const uint8_t packetFlags = data[3];
+	if (packetFlags & PacketV2Ack) {
+		// Only clients receive them
+		mStats.malformed++;
+		return 0;
+	}
+	ByteReader r(data + PACKET_V2_HEADER_SIZE,
+		length - PACKET_V2_HEADER_SIZE);
+
+	const uint64_t firstSeq = r.varint();
+	const uint64_t count = r.varint();
+	uint64_t timestamp = 0;
+	if (packetFlags & PacketV2Timestamp) {
+		timestamp = r.varint();
+	}
+	int64_t clockOffset = 0;
+	if (packetFlags & PacketV2ClockOffset) {
+		clockOffset = r.zigzag64();
+	}
+	uint64_t copies = 0;
+	if (packetFlags & PacketV2Redundant) {
+		copies = r.varint();
+	}
+	if (!r.ok || !count || count > PacketEncoder::maxSamples
+			|| copies > PacketEncoder::maxRedundancy || copies > firstSeq) {
+		mStats.malformed++;
+		return 0;
+	}
+	if (packetFlags & PacketV2ClockOffset) {
+		// We are the server, so this is our clock minus the one of the sender
+		mHasClockOffset = true;
+		mClockOffset = clockOffset;
+	}
+
+	size_t decoded = 0;
+	// The copies are self-contained, they do not touch the keyframe
+	Sample previous;
+	uint64_t copyTime = 0;
+	for (uint64_t i = 0; i < copies; i++) {
+		Sample &copy = samples[decoded];
+		const uint64_t distance = r.varint();
+		if (!i) {
+			copy = {};
+			readValues(r, copy);
+			copyTime = timestamp - distance;
+		} else {
+			copy = previous;
+			copyTime += distance;
+			const uint8_t mask = r.byte();
+			if (mask & PacketV2DeltaStatus) {
+				copy.status = static_cast<uint16_t>(r.varint32());
+			}
+			uint32_t values[5];
+			getValues(previous, values);
+			for (int j = 0; j < 5; j++) {
+				if (mask & deltaBits[j]) {
+					values[j] += static_cast<uint32_t>(r.zigzag());
+				}
+			}
+			setValues(copy, values);
+		}
+		if (!r.ok) {
+			mStats.malformed++;
+			return decoded;
+		}
+		copy.seqNumber = firstSeq - copies + i;
+		copy.redundant = true;
+		if (packetFlags & PacketV2Timestamp) {
+			copy.timestamp = copyTime;
+		}
+		previous = copy;
+
+		if (!mHasGeometry) {
+			mStats.missingGeometry++;
+			continue;
+		}
+		decoded++;
+	}
+
+	// The deltas refer to the keyframes of this packet, so a late packet is
+	// decoded even after a newer keyframe
+	bool hasKeyframe = false;
+	Sample keyframe;
+	for (uint64_t i = 0; i < count; i++) {
+		Sample &sample = samples[decoded];
+		sample = {};
+		sample.seqNumber = firstSeq + i;
+
+		const uint8_t flags = r.byte();
+		timestamp += r.varint();
+		// Without a base, the relative times are useless
+		if (packetFlags & PacketV2Timestamp) {
+			sample.timestamp = timestamp;
+		}
+
+		if (flags & PacketV2Keyframe) {
+			readValues(r, sample);
+
+			Geometry geometry;
+			if (flags & PacketV2Geometry) {
+				geometry.maxX = r.varint32();
+				geometry.maxY = r.varint32();
+				geometry.maxPressure = r.zigzag();
+			}
+			if (!r.ok) {
+				mStats.malformed++;
+				break;
+			}
+
+			hasKeyframe = true;
+			keyframe = sample;
+			if (flags & PacketV2Geometry) {
+				mHasGeometry = true;
+				mGeometry = geometry;
+			}
+		} else {
+			const uint64_t distance = r.varint();
+			const uint8_t mask = r.byte();
+			int32_t deltas[5] = {};
+			for (int j = 0; j < 5; j++) {
+				if (mask & deltaBits[j]) {
+					deltas[j] = r.zigzag();
+				}
+			}
+			if (!r.ok) {
+				mStats.malformed++;
+				break;
+			}
+			if (distance > sample.seqNumber) {
+				mStats.missingKeyframe++;
+				continue;
+			}
+			if (!hasKeyframe
+					|| sample.seqNumber - distance != keyframe.seqNumber) {
+				mStats.missingKeyframe++;
+				continue;
+			}
+
+			// Status changes always produce keyframes
+			sample.status = keyframe.status;
+			sample.x = keyframe.x + static_cast<uint32_t>(deltas[0]);
+			sample.y = keyframe.y + static_cast<uint32_t>(deltas[1]);
+			sample.pressure = keyframe.pressure
+				+ static_cast<uint32_t>(deltas[2]);
+			sample.tiltX = keyframe.tiltX + static_cast<uint32_t>(deltas[3]);
+			sample.tiltY = keyframe.tiltY + static_cast<uint32_t>(deltas[4]);
+		}
+
+		if (!mHasGeometry) {
+			mStats.missingGeometry++;
+			continue;
+		}
+		decoded++;
+	}
+
+	return decoded;
+}
@@ -0,0 +1,270 @@
+/**
+ * NetStylus packet encoding and decoding
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the classes that convert stylus samples to and from the
+ * network packets.
+ *
+ * This code does not depend on any platform, so it is shared by the client and
+ * the servers.
+ */
+
+#pragma once
+
+#include "netstylus_packet.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// A stylus sample, independent of the version of the protocol
+struct Sample {
+	uint64_t seqNumber = 0; ///< The packet sequence number
+	uint16_t status = 0; ///< The status and available data (PacketFeatures)
+	uint32_t pressure = 0; ///< The pressure, if PacketHasPressure
+	uint32_t x = 0; ///< x, in mm * 100 (i.e. 10^-5m)
+	uint32_t y = 0; ///< y, in mm * 100 (i.e. 10^-5m)
+	uint32_t tiltX = 0; ///< Tilt X, if PacketHasTiltX
+	uint32_t tiltY = 0; ///< Tilt Y, if PacketHasTiltY
+	/// The time of the sample in the clock of the sender, in µs (0 if unknown)
+	uint64_t timestamp = 0;
+	/// Whether this is a copy of a sample that was in a previous packet
+	bool redundant = false;
+};
+
+/// The size of the area and the pressure range of a sender
+struct Geometry {
+	uint32_t maxX = 0; ///< Width of the window, in mm * 100 (i.e. 10^-5m)
+	uint32_t maxY = 0; ///< Height of the window, in mm * 100 (i.e. 10^-5m)
+	int32_t maxPressure = 0; ///< The maximum pressure of the stylus
+
+	bool operator==(const Geometry &other) const
+	{
+		return maxX == other.maxX && maxY == other.maxY
+			&& maxPressure == other.maxPressure;
+	}
+
+	bool operator!=(const Geometry &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+/// What the server tells a sender about the samples it received
+struct FeedbackReport {
+	uint64_t highestSeq = 0; ///< The highest sequence number received
+	/// Whether the fields below are valid, i.e., it was not a plain
+	/// acknowledgment
+	bool complete = false;
+	uint64_t received = 0; ///< Received samples, since the start
+	uint64_t lost = 0; ///< Missing samples, since the start
+	/// The time of the newest received sample, in the clock of the sender (µs)
+	uint64_t echo = 0;
+	/// When that sample arrived, in the clock of the server (µs)
+	uint64_t arrival = 0;
+	/// When the report was sent, in the clock of the server (µs)
+	uint64_t sent = 0;
+};
+
+/**
+ * Tell the version of the protocol of a datagram, by its magic.
+ *
+ * \return 1 or 2, or 0 if the datagram is not a NetStylus packet
+ */
+int packetVersion(const uint8_t *data, size_t length);
+
+/**
+ * Decode a version 1 packet (it needs to have the right magic).
+ *
+ * The values are read in place, so the data does not need to be aligned.
+ */
+bool decodePacketV1(const uint8_t *data, size_t length, Sample &sample,
+	Geometry &geometry);
+
+/**
+ * Encode a sample as a version 1 packet, for the servers that do not know the
+ * version 2.
+ *
+ * \return The size of the packet (PacketV1Size), or 0 if the buffer is too
+ *  small
+ */
+size_t encodePacketV1(const Sample &sample, const Geometry &geometry,
+	uint8_t *buffer, size_t size);
+
+/// Tell whether a version 2 packet asks for an acknowledgment
+bool ackRequested(const uint8_t *data, size_t length);
+
+/**
+ * Encode an acknowledgment.
+ *
+ * \param seqNumber The highest sequence number received from the client
+ * \return The size of the packet, or 0 if the buffer is too small
+ */
+size_t encodeAck(uint64_t seqNumber, uint8_t *buffer, size_t size);
+
+/// Decode an acknowledgment, return false if the datagram is not one.
+/// Reports are acknowledgments, too.
+bool decodeAck(const uint8_t *data, size_t length, uint64_t &seqNumber);
+
+/**
+ * Encode a report, an acknowledgment with the feedback of the server.
+ *
+ * \return The size of the packet, or 0 if the buffer is too small
+ */
+size_t encodeReport(const FeedbackReport &report, uint8_t *buffer,
+	size_t size);
+
+/**
+ * Decode a report, or a plain acknowledgment (report.complete is false).
+ *
+ * \return false if the datagram is neither
+ */
+bool decodeReport(const uint8_t *data, size_t length, FeedbackReport &report);
+
+/// Encode samples as version 2 packets, it keeps the state of a stream
+class PacketEncoder {
+public:
+	/// The maximum size of a packet, to stay below the usual MTUs
+	static const size_t maxPacketSize = 1200;
+
+	/// The maximum number of samples of a packet
+	static const size_t maxSamples = 64;
+
+	/// The maximum number of redundant copies of a packet
+	static const unsigned int maxRedundancy = 8;
+
+	/// The number of samples after which we send a keyframe anyway, besides
+	/// the one at the start of every packet
+	unsigned int keyframeInterval = 16;
+
+	/**
+	 * The number of previous samples to repeat in every packet.
+	 *
+	 * It costs a few bytes per copy, and it lets the receiver recover up to
+	 * this number of lost samples without retransmissions.
+	 */
+	unsigned int redundancy = 0;
+
+	/**
+	 * Ask for an acknowledgment in the next packet.
+	 *
+	 * Packets that contain a transition ask for it anyway.
+	 */
+	bool ackRequest = false;
+
+	/**
+	 * Send clockOffset in the next packet.
+	 *
+	 * Only for servers that sent a report, the others do not know the field.
+	 */
+	bool sendClockOffset = false;
+	/// The offset of the clock of the server from ours, in µs
+	int64_t clockOffset = 0;
+
+	/**
+	 * Encode as many samples as possible in a packet.
+	 *
+	 * The samples must have consecutive sequence numbers.
+	 *
+	 * \param count The number of samples, on return the number of samples that
+	 *  have been encoded
+	 * \return The size of the packet, or 0 if not even a sample fits
+	 */
+	size_t encode(const Sample *samples, size_t &count,
+		const Geometry &geometry, uint8_t *buffer, size_t size);
+
+	/// Send a keyframe with the geometry at the next sample, and forget the
+	/// samples to repeat
+	void reset();
+
+private:
+	/// The part of the state that changes with every sample
+	struct State {
+		bool hasKeyframe = false;
+		Sample keyframe;
+		unsigned int sinceKeyframe = 0;
+
+		/// How many of the next keyframes will carry the geometry
+		unsigned int geometryRepeats = 0;
+		/// Keyframes since we last sent the geometry
+		unsigned int keyframesWithoutGeometry = 0;
+	};
+
+	State mState;
+	Geometry mGeometry;
+
+	/// The last encoded samples, from the oldest
+	Sample mHistory[maxRedundancy];
+	unsigned int mHistoryCount = 0;
+
+	/// The status of the last encoded sample, to detect the transitions
+	uint16_t mLastStatus = 0;
+};
+
+/// Decode the version 2 packets of a sender
+class PacketDecoder {
+public:
+	/// The maximum number of samples of a packet, including redundant copies
+	static const size_t maxSamples = PacketEncoder::maxSamples
+		+ PacketEncoder::maxRedundancy;
+
+	/// The samples that could not be decoded
+	struct Stats {
+		uint64_t malformed = 0; ///< Broken packets
+		uint64_t missingKeyframe = 0; ///< Deltas of keyframes we did not get
+		uint64_t missingGeometry = 0; ///< Samples before the geometry
+	};
+
+	/**
+	 * Decode a packet.
+	 *
+	 * The redundant copies come first, and they are marked as such.
+	 *
+	 * \param samples An array of at least maxSamples elements
+	 * \return The number of decoded samples, the others are skipped
+	 */
+	size_t decode(const uint8_t *data, size_t length, Sample *samples);
+
+	/// The last geometry received from the sender
+	const Geometry &geometry() const
+	{
+		return mGeometry;
+	}
+
+	const Stats &stats() const
+	{
+		return mStats;
+	}
+
+	/// Whether the sender told us the offset of our clock from its one
+	bool hasClockOffset() const
+	{
+		return mHasClockOffset;
+	}
+
+	/// Our clock minus the clock of the sender, in µs
+	int64_t clockOffset() const
+	{
+		return mClockOffset;
+	}
+
+private:
+	bool mHasGeometry = false;
+	Geometry mGeometry;
+
+	bool mHasClockOffset = false;
+	int64_t mClockOffset = 0;
+
+	Stats mStats;
+};
@@ -0,0 +1,186 @@
+/**
+ * NetStylus adaptation of the send rate to the link
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the implementation of the rate controller.
+ */
+
+#include "rate_control.h"
+
+#include <algorithm>
+
+namespace {
+
+/// The time between two probes, in µs
+const uint64_t probeInterval = 100000;
+
+/// A probe is lost if it is not acknowledged in this many round trips...
+const uint64_t probeTimeoutRoundTrips = 4;
+/// ... or in this time, whichever is longer, in µs
+const uint64_t minProbeTimeout = 200000;
+
+/// The link is congested above this fraction of lost probes; with the
+/// smoothing, a single lost probe is not enough
+const double maxLoss = 0.1;
+
+/// The link is congested when the round trip grows by this much over the
+/// shortest one, because the packets are queueing somewhere, in µs
+const uint64_t maxQueueDelay = 50000;
+
+/// The shortest time between two increases of the level, in µs
+const uint64_t minIncreaseInterval = 100000;
+
+/// How long the link must stay clean to decrease the level by one, in µs
+const uint64_t recoveryInterval = 1000000;
+
+/// Send a sample in the air at least this often, so that the cursor settles
+/// on its actual position, in µs
+const uint64_t maxHoverGap = 50000;
+
+} // namespace
+
+bool RateController::probeDue(uint64_t now) const
+{
+	return mProbeCount < maxProbes && now - mLastProbe >= probeInterval;
+}
+
+void RateController::probeSent(uint64_t seqNumber, uint64_t now)
+{
+	if (mProbeCount == maxProbes) {
+		// The oldest one has been waiting for too long anyway
+		mProbeHead = (mProbeHead + 1) % maxProbes;
+		mProbeCount--;
+		probeDone(true, now);
+	}
+	Probe &probe = mProbes[(mProbeHead + mProbeCount) % maxProbes];
+	probe.seqNumber = seqNumber;
+	probe.sent = now;
+	mProbeCount++;
+	mLastProbe = now;
+	mStats.probes++;
+}
+
+void RateController::acknowledged(uint64_t seqNumber, uint64_t now)
+{
+	while (mProbeCount) {
+		const Probe &probe = mProbes[mProbeHead];
+		if (probe.seqNumber > seqNumber) {
+			break;
+		}
+		const bool matches = probe.seqNumber == seqNumber;
+		if (matches) {
+			const uint64_t rtt = now - probe.sent;
+			mRoundTrip = mRoundTrip ? (mRoundTrip * 7 + rtt) / 8 : rtt;
+			if (!mMinRoundTrip || rtt < mMinRoundTrip) {
+				mMinRoundTrip = rtt;
+			}
+		}
+		mProbeHead = (mProbeHead + 1) % maxProbes;
+		mProbeCount--;
+		// A newer packet was acknowledged, but not this one: either the probe
+		// or its acknowledgment was lost
+		probeDone(!matches, now);
+	}
+}
+
+void RateController::reported(const FeedbackReport &report, uint64_t now)
+{
+	if (!report.complete) {
+		return;
+	}
+	// The counts restart with the stream
+	if (mHasReport && report.received >= mReportReceived) {
+		const uint64_t received = report.received - mReportReceived;
+		// Late packets make the count go down
+		const uint64_t lost = report.lost > mReportLost
+			? report.lost - mReportLost : 0;
+		if (received + lost) {
+			mLoss += (static_cast<double>(lost) / (received + lost) - mLoss)
+				/ 4;
+		}
+	}
+	mHasReport = true;
+	mReportReceived = report.received;
+	mReportLost = report.lost;
+	adjust(now);
+}
+
+void RateController::update(uint64_t now)
+{
+	const uint64_t timeout = std::max(minProbeTimeout,
+		mRoundTrip * probeTimeoutRoundTrips);
+	while (mProbeCount && now - mProbes[mProbeHead].sent >= timeout) {
+		mProbeHead = (mProbeHead + 1) % maxProbes;
+		mProbeCount--;
+		probeDone(true, now);
+	}
+	adjust(now);
+}
+
+size_t RateController::decimate(Sample *samples, size_t count)
+{
+	const int64_t tolerance = this->tolerance();
+	size_t kept = 0;
+	for (size_t i = 0; i < count; i++) {
+		const Sample &s = samples[i];
+		bool keep = !tolerance || !mHasKept || (s.status & PacketIsTouching)
+			|| s.status != mLastStatus
+			|| s.timestamp - mKept.timestamp >= maxHoverGap;
+		if (!keep) {
+			const int64_t dx = int64_t(s.x) - mKept.x;
+			const int64_t dy = int64_t(s.y) - mKept.y;
+			keep = dx * dx + dy * dy > tolerance * tolerance;
+		}
+		mLastStatus = s.status;
+
+		if (keep) {
+			mKept = s;
+			mHasKept = true;
+			samples[kept++] = s;
+		}
+	}
+	mStats.kept += kept;
+	mStats.decimated += count - kept;
+	return kept;
+}
+
+void RateController::probeDone(bool lost, uint64_t now)
+{
+	if (lost) {
+		mStats.lostProbes++;
+	}
+	if (!mHasReport) {
+		mLoss += ((lost ? 1.0 : 0.0) - mLoss) / 16;
+	}
+	adjust(now);
+}
+
+void RateController::adjust(uint64_t now)
+{
+	const bool congested = mLoss > maxLoss
+		|| (mMinRoundTrip && mRoundTrip > mMinRoundTrip + maxQueueDelay);
+	if (congested) {
+		if (mLevel < maxLevel && now - mLastChange >= std::max(mRoundTrip,
+				minIncreaseInterval)) {
+			mLevel++;
+			mLastChange = now;
+		}
+		mLastCongestion = now;
+	} else if (mLevel && now - std::max(mLastChange, mLastCongestion)
+			>= recoveryInterval) {
+		mLevel--;
+		mLastChange = now;
+	}
+}
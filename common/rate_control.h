@@ -0,0 +1,157 @@
+/**
+ * NetStylus adaptation of the send rate to the link
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the controller that measures the link to the server, and
+ * thins the samples in the air when the link is congested.
+ *
+ * This code does not depend on any platform, so netstylus-bench can drive it
+ * through a simulated lossy link.
+ */
+
+#pragma once
+
+#include "packet_codec.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Measures the loss and the round trip of the link with acknowledgment
+ * requests (probes), and decides a congestion level from them.
+ * When the server sends reports, their counts replace the lost probes in the
+ * measure of the loss.
+ *
+ * At level 0 every sample is sent. At the higher levels, a sample in the air
+ * is dropped if it is closer than tolerance() to the last sample that we kept.
+ * The server joins the samples it receives with segments, and the dropped
+ * samples are within the tolerance from an end of their segment, so the path
+ * of the cursor never moves further than that.
+ * Samples that touch the surface and samples that change the status are never
+ * dropped.
+ *
+ * The level goes up by one at most once per round trip while the link is
+ * congested, and it goes back down slowly once it is clean.
+ */
+class RateController {
+public:
+	/// The highest congestion level, each level doubles the tolerance
+	static const unsigned int maxLevel = 5;
+
+	/// The tolerance at level 1, in mm * 100
+	static const uint32_t baseTolerance = 10;
+
+	/// The samples that went through decimate
+	struct Stats {
+		uint64_t kept = 0;
+		uint64_t decimated = 0;
+		uint64_t probes = 0;
+		uint64_t lostProbes = 0;
+	};
+
+	/// Whether the next packet should ask for an acknowledgment
+	bool probeDue(uint64_t now) const;
+
+	/**
+	 * Tell that a packet asked for an acknowledgment.
+	 *
+	 * \param seqNumber The last sequence number of the packet
+	 * \param now The current time, in µs
+	 */
+	void probeSent(uint64_t seqNumber, uint64_t now);
+
+	/// Tell that the server acknowledged up to seqNumber
+	void acknowledged(uint64_t seqNumber, uint64_t now);
+
+	/// Take the loss counts of a complete report
+	void reported(const FeedbackReport &report, uint64_t now);
+
+	/// Count the probes that have not been acknowledged in time as lost.
+	/// Call it periodically, also when nothing is sent.
+	void update(uint64_t now);
+
+	/**
+	 * Remove the samples that the link cannot afford.
+	 *
+	 * \return The number of samples that are left, from the start of samples
+	 */
+	size_t decimate(Sample *samples, size_t count);
+
+	unsigned int level() const
+	{
+		return mLevel;
+	}
+
+	/// The distance within which samples in the air are dropped, in mm * 100
+	uint32_t tolerance() const
+	{
+		return mLevel ? baseTolerance << (mLevel - 1) : 0;
+	}
+
+	/// The smoothed fraction of lost samples, or of lost probes before the
+	/// first report
+	double loss() const
+	{
+		return mLoss;
+	}
+
+	/// The smoothed round trip, in µs, 0 before the first measure
+	uint64_t roundTrip() const
+	{
+		return mRoundTrip;
+	}
+
+	const Stats &stats() const
+	{
+		return mStats;
+	}
+
+private:
+	/// The probes we remember
+	static const size_t maxProbes = 16;
+
+	struct Probe {
+		uint64_t seqNumber;
+		uint64_t sent;
+	};
+
+	void probeDone(bool lost, uint64_t now);
+	void adjust(uint64_t now);
+
+	Probe mProbes[maxProbes];
+	size_t mProbeHead = 0;
+	size_t mProbeCount = 0;
+	uint64_t mLastProbe = 0;
+
+	double mLoss = 0;
+	/// The counts of the last report, to measure the loss since then
+	bool mHasReport = false;
+	uint64_t mReportReceived = 0;
+	uint64_t mReportLost = 0;
+
+	uint64_t mRoundTrip = 0;
+	uint64_t mMinRoundTrip = 0;
+
+	unsigned int mLevel = 0;
+	uint64_t mLastChange = 0;
+	uint64_t mLastCongestion = 0;
+
+	/// The last sample we kept, and the status of the last sample we saw
+	bool mHasKept = false;
+	Sample mKept;
+	uint16_t mLastStatus = 0;
+
+	Stats mStats;
+};
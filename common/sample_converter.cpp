@@ -0,0 +1,101 @@
+/**
+ * NetStylus conversion of tablet packets to samples
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the implementation of the converter of tablet packets.
+ */
+
+#include "sample_converter.h"
+
+#include <cmath>
+
+namespace {
+
+/// The status bits of the packets that we send, they have the same values
+const uint32_t statusMask = PacketIsTouching | PacketIsEraser
+	| PacketButtonPressed;
+
+/// The offset of a property, and the mask to apply to its value
+void plan(int index, size_t &offset, uint32_t &mask)
+{
+	offset = index >= 0 ? static_cast<size_t>(index) : 0;
+	mask = index >= 0 ? UINT32_MAX : 0;
+}
+
+int64_t toFixed(double divisor)
+{
+	if (!(divisor > 0)) {
+		return int64_t(1) << SampleConverter::scaleBits;
+	}
+	return std::llround((1 << SampleConverter::scaleBits) / divisor);
+}
+
+} // namespace
+
+SampleConverter::SampleConverter(const PacketLayout &layout)
+{
+	mValid = layout.x >= 0 && layout.y >= 0 && layout.status >= 0;
+	if (!mValid) {
+		return;
+	}
+
+	mX = static_cast<size_t>(layout.x);
+	mY = static_cast<size_t>(layout.y);
+	mStatus = static_cast<size_t>(layout.status);
+	plan(layout.pressure, mPressure, mPressureMask);
+	plan(layout.tiltX, mTiltX, mTiltXMask);
+	plan(layout.tiltY, mTiltY, mTiltYMask);
+
+	if (layout.pressure >= 0) {
+		mFeatures |= PacketHasPressure;
+		mMaxPressure = layout.maxPressure;
+	}
+	if (layout.tiltX >= 0) {
+		mFeatures |= PacketHasTiltX;
+	}
+	if (layout.tiltY >= 0) {
+		mFeatures |= PacketHasTiltY;
+	}
+}
+
+void SampleConverter::setScale(double scaleX, double scaleY)
+{
+	mScaleX = toFixed(scaleX);
+	mScaleY = toFixed(scaleY);
+}
+
+void SampleConverter::convert(const int32_t *packets, size_t count,
+	size_t stride, uint64_t seqNumber, uint64_t lastTime, uint64_t interval,
+	Sample *samples) const
+{
+	// The first sample is the oldest one
+	uint64_t timestamp = lastTime - (count ? count - 1 : 0) * interval;
+	for (size_t i = 0; i < count; i++, packets += stride) {
+		Sample &s = samples[i];
+		const uint32_t status = static_cast<uint32_t>(packets[mStatus]);
+		s.status = static_cast<uint16_t>((status & statusMask) | mFeatures);
+		// Coordinates outside of the window can be negative, they wrap like
+		// the other unsigned fields
+		s.x = static_cast<uint32_t>((packets[mX] * mScaleX) >> scaleBits);
+		s.y = static_cast<uint32_t>((packets[mY] * mScaleY) >> scaleBits);
+		s.pressure = static_cast<uint32_t>(packets[mPressure]) & mPressureMask;
+		s.tiltX = static_cast<uint32_t>(packets[mTiltX]) & mTiltXMask;
+		s.tiltY = static_cast<uint32_t>(packets[mTiltY]) & mTiltYMask;
+		s.seqNumber = seqNumber + i;
+		s.timestamp = timestamp;
+		s.redundant = false;
+		timestamp += interval;
+	}
+}
@@ -0,0 +1,112 @@
+/**
+ * NetStylus conversion of tablet packets to samples
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the conversion of the packets of a tablet, such as the
+ * ones of RealTimeStylus, to samples.
+ *
+ * This code does not depend on any platform, so it can be used and measured
+ * also outside of the Windows client.
+ */
+
+#pragma once
+
+#include "packet_codec.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Where the values are in the packets of a tablet, as indices of its packet
+ * properties; -1 means that the tablet does not have that property.
+ */
+struct PacketLayout {
+	int x = -1;
+	int y = -1;
+	int status = -1;
+	int pressure = -1;
+	int tiltX = -1;
+	int tiltY = -1;
+	int32_t maxPressure = 0; ///< The maximum pressure, if pressure >= 0
+};
+
+/**
+ * Converts batches of packets of a tablet to samples.
+ *
+ * The plan of the conversion is computed once for each tablet: the missing
+ * properties read the first property of the packet and mask it, so the loop
+ * does not have any branch.
+ * The coordinates are scaled in fixed point rather than divided in double.
+ */
+class SampleConverter {
+public:
+	/// The fractional bits of the scales
+	static const unsigned int scaleBits = 16;
+
+	SampleConverter() = default;
+	explicit SampleConverter(const PacketLayout &layout);
+
+	/// Whether the tablet has the properties we need
+	bool valid() const
+	{
+		return mValid;
+	}
+
+	int32_t maxPressure() const
+	{
+		return mMaxPressure;
+	}
+
+	/// Set the divisors that convert the coordinates to mm * 100
+	void setScale(double scaleX, double scaleY);
+
+	/**
+	 * Convert a batch of packets.
+	 *
+	 * \param packets The properties of count packets
+	 * \param stride The number of properties of a packet
+	 * \param seqNumber The sequence number of the first sample
+	 * \param lastTime The time of the last packet, in µs
+	 * \param interval The time between two packets, in µs
+	 * \param samples An array of at least count samples
+	 */
+	void convert(const int32_t *packets, size_t count, size_t stride,
+		uint64_t seqNumber, uint64_t lastTime, uint64_t interval,
+		Sample *samples) const;
+
+private:
+	bool mValid = false;
+	int32_t mMaxPressure = 0;
+
+	/// The offsets of the values, 0 when they are not available
+	size_t mX = 0;
+	size_t mY = 0;
+	size_t mStatus = 0;
+	size_t mPressure = 0;
+	size_t mTiltX = 0;
+	size_t mTiltY = 0;
+
+	/// All ones for the available values, 0 for the missing ones
+	uint32_t mPressureMask = 0;
+	uint32_t mTiltXMask = 0;
+	uint32_t mTiltYMask = 0;
+
+	/// The PacketHas* bits of the available values
+	uint16_t mFeatures = 0;
+
+	/// The multipliers of the coordinates, with scaleBits fractional bits
+	int64_t mScaleX = int64_t(1) << scaleBits;
+	int64_t mScaleY = int64_t(1) << scaleBits;
+};
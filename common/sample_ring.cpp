@@ -0,0 +1,217 @@
+/**
+ * NetStylus handoff of samples to a sender thread
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the implementation of the sample ring and of the sender
+ * thread.
+ */
+
+#include "sample_ring.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+/// The sender sleeps at most this long, in case it misses a wake up
+const std::chrono::milliseconds wakeTimeout(10);
+
+inline uint64_t pack(uint32_t low, uint32_t high)
+{
+	return low | static_cast<uint64_t>(high) << 32;
+}
+
+inline uint32_t low(uint64_t word)
+{
+	return static_cast<uint32_t>(word);
+}
+
+inline uint32_t high(uint64_t word)
+{
+	return static_cast<uint32_t>(word >> 32);
+}
+
+} // namespace
+
+bool SampleRing::push(const Sample &sample, const Geometry &geometry)
+{
+	static_assert(!(capacity & (capacity - 1)),
+		"The capacity must be a power of two");
+
+	const size_t tail = mTail.load(std::memory_order_relaxed);
+	size_t head = mHead.load(std::memory_order_acquire);
+	if (tail - head == capacity) {
+		// We wrote the oldest slot, and the consumer does not change it
+		if (!inAir(mSlots[head & (capacity - 1)])
+				&& !(sample.status & PacketIsTouching)) {
+			mStats.droppedNew.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (mHead.compare_exchange_strong(head, head + 1,
+				std::memory_order_acq_rel)) {
+			mStats.droppedOldest.fetch_add(1, std::memory_order_relaxed);
+		}
+		// Otherwise the consumer has just made room
+	}
+
+	store(mSlots[tail & (capacity - 1)], sample, geometry);
+	mTail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+size_t SampleRing::pop(Sample *samples, size_t max, Geometry &geometry)
+{
+	while (true) {
+		size_t head = mHead.load(std::memory_order_acquire);
+		size_t count = mTail.load(std::memory_order_acquire) - head;
+		if (!count) {
+			return 0;
+		}
+		// The head might be old already, the exchange will tell
+		count = std::min(count, max);
+		if (count > capacity) {
+			count = capacity;
+		}
+
+		size_t copied = 0;
+		for (; copied < count; copied++) {
+			Geometry slotGeometry;
+			load(mSlots[(head + copied) & (capacity - 1)], samples[copied],
+				slotGeometry);
+			if (!copied) {
+				geometry = slotGeometry;
+			} else if (slotGeometry != geometry) {
+				break;
+			}
+		}
+
+		if (mHead.compare_exchange_strong(head, head + copied,
+				std::memory_order_acq_rel)) {
+			return copied;
+		}
+		// The producer dropped the oldest sample, and it might have
+		// overwritten the slots we copied
+	}
+}
+
+void SampleRing::store(Slot &slot, const Sample &sample,
+	const Geometry &geometry)
+{
+	const auto relaxed = std::memory_order_relaxed;
+	slot.words[0].store(sample.seqNumber, relaxed);
+	slot.words[1].store(sample.timestamp, relaxed);
+	slot.words[2].store(pack(sample.status, sample.pressure), relaxed);
+	slot.words[3].store(pack(sample.x, sample.y), relaxed);
+	slot.words[4].store(pack(sample.tiltX, sample.tiltY), relaxed);
+	slot.words[5].store(pack(geometry.maxX, geometry.maxY), relaxed);
+	slot.words[6].store(static_cast<uint32_t>(geometry.maxPressure), relaxed);
+}
+
+void SampleRing::load(const Slot &slot, Sample &sample, Geometry &geometry)
+{
+	const auto relaxed = std::memory_order_relaxed;
+	sample.seqNumber = slot.words[0].load(relaxed);
+	sample.timestamp = slot.words[1].load(relaxed);
+	const uint64_t status = slot.words[2].load(relaxed);
+	sample.status = static_cast<uint16_t>(low(status));
+	sample.pressure = high(status);
+	const uint64_t position = slot.words[3].load(relaxed);
+	sample.x = low(position);
+	sample.y = high(position);
+	const uint64_t tilt = slot.words[4].load(relaxed);
+	sample.tiltX = low(tilt);
+	sample.tiltY = high(tilt);
+	sample.redundant = false;
+
+	const uint64_t size = slot.words[5].load(relaxed);
+	geometry.maxX = low(size);
+	geometry.maxY = high(size);
+	geometry.maxPressure = static_cast<int32_t>(low(
+		slot.words[6].load(relaxed)));
+}
+
+bool SampleRing::inAir(const Slot &slot)
+{
+	const uint64_t status = slot.words[2].load(std::memory_order_relaxed);
+	return !(low(status) & PacketIsTouching);
+}
+
+SampleSender::SampleSender(Sink sink) : mSink(std::move(sink))
+{
+	mThread = std::thread(&SampleSender::run, this);
+}
+
+SampleSender::~SampleSender()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mStop = true;
+		mWake.notify_one();
+	}
+	mThread.join();
+}
+
+size_t SampleSender::push(const Sample *samples, size_t count,
+	const Geometry &geometry)
+{
+	size_t dropped = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!mRing.push(samples[i], geometry)) {
+			dropped++;
+		}
+	}
+
+	// Pairs with the fence in run: either we see that the sender is going to
+	// sleep, or it sees our samples
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mSleeping.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mWake.notify_one();
+	}
+	return dropped;
+}
+
+void SampleSender::run()
+{
+	while (!mStop) {
+		if (drain()) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mSleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (mRing.empty() && !mStop) {
+			mWake.wait_for(lock, wakeTimeout);
+		}
+		mSleeping.store(false, std::memory_order_relaxed);
+	}
+
+	while (drain()) {
+	}
+}
+
+bool SampleSender::drain()
+{
+	Sample samples[PacketEncoder::maxSamples];
+	Geometry geometry;
+	const size_t count = mRing.pop(samples, PacketEncoder::maxSamples,
+		geometry);
+	if (!count) {
+		return false;
+	}
+	mSink(samples, count, geometry);
+	return true;
+}
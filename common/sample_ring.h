@@ -0,0 +1,152 @@
+/**
+ * NetStylus handoff of samples to a sender thread
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the ring that passes the samples from the stylus callback
+ * to the thread that sends them, so that a slow socket never stalls the
+ * stylus.
+ *
+ * This code does not depend on any platform.
+ */
+
+#pragma once
+
+#include "packet_codec.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * A single-producer/single-consumer ring of samples.
+ *
+ * Pushing is wait-free: when the ring is full, the producer drops the oldest
+ * sample if it is in the air, or the new sample if it is in the air. When both
+ * touch the surface, it drops the oldest one, as the newest ink matters more.
+ * The status of later samples carries the transitions anyway.
+ *
+ * The producer drops the oldest sample by moving the head, so the consumer
+ * copies the samples before claiming them, and it discards the copy if the
+ * producer moved the head first. The slots are made of atomic words, so such
+ * copies are not data races.
+ */
+class SampleRing {
+public:
+	/// The number of samples of the ring, a power of two
+	static const size_t capacity = 1024;
+
+	/// The samples that have been dropped because the ring was full
+	struct Stats {
+		std::atomic<uint64_t> droppedOldest{0};
+		std::atomic<uint64_t> droppedNew{0};
+	};
+
+	/**
+	 * Add a sample, from the producer.
+	 *
+	 * \return false if the sample has been dropped
+	 */
+	bool push(const Sample &sample, const Geometry &geometry);
+
+	/**
+	 * Take the oldest samples with the same geometry, from the consumer.
+	 *
+	 * \return The number of samples, 0 if the ring is empty
+	 */
+	size_t pop(Sample *samples, size_t max, Geometry &geometry);
+
+	bool empty() const
+	{
+		return mHead.load() == mTail.load();
+	}
+
+	const Stats &stats() const
+	{
+		return mStats;
+	}
+
+private:
+	/// The words of a sample and of its geometry
+	static const unsigned int slotWords = 7;
+
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> words[slotWords];
+	};
+
+	static void store(Slot &slot, const Sample &sample,
+		const Geometry &geometry);
+	static void load(const Slot &slot, Sample &sample, Geometry &geometry);
+	/// Whether the slot can be dropped before a contact sample
+	static bool inAir(const Slot &slot);
+
+	Slot mSlots[capacity];
+	/// The oldest sample, moved by the consumer and by the producer to drop it
+	alignas(64) std::atomic<size_t> mHead{0};
+	/// The next free slot, moved only by the producer
+	alignas(64) std::atomic<size_t> mTail{0};
+
+	Stats mStats;
+};
+
+/**
+ * A thread that takes the samples from a SampleRing and passes them to a sink,
+ * in batches of up to PacketEncoder::maxSamples samples.
+ *
+ * The producer wakes the thread only if it is sleeping.
+ */
+class SampleSender {
+public:
+	/// Receives the samples, on the thread of the sender; it can change them
+	using Sink = std::function<void(Sample *samples, size_t count,
+		const Geometry &geometry)>;
+
+	explicit SampleSender(Sink sink);
+	SampleSender(const SampleSender &) = delete;
+	SampleSender &operator=(const SampleSender &) = delete;
+
+	/// Stop the thread, after passing the samples that are still in the ring
+	~SampleSender();
+
+	/**
+	 * Queue samples, from the producer.
+	 *
+	 * \return The number of dropped samples
+	 */
+	size_t push(const Sample *samples, size_t count, const Geometry &geometry);
+
+	const SampleRing::Stats &stats() const
+	{
+		return mRing.stats();
+	}
+
+private:
+	void run();
+
+	/// Pass the samples of the ring to the sink, return false if it was empty
+	bool drain();
+
+	SampleRing mRing;
+	Sink mSink;
+
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	std::atomic<bool> mSleeping{false};
+	std::atomic<bool> mStop{false};
+	std::thread mThread;
+};
@@ -0,0 +1,150 @@
+/**
+ * Batched datagram receiver for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the recvmmsg-based receiver of the evdev server.
+ */
+
+#include "batch_receiver.h"
+
+#include "clock.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+BatchReceiver::BatchReceiver()
+{
+	for (unsigned int i = 0; i < batchSize; i++) {
+		mIovecs[i].iov_base = mBuffers[i];
+		mIovecs[i].iov_len = bufferSize;
+		mHeaders[i] = {};
+		mHeaders[i].msg_hdr.msg_iov = &mIovecs[i];
+		mHeaders[i].msg_hdr.msg_iovlen = 1;
+		mHeaders[i].msg_hdr.msg_name = &mAddresses[i];
+		mHeaders[i].msg_hdr.msg_control = mControl[i];
+	}
+}
+
+bool BatchReceiver::enableTimestamps(int socket)
+{
+	int enable = 1;
+	if (setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable,
+			sizeof(enable))) {
+		perror("Could not enable the timestamps of the datagrams");
+		return false;
+	}
+	return true;
+}
+
+int BatchReceiver::receive(int socket)
+{
+	mCount = 0;
+
+	// The kernel overwrites the lengths, so restore them every time
+	for (unsigned int i = 0; i < batchSize; i++) {
+		mHeaders[i].msg_hdr.msg_namelen = sizeof(mAddresses[i]);
+		mHeaders[i].msg_hdr.msg_controllen = sizeof(mControl[i]);
+		mHeaders[i].msg_hdr.msg_flags = 0;
+	}
+
+	// MSG_WAITFORONE: block for the first datagram, then take only what is
+	// already queued
+	int ret = recvmmsg(socket, mHeaders, batchSize, MSG_WAITFORONE, nullptr);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	mCount = static_cast<unsigned int>(ret);
+
+	// The kernel timestamps are in CLOCK_REALTIME: convert them to monotonic
+	// through the time elapsed since the arrival
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	mReceiveTime = monotonicTime();
+	const uint64_t realNow = toMicroseconds(now);
+	for (unsigned int i = 0; i < mCount; i++) {
+		mArrivals[i] = mReceiveTime;
+		msghdr &msg = mHeaders[i].msg_hdr;
+		for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+			if (c->cmsg_level != SOL_SOCKET
+					|| c->cmsg_type != SCM_TIMESTAMPNS) {
+				continue;
+			}
+			timespec ts;
+			memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+			const uint64_t arrival = toMicroseconds(ts);
+			if (arrival <= realNow && realNow - arrival < mReceiveTime) {
+				mArrivals[i] = mReceiveTime - (realNow - arrival);
+			}
+		}
+	}
+
+	mStats.syscalls++;
+	mStats.datagrams += mCount;
+	if (mCount > mStats.maxBatch) {
+		mStats.maxBatch = mCount;
+	}
+	unsigned int bucket = 0;
+	while ((2u << bucket) <= mCount && bucket < histogramBuckets - 1) {
+		bucket++;
+	}
+	mStats.histogram[bucket]++;
+
+	for (unsigned int i = 0; i < mCount; i++) {
+		if (mHeaders[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			mStats.truncated++;
+		}
+	}
+
+	return ret;
+}
+
+size_t BatchReceiver::length(unsigned int i) const
+{
+	if (mHeaders[i].msg_hdr.msg_flags & MSG_TRUNC) {
+		return 0;
+	}
+	return mHeaders[i].msg_len;
+}
+
+void BatchReceiver::printStats() const
+{
+	printf("Receive: %" PRIu64 " datagrams in %" PRIu64 " syscalls",
+		mStats.datagrams, mStats.syscalls);
+	if (mStats.syscalls) {
+		printf(" (%.2f per syscall, max %u)",
+			static_cast<double>(mStats.datagrams) / mStats.syscalls,
+			mStats.maxBatch);
+	}
+	printf(", %" PRIu64 " truncated\n", mStats.truncated);
+
+	for (unsigned int i = 0; i < histogramBuckets; i++) {
+		if (!mStats.histogram[i]) {
+			continue;
+		}
+		unsigned int low = 1u << i;
+		unsigned int high = (2u << i) - 1;
+		if (i == histogramBuckets - 1 || high > batchSize) {
+			high = batchSize;
+		}
+		if (low == high) {
+			printf("  %u per syscall: %" PRIu64 "\n", low, mStats.histogram[i]);
+		} else {
+			printf("  %u-%u per syscall: %" PRIu64 "\n", low, high,
+				mStats.histogram[i]);
+		}
+	}
+}
@@ -0,0 +1,134 @@
+/**
+ * Batched datagram receiver for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the reception of the datagrams of the server in batches,
+ * together with the time the kernel received each of them.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Receives all the datagrams queued on a socket with a single recvmmsg call.
+ *
+ * The buffers are allocated once, together with the object, and reused for
+ * every batch: the data of a batch is valid only until the following call to
+ * receive().
+ */
+class BatchReceiver {
+public:
+	/// The maximum number of datagrams read by a single syscall
+	static const unsigned int batchSize = 64;
+
+	/// The maximum size of a datagram; larger datagrams are discarded
+	static const size_t bufferSize = 2048;
+
+	/// The number of buckets of the histogram of datagrams per syscall
+	static const unsigned int histogramBuckets = 7;
+
+	/// Counters about the receive syscalls
+	struct Stats {
+		uint64_t syscalls = 0; ///< Syscalls that returned at least a datagram
+		uint64_t datagrams = 0; ///< Datagrams returned by the syscalls
+		uint64_t truncated = 0; ///< Datagrams discarded for being too large
+		unsigned int maxBatch = 0; ///< Largest batch returned by a syscall
+
+		/**
+		 * Datagrams returned per syscall, in power of two buckets: the bucket
+		 * i counts the batches with a size in [2^i, 2^(i+1)).
+		 */
+		uint64_t histogram[histogramBuckets] = {};
+	};
+
+	BatchReceiver();
+	BatchReceiver(const BatchReceiver &) = delete;
+	BatchReceiver &operator=(const BatchReceiver &) = delete;
+
+	/**
+	 * Wait for at least one datagram and read all the queued ones.
+	 *
+	 * \return The number of datagrams, or -1 on error (errno is kept)
+	 */
+	int receive(int socket);
+
+	/// The number of datagrams of the last batch
+	unsigned int size() const
+	{
+		return mCount;
+	}
+
+	/// The data of the i-th datagram of the last batch
+	const uint8_t *data(unsigned int i) const
+	{
+		return mBuffers[i];
+	}
+
+	/// The length of the i-th datagram of the last batch (0 if truncated)
+	size_t length(unsigned int i) const;
+
+	/// The sender of the i-th datagram of the last batch
+	const sockaddr_in &address(unsigned int i) const
+	{
+		return mAddresses[i];
+	}
+
+	/// When receive() got the last batch, in monotonic µs
+	uint64_t receiveTime() const
+	{
+		return mReceiveTime;
+	}
+
+	/**
+	 * When the kernel received the i-th datagram of the last batch, in
+	 * monotonic µs.
+	 *
+	 * It needs enableTimestamps, otherwise it is receiveTime().
+	 */
+	uint64_t arrival(unsigned int i) const
+	{
+		return mArrivals[i];
+	}
+
+	/// Ask the kernel to timestamp the datagrams of a socket
+	static bool enableTimestamps(int socket);
+
+	const Stats &stats() const
+	{
+		return mStats;
+	}
+
+	/// Print the counters on stdout
+	void printStats() const;
+
+private:
+	mmsghdr mHeaders[batchSize];
+	iovec mIovecs[batchSize];
+	sockaddr_in mAddresses[batchSize];
+	alignas(8) uint8_t mBuffers[batchSize][bufferSize];
+	/// The ancillary data, for the timestamps
+	alignas(cmsghdr) char mControl[batchSize][CMSG_SPACE(sizeof(timespec))];
+	uint64_t mArrivals[batchSize];
+
+	unsigned int mCount = 0;
+	uint64_t mReceiveTime = 0;
+
+	Stats mStats;
+};
@@ -0,0 +1,33 @@
+/**
+ * Clocks for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <time.h>
+
+#include <cstdint>
+
+/// Convert a timespec to µs
+inline uint64_t toMicroseconds(const timespec &ts)
+{
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// The current monotonic time, in µs
+inline uint64_t monotonicTime()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return toMicroseconds(ts);
+}
@@ -0,0 +1,79 @@
+/**
+ * Coordinate mapping for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the computation of the transforms from the windows of the
+ * senders to the virtual devices.
+ */
+
+#include "coordinate_map.h"
+
+namespace {
+
+/// A pixel of the desktop, in device units
+uint32_t toDevice(uint32_t pixel, uint32_t desktop)
+{
+	return static_cast<uint32_t>(uint64_t(pixel) * CoordinateMap::deviceMax
+		/ desktop);
+}
+
+} // namespace
+
+CoordinateMap::CoordinateMap(const Options &options)
+{
+	if (options.mapWidth) {
+		// Options::parse checks that the area is inside the desktop
+		mRegionX = toDevice(options.mapX, options.desktopWidth);
+		mRegionY = toDevice(options.mapY, options.desktopHeight);
+		mRegionWidth = toDevice(options.mapX + options.mapWidth,
+			options.desktopWidth) - mRegionX;
+		mRegionHeight = toDevice(options.mapY + options.mapHeight,
+			options.desktopHeight) - mRegionY;
+	} else {
+		mRegionX = 0;
+		mRegionY = 0;
+		mRegionWidth = deviceMax;
+		mRegionHeight = deviceMax;
+	}
+}
+
+void CoordinateMap::setGeometry(const Geometry &geometry)
+{
+	Transform transform;
+	transform.x = axis(mRegionX, mRegionWidth, geometry.maxX);
+	transform.y = axis(mRegionY, mRegionHeight, geometry.maxY);
+	transform.pressure = axis(0, devicePressure, geometry.maxPressure > 0
+		? static_cast<uint32_t>(geometry.maxPressure) : 0);
+	mTransform = transform;
+}
+
+int32_t CoordinateMap::resolution(const Axis &axis)
+{
+	const uint64_t half = uint64_t(1) << (scaleBits - 1);
+	// The scale is at most deviceMax << scaleBits, it does not overflow
+	const uint64_t perMm = (axis.scale * 100 + half) >> scaleBits;
+	return perMm ? static_cast<int32_t>(perMm) : 1;
+}
+
+CoordinateMap::Axis CoordinateMap::axis(uint32_t offset, uint32_t size,
+	uint32_t max)
+{
+	Axis axis;
+	axis.offset = offset;
+	axis.max = max;
+	// With an empty range, everything goes to the offset
+	axis.scale = max ? (uint64_t(size) << scaleBits) / max : 0;
+	return axis;
+}
@@ -0,0 +1,143 @@
+/**
+ * Coordinate mapping for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include "options.h"
+#include "pressure_curve.h"
+
+#include <packet_codec.h>
+
+#include <cstdint>
+#include <memory>
+
+/**
+ * Maps the samples of a sender to the fixed range of the virtual devices.
+ *
+ * The devices never change their axes, so the window of the client can change
+ * size without recreating them. Instead, the whole window is mapped to a region
+ * of the device: by default the whole device, which the compositor stretches
+ * over the whole desktop, or the area of a monitor.
+ *
+ * The pressure is scaled linearly, unless a curve is set: then it goes
+ * through the table of the curve for the maximum pressure of the sender.
+ *
+ * The transform is fixed point, and it is computed only when the geometry
+ * changes. It is replaced as a whole between two samples, and the session maps
+ * the samples as soon as they arrive, so the buffers after it never mix the
+ * two geometries.
+ */
+class CoordinateMap {
+public:
+	/// The maximum of ABS_X and ABS_Y of the devices
+	static const uint32_t deviceMax = 65535;
+
+	/// The maximum of ABS_PRESSURE of the devices
+	static const int32_t devicePressure = 65535;
+
+	/// The fractional bits of the scales
+	static const unsigned int scaleBits = 32;
+
+	/// The geometry of all the virtual devices
+	static Geometry deviceGeometry()
+	{
+		return {deviceMax, deviceMax, devicePressure};
+	}
+
+	/// Map the whole window to the region of the options
+	explicit CoordinateMap(const Options &options);
+
+	/// Compute the transform for a new geometry of the sender
+	void setGeometry(const Geometry &geometry);
+
+	/// Use the table of a pressure curve for the last geometry, or nullptr to
+	/// scale the pressure linearly
+	void setPressureTable(std::shared_ptr<const PressureTable> table)
+	{
+		mPressureTable = std::move(table);
+	}
+
+	const PressureTable *pressureTable() const
+	{
+		return mPressureTable.get();
+	}
+
+	/**
+	 * The device units per mm of the window of the sender, for the
+	 * applications that want the physical size of the stylus.
+	 *
+	 * The senders measure their window in 10µm, so it follows the last
+	 * geometry; the devices keep the one of the geometry they were created
+	 * with.
+	 */
+	int32_t resolutionX() const
+	{
+		return resolution(mTransform.x);
+	}
+
+	int32_t resolutionY() const
+	{
+		return resolution(mTransform.y);
+	}
+
+	/// Map x, y and pressure of a sample to the device
+	void apply(Sample &sample) const
+	{
+		sample.x = map(mTransform.x, sample.x);
+		sample.y = map(mTransform.y, sample.y);
+		sample.pressure = mPressureTable
+			? mPressureTable->map(sample.pressure)
+			: map(mTransform.pressure, sample.pressure);
+	}
+
+private:
+	/// The transform of a value: offset + value * scale, with value clamped
+	struct Axis {
+		uint32_t offset = 0;
+		uint64_t scale = 0;
+		uint32_t max = 0; ///< The maximum of the sender
+	};
+
+	struct Transform {
+		Axis x;
+		Axis y;
+		Axis pressure;
+	};
+
+	static Axis axis(uint32_t offset, uint32_t size, uint32_t max);
+
+	/// The device units per 100 units of the sender, at least 1
+	static int32_t resolution(const Axis &axis);
+
+	static uint32_t map(const Axis &axis, uint32_t value)
+	{
+		// Coordinates outside of the window arrive as negative values
+		const int32_t signedValue = static_cast<int32_t>(value);
+		uint64_t clamped = signedValue < 0 ? 0 : static_cast<uint32_t>(
+			signedValue);
+		clamped = clamped < axis.max ? clamped : axis.max;
+		const uint64_t half = uint64_t(1) << (scaleBits - 1);
+		return axis.offset + static_cast<uint32_t>((clamped * axis.scale
+			+ half) >> scaleBits);
+	}
+
+	/// The region of the device, in device units
+	uint32_t mRegionX;
+	uint32_t mRegionY;
+	uint32_t mRegionWidth;
+	uint32_t mRegionHeight;
+
+	Transform mTransform;
+	std::shared_ptr<const PressureTable> mPressureTable;
+};
@@ -0,0 +1,101 @@
+/**
+ * Evdev event frames for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the builder of evdev frames.
+ */
+
+#include "event_frame.h"
+
+#include "output_sink.h"
+
+#include <cassert>
+
+EventFrame::EventFrame()
+{
+	invalidate();
+}
+
+void EventFrame::setAbs(unsigned int code, int value)
+{
+	assert(code < ABS_CNT);
+	if (mAbsKnown[code] && mAbs[code] == value) {
+		return;
+	}
+	push(EV_ABS, code, value);
+	mAbs[code] = value;
+	mAbsKnown[code] = true;
+}
+
+void EventFrame::setKey(unsigned int code, bool pressed)
+{
+	assert(code < KEY_CNT);
+	int8_t value = pressed ? 1 : 0;
+	if (mKeys[code] == value) {
+		return;
+	}
+	push(EV_KEY, code, value);
+	mKeys[code] = value;
+}
+
+void EventFrame::add(unsigned int type, unsigned int code, int value)
+{
+	push(type, code, value);
+}
+
+int EventFrame::commit(OutputSink &sink)
+{
+	if (!mCount) {
+		return 0;
+	}
+
+	mEvents[mCount] = {};
+	mEvents[mCount].type = EV_SYN;
+	mEvents[mCount].code = SYN_REPORT;
+	const unsigned int count = mCount + 1;
+	mCount = 0;
+
+	const int err = sink.write(mEvents, count);
+	if (err) {
+		// We do not know what the device has received
+		invalidate();
+	}
+	return err;
+}
+
+void EventFrame::invalidate()
+{
+	for (unsigned int i = 0; i < ABS_CNT; i++) {
+		mAbsKnown[i] = false;
+	}
+	for (unsigned int i = 0; i < KEY_CNT; i++) {
+		mKeys[i] = -1;
+	}
+}
+
+void EventFrame::push(unsigned int type, unsigned int code, int value)
+{
+	assert(mCount < maxEvents);
+	if (mCount >= maxEvents) {
+		return;
+	}
+
+	// uinput ignores the time, the kernel will set it
+	input_event &ev = mEvents[mCount++];
+	ev = {};
+	ev.type = static_cast<uint16_t>(type);
+	ev.code = static_cast<uint16_t>(code);
+	ev.value = value;
+}
@@ -0,0 +1,77 @@
+/**
+ * Evdev event frames for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <linux/input.h>
+
+#include <cstdint>
+
+class OutputSink;
+
+/**
+ * Collects the events of a frame and writes them to the output sink at once,
+ * SYN_REPORT included (a single syscall for uinput devices).
+ *
+ * It remembers the last value written for each axis and key, so that the
+ * unchanged ones are not written again (the kernel would drop them anyway).
+ * A frame without changes is not written at all.
+ */
+class EventFrame {
+public:
+	/// The maximum number of events of a frame, SYN_REPORT excluded
+	static const unsigned int maxEvents = 16;
+
+	EventFrame();
+
+	/// Add an absolute axis to the frame, if it has changed
+	void setAbs(unsigned int code, int value);
+
+	/// Add a key to the frame, if it has changed
+	void setKey(unsigned int code, bool pressed);
+
+	/// Add an event that is always written, such as MSC events
+	void add(unsigned int type, unsigned int code, int value);
+
+	/// The number of events waiting to be written
+	unsigned int pending() const
+	{
+		return mCount;
+	}
+
+	/**
+	 * Terminate the frame with a SYN_REPORT and write it.
+	 *
+	 * \return 0 on success or when there was nothing to write, a negative
+	 *  errno otherwise
+	 */
+	int commit(OutputSink &sink);
+
+	/// Forget the cached state, e.g., because the device was recreated
+	void invalidate();
+
+private:
+	void push(unsigned int type, unsigned int code, int value);
+
+	input_event mEvents[maxEvents + 1];
+	unsigned int mCount = 0;
+
+	/// The last values of the axes
+	int mAbs[ABS_CNT];
+	/// Whether mAbs contains a meaningful value
+	bool mAbsKnown[ABS_CNT];
+
+	/// The last state of the keys: 0 or 1, or -1 when unknown
+	int8_t mKeys[KEY_CNT];
+};
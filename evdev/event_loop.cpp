@@ -0,0 +1,206 @@
+/**
+ * Event loop for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the epoll-based event loop of the evdev server.
+ */
+
+#include "event_loop.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+EventLoop::~EventLoop()
+{
+	for (auto &timer : mTimerCallbacks) {
+		close(timer.first);
+	}
+	if (mSignalFd >= 0) {
+		close(mSignalFd);
+	}
+	if (mEpoll >= 0) {
+		close(mEpoll);
+	}
+}
+
+bool EventLoop::init()
+{
+	mEpoll = epoll_create1(EPOLL_CLOEXEC);
+	if (mEpoll < 0) {
+		perror("Could not create the epoll instance");
+		return false;
+	}
+	sigemptyset(&mSignals);
+	return true;
+}
+
+bool EventLoop::add(int fd, uint32_t events, Callback callback)
+{
+	epoll_event ev = {};
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, fd, &ev)) {
+		perror("Could not add a file descriptor to epoll");
+		return false;
+	}
+	mCallbacks[fd] = std::make_shared<Callback>(std::move(callback));
+	return true;
+}
+
+void EventLoop::remove(int fd)
+{
+	if (mCallbacks.erase(fd)) {
+		epoll_ctl(mEpoll, EPOLL_CTL_DEL, fd, nullptr);
+	}
+}
+
+bool EventLoop::watchSignal(int signo, std::function<void()> callback)
+{
+	sigaddset(&mSignals, signo);
+	if (sigprocmask(SIG_BLOCK, &mSignals, nullptr)) {
+		perror("Could not block the signals");
+		return false;
+	}
+
+	// Passing the old descriptor updates its mask
+	int fd = signalfd(mSignalFd, &mSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		perror("Could not create the signalfd");
+		return false;
+	}
+	if (mSignalFd < 0) {
+		mSignalFd = fd;
+		if (!add(mSignalFd, EPOLLIN, [this](uint32_t) { readSignals(); })) {
+			return false;
+		}
+	}
+
+	mSignalCallbacks[signo] = std::move(callback);
+	return true;
+}
+
+int EventLoop::addTimer(std::function<void()> callback)
+{
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer < 0) {
+		perror("Could not create a timer");
+		return -1;
+	}
+	if (!add(timer, EPOLLIN, [this, timer](uint32_t) { readTimer(timer); })) {
+		close(timer);
+		return -1;
+	}
+	mTimerCallbacks[timer] = std::move(callback);
+	return timer;
+}
+
+bool EventLoop::setTimer(int timer, uint64_t firstUs, uint64_t intervalUs)
+{
+	itimerspec spec = {};
+	spec.it_value.tv_sec = firstUs / 1000000;
+	spec.it_value.tv_nsec = (firstUs % 1000000) * 1000;
+	spec.it_interval.tv_sec = intervalUs / 1000000;
+	spec.it_interval.tv_nsec = (intervalUs % 1000000) * 1000;
+	if (timerfd_settime(timer, 0, &spec, nullptr)) {
+		perror("Could not set a timer");
+		return false;
+	}
+	return true;
+}
+
+bool EventLoop::setTimerAt(int timer, uint64_t time)
+{
+	itimerspec spec = {};
+	spec.it_value.tv_sec = time / 1000000;
+	spec.it_value.tv_nsec = (time % 1000000) * 1000;
+	if (!time) {
+		// A zero it_value would disarm the timer, fire as soon as possible
+		spec.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+		perror("Could not set a timer");
+		return false;
+	}
+	return true;
+}
+
+void EventLoop::removeTimer(int timer)
+{
+	if (mTimerCallbacks.erase(timer)) {
+		remove(timer);
+		close(timer);
+	}
+}
+
+void EventLoop::run()
+{
+	const int maxEvents = 16;
+	epoll_event events[maxEvents];
+
+	mRunning = true;
+	while (mRunning) {
+		int n = epoll_wait(mEpoll, events, maxEvents, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::string msg = "epoll_wait failed: ";
+			msg += strerror(errno);
+			throw std::runtime_error(msg);
+		}
+
+		for (int i = 0; i < n && mRunning; i++) {
+			auto it = mCallbacks.find(events[i].data.fd);
+			if (it == mCallbacks.end()) {
+				// Removed by a previous callback of this round
+				continue;
+			}
+			std::shared_ptr<Callback> callback = it->second;
+			(*callback)(events[i].events);
+		}
+	}
+}
+
+void EventLoop::readSignals()
+{
+	signalfd_siginfo info;
+	while (read(mSignalFd, &info, sizeof(info)) == sizeof(info)) {
+		auto it = mSignalCallbacks.find(static_cast<int>(info.ssi_signo));
+		if (it != mSignalCallbacks.end()) {
+			it->second();
+		}
+	}
+}
+
+void EventLoop::readTimer(int timer)
+{
+	uint64_t expirations;
+	if (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+		// Already consumed, or rearmed in the meantime
+		return;
+	}
+	auto it = mTimerCallbacks.find(timer);
+	if (it != mTimerCallbacks.end()) {
+		it->second();
+	}
+}
@@ -0,0 +1,112 @@
+/**
+ * Event loop for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <signal.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+/**
+ * A single-threaded loop based on epoll.
+ *
+ * Any file descriptor can be registered with a callback. Signals are received
+ * through a signalfd and timers are timerfds, so the loop sleeps until
+ * something actually happens.
+ */
+class EventLoop {
+public:
+	/// The callback of a file descriptor, receives the epoll events
+	using Callback = std::function<void(uint32_t events)>;
+
+	EventLoop() = default;
+	EventLoop(const EventLoop &) = delete;
+	EventLoop &operator=(const EventLoop &) = delete;
+	~EventLoop();
+
+	/// Create the epoll instance
+	bool init();
+
+	/// Start monitoring a file descriptor
+	bool add(int fd, uint32_t events, Callback callback);
+
+	/// Stop monitoring a file descriptor (it is not closed)
+	void remove(int fd);
+
+	/**
+	 * Receive a signal through the loop instead of an asynchronous handler.
+	 *
+	 * The signal is blocked for the whole process, so this should be called
+	 * before creating any thread.
+	 */
+	bool watchSignal(int signo, std::function<void()> callback);
+
+	/**
+	 * Create a disarmed timer.
+	 *
+	 * \return The timer file descriptor, owned by the loop, or -1 on error
+	 */
+	int addTimer(std::function<void()> callback);
+
+	/**
+	 * Arm or disarm a timer.
+	 *
+	 * \param firstUs The first expiration in µs from now, 0 disarms it
+	 * \param intervalUs The period after the first expiration, 0 for one-shot
+	 */
+	bool setTimer(int timer, uint64_t firstUs, uint64_t intervalUs = 0);
+
+	/// Arm a one-shot timer at a time of the monotonic clock, in µs
+	bool setTimerAt(int timer, uint64_t time);
+
+	/// Close a timer created with addTimer
+	void removeTimer(int timer);
+
+	/// Dispatch the events until stop() is called
+	void run();
+
+	/// Make run() return after the current dispatch
+	void stop()
+	{
+		mRunning = false;
+	}
+
+	bool running() const
+	{
+		return mRunning;
+	}
+
+private:
+	void readSignals();
+	void readTimer(int timer);
+
+	int mEpoll = -1;
+	int mSignalFd = -1;
+	sigset_t mSignals;
+
+	bool mRunning = false;
+
+	/**
+	 * The callbacks of the file descriptors.
+	 *
+	 * They are stored in a shared_ptr so that a callback can remove itself or
+	 * another file descriptor while it is running.
+	 */
+	std::unordered_map<int, std::shared_ptr<Callback>> mCallbacks;
+	std::unordered_map<int, std::function<void()>> mSignalCallbacks;
+	std::unordered_map<int, std::function<void()>> mTimerCallbacks;
+};
@@ -0,0 +1,133 @@
+/**
+ * Jitter buffer for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the adaptive playout buffer of the evdev server.
+ */
+
+#include "jitter_buffer.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+/// The fraction of the samples that should arrive before their due time
+const double onTimeFraction = 0.95;
+
+/// Recompute the target after this number of samples
+const unsigned int adaptInterval = 16;
+
+/// The largest change of the base between two samples, in µs
+const int64_t maxStep = 250;
+
+} // namespace
+
+JitterBuffer::JitterBuffer(uint64_t maxDelay) : mMaxDelay(maxDelay)
+{
+}
+
+bool JitterBuffer::push(const Sample &sample, uint64_t arrival)
+{
+	if (!sample.timestamp) {
+		return false;
+	}
+
+	const int64_t transit = static_cast<int64_t>(arrival - sample.timestamp);
+	mTransits[mTransitPos] = transit;
+	mTransitPos = (mTransitPos + 1) % windowSize;
+	if (mTransitCount < windowSize) {
+		mTransitCount++;
+	}
+	if (!mHasBase || ++mSinceAdapt >= adaptInterval) {
+		adapt();
+	}
+
+	if (!mHasBase || (!mCount && arrival > mLastDue)) {
+		// Nothing is playing, so we can change the delay without a jerk
+		mBase = mTarget;
+		mHasBase = true;
+	} else if (mTarget > mBase) {
+		mBase += std::min(mTarget - mBase, maxStep);
+	} else {
+		mBase -= std::min(mBase - mTarget, maxStep);
+	}
+
+	uint64_t due = sample.timestamp + static_cast<uint64_t>(mBase);
+	if (due < arrival) {
+		mLate++;
+		due = arrival;
+	} else if (due - arrival > mMaxDelay) {
+		due = arrival + mMaxDelay;
+	}
+	// Never release the samples out of order
+	due = std::max(due, mLastDue);
+	mLastDue = due;
+	mHold.record(due - arrival);
+
+	if (mCount == capacity) {
+		// Only a flood can hold this many samples within mMaxDelay
+		mOverflows++;
+		mFirst = (mFirst + 1) % capacity;
+		mCount--;
+	}
+	mEntries[(mFirst + mCount) % capacity] = {sample, due};
+	mCount++;
+	return true;
+}
+
+bool JitterBuffer::pop(uint64_t now, Sample &sample)
+{
+	if (!mCount || mEntries[mFirst].due > now) {
+		return false;
+	}
+	sample = mEntries[mFirst].sample;
+	mFirst = (mFirst + 1) % capacity;
+	mCount--;
+	return true;
+}
+
+void JitterBuffer::adapt()
+{
+	mSinceAdapt = 0;
+	if (!mTransitCount) {
+		return;
+	}
+
+	int64_t sorted[windowSize];
+	std::copy(mTransits, mTransits + mTransitCount, sorted);
+	const unsigned int index = static_cast<unsigned int>(
+		onTimeFraction * (mTransitCount - 1));
+	std::nth_element(sorted, sorted + index, sorted + mTransitCount);
+	mTarget = sorted[index];
+	mMinTransit = *std::min_element(sorted, sorted + mTransitCount);
+
+	const int64_t maxDelay = static_cast<int64_t>(mMaxDelay);
+	if (mTarget - mMinTransit > maxDelay) {
+		mTarget = mMinTransit + maxDelay;
+	}
+}
+
+void JitterBuffer::print(const char *name) const
+{
+	std::string label = name;
+	label += ": jitter buffer hold";
+	mHold.print(label.c_str());
+	printf("%s: jitter buffer delay %" PRId64 "µs over the fastest sample, "
+		"%" PRIu64 " late, %" PRIu64 " overflows\n", name,
+		mHasBase ? mBase - mMinTransit : 0, mLate, mOverflows);
+}
@@ -0,0 +1,107 @@
+/**
+ * Jitter buffer for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include "stats.h"
+
+#include <packet_codec.h>
+
+#include <cstdint>
+
+/**
+ * Holds the samples of a sender, to release them with their original spacing.
+ *
+ * A sample is due at its sender time plus a base transit time, so samples that
+ * arrive in a burst are spread again as they were taken.
+ * The base is a high percentile of the transit times of the last samples: the
+ * more the network jitters, the longer we hold the samples.
+ * The base follows its target with small steps during a stroke, to keep the
+ * cadence uniform, and jumps to it when the buffer has been idle.
+ * Since it is measured on a sliding window, it also follows the drift between
+ * the clocks of the sender and of the server.
+ *
+ * Samples that arrive after their due time are released immediately: a late
+ * sample is still better than a lost one.
+ */
+class JitterBuffer {
+public:
+	/// The maximum number of held samples, older ones are dropped when full
+	static const unsigned int capacity = 256;
+
+	/// The number of transit times of the sliding window
+	static const unsigned int windowSize = 128;
+
+	/// \param maxDelay The longest time a sample can be held, in µs
+	explicit JitterBuffer(uint64_t maxDelay);
+
+	/**
+	 * Add a sample.
+	 *
+	 * \param arrival The monotonic time of arrival of the sample, in µs
+	 * \return false if the sample has no timestamp, and must not be held
+	 */
+	bool push(const Sample &sample, uint64_t arrival);
+
+	bool empty() const
+	{
+		return !mCount;
+	}
+
+	/// The monotonic time at which the oldest sample is due, in µs
+	uint64_t nextDue() const
+	{
+		return mEntries[mFirst].due;
+	}
+
+	/// Remove the oldest sample, if it is due at the given monotonic time
+	bool pop(uint64_t now, Sample &sample);
+
+	/// Print the statistics on stdout
+	void print(const char *name) const;
+
+private:
+	struct Entry {
+		Sample sample;
+		uint64_t due;
+	};
+
+	/// Update the target of the base transit
+	void adapt();
+
+	uint64_t mMaxDelay;
+
+	Entry mEntries[capacity];
+	unsigned int mFirst = 0;
+	unsigned int mCount = 0;
+	/// The due time of the last sample, to keep the order
+	uint64_t mLastDue = 0;
+
+	/// The transit times, with an arbitrary offset since the clocks differ
+	int64_t mTransits[windowSize];
+	unsigned int mTransitCount = 0;
+	unsigned int mTransitPos = 0;
+	unsigned int mSinceAdapt = 0;
+
+	bool mHasBase = false;
+	int64_t mBase = 0;
+	int64_t mTarget = 0;
+	/// The transit of the fastest sample of the window, to report the delay
+	int64_t mMinTransit = 0;
+
+	/// How long we held the samples
+	LatencyHistogram mHold;
+	uint64_t mLate = 0;
+	uint64_t mOverflows = 0;
+};
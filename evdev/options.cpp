@@ -0,0 +1,315 @@
+/**
+ * Command line options of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the parser of the command line of the evdev server.
+ */
+
+#include "options.h"
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+/// The longest prediction we allow, in ms: after that, it is just a guess
+const unsigned long maxPrediction = 50;
+
+/// The longest hold of the jitter buffer we allow, in ms
+const unsigned long maxJitterBuffer = 200;
+
+/// The longest hold of the jitter buffer when upsampling, unless specified
+const uint64_t upsamplingJitterBuffer = 50000;
+
+/// The fastest replay with a timing, use "max" to go faster
+const double maxReplaySpeed = 1000;
+
+/// The largest size or offset of the desktop we accept, in pixels
+const unsigned int maxDesktop = 65536;
+
+/// The highest cutoff of the smoothing, in Hz: above that, it does nothing
+const double maxCutoff = 1000;
+
+void usage(const char *program, FILE *out)
+{
+	fprintf(out, "Usage: %s [options]\n"
+		"  -p, --predict MS   Predict the stylus MS milliseconds ahead "
+		"(max %lu)\n"
+		"  -j, --jitter-buffer MS\n"
+		"                     Hold the samples up to MS milliseconds, to "
+		"release them\n"
+		"                     with their original spacing (max %lu)\n"
+		"  -r, --rate HZ      Inject interpolated samples at HZ, through the "
+		"jitter\n"
+		"                     buffer (max %u)\n"
+		"  -i, --interpolation linear|catmull-rom\n"
+		"                     How to interpolate the samples "
+		"(default catmull-rom)\n"
+		"  -R, --record FILE  Append the received datagrams to FILE\n"
+		"  -P, --replay FILE  Inject a recording instead of listening\n"
+		"  -s, --speed N|max  Replay N times faster than recorded, or as "
+		"fast as possible\n"
+		"  -o, --output SINK  Where to write the events: uinput (default), "
+		"null or ring\n"
+		"  -L, --event-log FILE\n"
+		"                     Write the events to FILE instead of devices\n"
+		"  -m, --map WxH+X+Y  Map the senders to this area of the desktop, "
+		"e.g., a\n"
+		"                     monitor, in pixels (it needs --desktop)\n"
+		"  -D, --desktop WxH  The size of the whole desktop, in pixels\n"
+		"  -f, --smooth [AXIS=]MIN:BETA[:DCUTOFF]\n"
+		"                     Smooth AXIS (x, y or pressure; x and y if "
+		"omitted)\n"
+		"                     with a One-Euro filter: cutoff MIN Hz at "
+		"rest, growing\n"
+		"                     by BETA Hz per device unit/s "
+		"(DCUTOFF default 1 Hz)\n"
+		"  -c, --pressure-curve CURVE\n"
+		"                     The response to the pressure: linear "
+		"(default),\n"
+		"                     gamma:G, bezier:X1,Y1,X2,Y2 or "
+		"table:X:Y,X:Y,...\n"
+		"  -C, --curve-file FILE\n"
+		"                     Read a curve for each sender address from "
+		"FILE,\n"
+		"                     as lines of ADDRESS CURVE; kill -HUP reloads "
+		"it\n"
+		"  -h, --help         Show this message\n", program, maxPrediction,
+		maxJitterBuffer, Upsampler::maxRate);
+}
+
+/// Parse a number in [0, max], return false if it is not valid
+bool parseNumber(const char *arg, unsigned long max, unsigned long &value)
+{
+	char *end;
+	value = strtoul(arg, &end, 10);
+	return *arg && !*end && value <= max;
+}
+
+/// Parse WxH, or WxH+X+Y if x and y are not null; the size cannot be empty
+bool parseArea(const char *arg, uint32_t &width, uint32_t &height,
+	uint32_t *x = nullptr, uint32_t *y = nullptr)
+{
+	unsigned int w, h, left = 0, top = 0;
+	int length = 0;
+	const int parsed = x
+		? sscanf(arg, "%ux%u+%u+%u%n", &w, &h, &left, &top, &length)
+		: sscanf(arg, "%ux%u%n", &w, &h, &length);
+	if (parsed != (x ? 4 : 2) || arg[length] || !w || !h
+			|| w > maxDesktop || h > maxDesktop || left > maxDesktop
+			|| top > maxDesktop) {
+		return false;
+	}
+	width = w;
+	height = h;
+	if (x) {
+		*x = left;
+		*y = top;
+	}
+	return true;
+}
+
+/// Parse [AXIS=]MIN:BETA[:DCUTOFF] into the parameters of the axes
+bool parseSmoothing(const char *arg, StrokeFilter::Settings &settings)
+{
+	StrokeFilter::Parameters *axes[2] = {&settings.x, &settings.y};
+	const char *equal = strchr(arg, '=');
+	if (equal) {
+		const std::string axis(arg, equal);
+		if (axis == "x") {
+			axes[1] = nullptr;
+		} else if (axis == "y") {
+			axes[0] = axes[1];
+			axes[1] = nullptr;
+		} else if (axis == "pressure") {
+			axes[0] = &settings.pressure;
+			axes[1] = nullptr;
+		} else {
+			return false;
+		}
+		arg = equal + 1;
+	}
+
+	StrokeFilter::Parameters parameters;
+	int length = 0;
+	const int parsed = sscanf(arg, "%lf:%lf%n:%lf%n", &parameters.minCutoff,
+		&parameters.beta, &length, &parameters.derivativeCutoff, &length);
+	if (parsed < 2 || arg[length] || !(parameters.minCutoff > 0)
+			|| parameters.minCutoff > maxCutoff || !(parameters.beta >= 0)
+			|| !(parameters.derivativeCutoff > 0)
+			|| parameters.derivativeCutoff > maxCutoff) {
+		return false;
+	}
+	for (StrokeFilter::Parameters *axis : axes) {
+		if (axis) {
+			*axis = parameters;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+bool Options::parse(int argc, char **argv)
+{
+	static const option longOptions[] = {
+		{"predict", required_argument, nullptr, 'p'},
+		{"jitter-buffer", required_argument, nullptr, 'j'},
+		{"rate", required_argument, nullptr, 'r'},
+		{"interpolation", required_argument, nullptr, 'i'},
+		{"record", required_argument, nullptr, 'R'},
+		{"replay", required_argument, nullptr, 'P'},
+		{"speed", required_argument, nullptr, 's'},
+		{"output", required_argument, nullptr, 'o'},
+		{"event-log", required_argument, nullptr, 'L'},
+		{"map", required_argument, nullptr, 'm'},
+		{"desktop", required_argument, nullptr, 'D'},
+		{"smooth", required_argument, nullptr, 'f'},
+		{"pressure-curve", required_argument, nullptr, 'c'},
+		{"curve-file", required_argument, nullptr, 'C'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	int opt;
+	const char *shortOptions = "p:j:r:i:R:P:s:o:L:m:D:f:c:C:h";
+	while ((opt = getopt_long(argc, argv, shortOptions, longOptions,
+			nullptr)) != -1) {
+		unsigned long value;
+		switch (opt) {
+		case 'p':
+			if (!parseNumber(optarg, maxPrediction, value)) {
+				fprintf(stderr, "Invalid prediction: %s\n", optarg);
+				return false;
+			}
+			prediction = value * 1000;
+			break;
+		case 'j':
+			if (!parseNumber(optarg, maxJitterBuffer, value)) {
+				fprintf(stderr, "Invalid jitter buffer: %s\n", optarg);
+				return false;
+			}
+			jitterBuffer = value * 1000;
+			break;
+		case 'r':
+			if (!parseNumber(optarg, Upsampler::maxRate, value) || !value) {
+				fprintf(stderr, "Invalid rate: %s\n", optarg);
+				return false;
+			}
+			outputRate = static_cast<unsigned int>(value);
+			break;
+		case 'i':
+			if (!strcmp(optarg, "linear")) {
+				interpolation = Upsampler::Interpolation::Linear;
+			} else if (!strcmp(optarg, "catmull-rom")) {
+				interpolation = Upsampler::Interpolation::CatmullRom;
+			} else {
+				fprintf(stderr, "Invalid interpolation: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'R':
+			record = optarg;
+			break;
+		case 'P':
+			replay = optarg;
+			break;
+		case 'o':
+			if (!strcmp(optarg, "uinput")) {
+				output = Output::Uinput;
+			} else if (!strcmp(optarg, "null")) {
+				output = Output::Null;
+			} else if (!strcmp(optarg, "ring")) {
+				output = Output::Ring;
+			} else {
+				fprintf(stderr, "Invalid output: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'L':
+			output = Output::EventLog;
+			eventLog = optarg;
+			break;
+		case 'm':
+			if (!parseArea(optarg, mapWidth, mapHeight, &mapX, &mapY)) {
+				fprintf(stderr, "Invalid area: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'D':
+			if (!parseArea(optarg, desktopWidth, desktopHeight)) {
+				fprintf(stderr, "Invalid desktop: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'f':
+			if (!parseSmoothing(optarg, smoothing)) {
+				fprintf(stderr, "Invalid smoothing: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'c':
+			if (!PressureCurve::parse(optarg, pressureCurve)) {
+				fprintf(stderr, "Invalid pressure curve: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'C':
+			curveFile = optarg;
+			break;
+		case 's':
+			if (!strcmp(optarg, "max")) {
+				replaySpeed = 0;
+			} else {
+				char *end;
+				replaySpeed = strtod(optarg, &end);
+				if (!*optarg || *end || !(replaySpeed > 0)
+						|| replaySpeed > maxReplaySpeed) {
+					fprintf(stderr, "Invalid speed: %s\n", optarg);
+					return false;
+				}
+			}
+			break;
+		case 'h':
+			usage(argv[0], stdout);
+			exit(0);
+		default:
+			usage(argv[0], stderr);
+			return false;
+		}
+	}
+
+	if (optind < argc) {
+		fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+		usage(argv[0], stderr);
+		return false;
+	}
+
+	if (mapWidth && (!desktopWidth || mapX + mapWidth > desktopWidth
+			|| mapY + mapHeight > desktopHeight)) {
+		fputs("The area must be inside the desktop, set with --desktop\n",
+			stderr);
+		return false;
+	}
+
+	if (outputRate && !jitterBuffer) {
+		jitterBuffer = upsamplingJitterBuffer;
+	}
+	return true;
+}
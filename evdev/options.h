@@ -0,0 +1,91 @@
+/**
+ * Command line options of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include "pressure_curve.h"
+#include "stroke_filter.h"
+#include "upsampler.h"
+
+#include <cstdint>
+
+/// The settings of the server; the defaults keep the optional stages disabled
+struct Options {
+	/// How far ahead to predict the stylus, in µs (0 to disable the
+	/// prediction)
+	uint64_t prediction = 0;
+
+	/// The longest hold of the jitter buffer, in µs (0 to disable the buffer)
+	uint64_t jitterBuffer = 0;
+
+	/**
+	 * The rate of the output, in Hz (0 to inject the real samples).
+	 *
+	 * The upsampled stream is played through the jitter buffer, so this enables
+	 * it, too.
+	 */
+	unsigned int outputRate = 0;
+	Upsampler::Interpolation interpolation =
+		Upsampler::Interpolation::CatmullRom;
+
+	/// Append the received datagrams to this file (nullptr not to record)
+	const char *record = nullptr;
+
+	/// Replay the datagrams of this recording, instead of opening a socket
+	const char *replay = nullptr;
+	/// The speed of the replay, relative to the recording (0 for the maximum)
+	double replaySpeed = 1;
+
+	/// Where the frames go
+	enum class Output {
+		Uinput, ///< Virtual devices, the normal operation
+		Null, ///< Nowhere, to measure the rest of the server
+		EventLog, ///< A file with the frames of all the senders
+		Ring, ///< Another thread, through a lock-free ring
+	};
+	Output output = Output::Uinput;
+	/// The file of Output::EventLog
+	const char *eventLog = nullptr;
+
+	/**
+	 * The area of the desktop where the windows of the senders are mapped, in
+	 * pixels, like the geometries of xrandr (mapWidth 0 for the whole
+	 * desktop).
+	 *
+	 * The devices cover the whole desktop, so the area needs its size, too.
+	 */
+	uint32_t mapX = 0;
+	uint32_t mapY = 0;
+	uint32_t mapWidth = 0;
+	uint32_t mapHeight = 0;
+	uint32_t desktopWidth = 0;
+	uint32_t desktopHeight = 0;
+
+	/// The smoothing of the strokes, disabled for the axes without a cutoff
+	StrokeFilter::Settings smoothing;
+
+	/// The pressure curve of the senders without a curve in curveFile
+	PressureCurve pressureCurve;
+	/// The curves of the senders, reloaded with SIGHUP (nullptr for none)
+	const char *curveFile = nullptr;
+
+	/**
+	 * Parse the command line.
+	 *
+	 * It prints the usage and exits for --help.
+	 *
+	 * \return false if the options are not valid
+	 */
+	bool parse(int argc, char **argv);
+};
@@ -0,0 +1,381 @@
+/**
+ * Output sinks of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the backends of the output of the evdev server that do
+ * not need libevdev: nothing, an event log file and an in-process ring.
+ */
+
+#include "output_sink.h"
+
+#include "clock.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+/// The buffer of the event log: records reach the disk at most once a second
+const size_t eventLogBuffer = 1 << 16;
+
+/// The longest wait of the drain thread, in case a wakeup is missed
+const std::chrono::milliseconds drainTimeout(10);
+
+void putLittleEndian(uint8_t *dst, uint64_t value, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i++) {
+		dst[i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+}
+
+/// Drops the frames, to measure the cost of the rest of the server
+class NullBackend : public OutputBackend {
+public:
+	std::unique_ptr<OutputSink> createSink() override;
+
+	void printStats() const override
+	{
+		printf("Output: %" PRIu64 " frames, %" PRIu64 " events discarded\n",
+			frames, events);
+	}
+
+	uint64_t frames = 0;
+	uint64_t events = 0;
+};
+
+class NullSink : public OutputSink {
+public:
+	explicit NullSink(NullBackend &backend) : mBackend(backend)
+	{
+	}
+
+	bool open(const std::string &, const Geometry &, int32_t, int32_t)
+		override
+	{
+		return true;
+	}
+
+	int write(const input_event *, unsigned int count) override
+	{
+		mBackend.frames++;
+		mBackend.events += count;
+		return 0;
+	}
+
+private:
+	NullBackend &mBackend;
+};
+
+std::unique_ptr<OutputSink> NullBackend::createSink()
+{
+	return std::make_unique<NullSink>(*this);
+}
+
+/// Writes the frames of all the senders to an event log file
+class EventLogBackend : public OutputBackend {
+public:
+	EventLogBackend() = default;
+	EventLogBackend(const EventLogBackend &) = delete;
+	EventLogBackend &operator=(const EventLogBackend &) = delete;
+	~EventLogBackend() override;
+
+	bool open(const char *path);
+
+	std::unique_ptr<OutputSink> createSink() override;
+
+	void flush() override;
+
+	void printStats() const override
+	{
+		printf("Output: %" PRIu64 " frames logged\n", mFrames);
+	}
+
+	void writeDevice(unsigned int device, const std::string &name,
+		const Geometry &geometry);
+
+	int writeFrame(unsigned int device, const input_event *events,
+		unsigned int count);
+
+private:
+	/// Write a record, or close the file on errors
+	int writeRecord(const uint8_t *data, size_t size);
+
+	FILE *mFile = nullptr;
+	unsigned int mSinks = 0;
+	uint64_t mFrames = 0;
+};
+
+class EventLogSink : public OutputSink {
+public:
+	EventLogSink(EventLogBackend &backend, unsigned int device)
+		: mBackend(backend), mDevice(device)
+	{
+	}
+
+	bool open(const std::string &name, const Geometry &geometry, int32_t,
+		int32_t) override
+	{
+		// The event log has no resolution, its readers know the units
+		mBackend.writeDevice(mDevice, name, geometry);
+		return true;
+	}
+
+	int write(const input_event *events, unsigned int count) override
+	{
+		return mBackend.writeFrame(mDevice, events, count);
+	}
+
+private:
+	EventLogBackend &mBackend;
+	unsigned int mDevice;
+};
+
+EventLogBackend::~EventLogBackend()
+{
+	if (mFile) {
+		fclose(mFile);
+	}
+}
+
+bool EventLogBackend::open(const char *path)
+{
+	mFile = fopen(path, "wb");
+	if (!mFile) {
+		perror("Could not open the event log");
+		return false;
+	}
+	setvbuf(mFile, nullptr, _IOFBF, eventLogBuffer);
+	return writeRecord(reinterpret_cast<const uint8_t *>(EVENT_LOG_MAGIC),
+		sizeof(EVENT_LOG_MAGIC)) == 0;
+}
+
+std::unique_ptr<OutputSink> EventLogBackend::createSink()
+{
+	return std::make_unique<EventLogSink>(*this, mSinks++);
+}
+
+void EventLogBackend::flush()
+{
+	if (mFile && fflush(mFile)) {
+		perror("Could not write the event log, stopping it");
+		fclose(mFile);
+		mFile = nullptr;
+	}
+}
+
+void EventLogBackend::writeDevice(unsigned int device, const std::string &name,
+	const Geometry &geometry)
+{
+	// The name is a sender address, it is always short
+	uint8_t record[12 + 2 + 64 + 12];
+	const size_t length = std::min<size_t>(name.size(), 64);
+	putLittleEndian(record, monotonicTime(), 8);
+	putLittleEndian(record + 8, device, 2);
+	putLittleEndian(record + 10, 0, 2);
+	putLittleEndian(record + 12, length, 2);
+	memcpy(record + 14, name.data(), length);
+	uint8_t *values = record + 14 + length;
+	putLittleEndian(values, geometry.maxX, 4);
+	putLittleEndian(values + 4, geometry.maxY, 4);
+	putLittleEndian(values + 8, static_cast<uint32_t>(geometry.maxPressure), 4);
+	writeRecord(record, 14 + length + 12);
+}
+
+int EventLogBackend::writeFrame(unsigned int device, const input_event *events,
+	unsigned int count)
+{
+	uint8_t record[12 + 8 * (EventFrame::maxEvents + 1)];
+	if (count > EventFrame::maxEvents + 1) {
+		return -EINVAL;
+	}
+	putLittleEndian(record, monotonicTime(), 8);
+	putLittleEndian(record + 8, device, 2);
+	putLittleEndian(record + 10, count, 2);
+	uint8_t *dst = record + 12;
+	for (unsigned int i = 0; i < count; i++, dst += 8) {
+		putLittleEndian(dst, events[i].type, 2);
+		putLittleEndian(dst + 2, events[i].code, 2);
+		putLittleEndian(dst + 4, static_cast<uint32_t>(events[i].value), 4);
+	}
+	const int err = writeRecord(record, static_cast<size_t>(dst - record));
+	if (!err) {
+		mFrames++;
+	}
+	return err;
+}
+
+int EventLogBackend::writeRecord(const uint8_t *data, size_t size)
+{
+	if (!mFile) {
+		return -EBADF;
+	}
+	if (fwrite(data, size, 1, mFile) != 1) {
+		const int err = errno;
+		perror("Could not write the event log, stopping it");
+		fclose(mFile);
+		mFile = nullptr;
+		return -err;
+	}
+	return 0;
+}
+
+class RingSink : public OutputSink {
+public:
+	RingSink(RingBackend &backend, unsigned int device)
+		: mBackend(backend), mDevice(device)
+	{
+	}
+
+	bool open(const std::string &, const Geometry &, int32_t, int32_t)
+		override
+	{
+		return true;
+	}
+
+	int write(const input_event *events, unsigned int count) override
+	{
+		// A full ring is like a slow device: the frame is lost, but the next
+		// ones are complete anyway
+		return mBackend.push(mDevice, events, count) ? 0 : -EAGAIN;
+	}
+
+private:
+	RingBackend &mBackend;
+	unsigned int mDevice;
+};
+
+} // namespace
+
+std::unique_ptr<OutputBackend> OutputBackend::create(const Options &options)
+{
+	switch (options.output) {
+	case Options::Output::Null:
+		return std::make_unique<NullBackend>();
+	case Options::Output::EventLog: {
+		auto backend = std::make_unique<EventLogBackend>();
+		if (!backend->open(options.eventLog)) {
+			return nullptr;
+		}
+		return backend;
+	}
+	case Options::Output::Ring:
+		return std::make_unique<RingBackend>(true);
+	case Options::Output::Uinput:
+		break;
+	}
+	fputs("The uinput backend is created by createUinput\n", stderr);
+	return nullptr;
+}
+
+RingBackend::RingBackend(bool drain)
+{
+	static_assert(!(capacity & (capacity - 1)),
+		"The capacity must be a power of two");
+	if (drain) {
+		mDrainThread = std::thread(&RingBackend::drain, this);
+	}
+}
+
+RingBackend::~RingBackend()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mStop = true;
+		mWake.notify_one();
+	}
+	if (mDrainThread.joinable()) {
+		mDrainThread.join();
+	}
+}
+
+std::unique_ptr<OutputSink> RingBackend::createSink()
+{
+	return std::make_unique<RingSink>(*this, mSinks++);
+}
+
+void RingBackend::printStats() const
+{
+	printf("Output: %" PRIu64 " frames through the ring, %" PRIu64
+		" dropped\n", consumed(), mDropped);
+}
+
+bool RingBackend::push(unsigned int device, const input_event *events,
+	unsigned int count)
+{
+	const size_t tail = mTail.load(std::memory_order_relaxed);
+	if (tail - mHead.load(std::memory_order_acquire) == capacity
+			|| count > EventFrame::maxEvents + 1) {
+		mDropped++;
+		return false;
+	}
+
+	OutputFrame &frame = mFrames[tail & (capacity - 1)];
+	frame.time = monotonicTime();
+	frame.device = device;
+	frame.count = count;
+	memcpy(frame.events, events, count * sizeof(input_event));
+	mTail.store(tail + 1, std::memory_order_release);
+
+	// Pairs with the fence in drain: either we see that the thread is going
+	// to sleep, or it sees our frame
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mSleeping.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mWake.notify_one();
+	}
+	return true;
+}
+
+bool RingBackend::pop(OutputFrame &frame)
+{
+	const size_t head = mHead.load(std::memory_order_relaxed);
+	if (head == mTail.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	const OutputFrame &src = mFrames[head & (capacity - 1)];
+	frame.time = src.time;
+	frame.device = src.device;
+	frame.count = src.count;
+	memcpy(frame.events, src.events, src.count * sizeof(input_event));
+	mHead.store(head + 1, std::memory_order_release);
+	mConsumed.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void RingBackend::drain()
+{
+	OutputFrame frame;
+	while (!mStop) {
+		if (pop(frame)) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mSleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (mHead.load(std::memory_order_relaxed)
+				== mTail.load(std::memory_order_acquire) && !mStop) {
+			mWake.wait_for(lock, drainTimeout);
+		}
+		mSleeping.store(false, std::memory_order_relaxed);
+	}
+	while (pop(frame)) {
+	}
+}
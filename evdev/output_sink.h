@@ -0,0 +1,178 @@
+/**
+ * Output sinks of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include "event_frame.h"
+#include "options.h"
+
+#include <packet_codec.h>
+
+#include <linux/input.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * \name Event log files
+ *
+ * An event log starts with the 8-byte header "NSEVT", the version (1) and two
+ * zero bytes, and continues with records, all in little endian:
+ * - the monotonic time of the record, in µs (8 bytes);
+ * - the index of the device, in order of creation (2 bytes);
+ * - the number of events (2 bytes), and then the events: type (2 bytes), code
+ *   (2 bytes) and value (4 bytes, signed), SYN_REPORT included.
+ *
+ * A record without events describes a device, when it is created: the length
+ * of the name (2 bytes), the name, maxX, maxY and maxPressure (4 bytes each).
+ * The devices never change their ranges: the senders are mapped to them.
+ */
+///@{
+
+/// The header of event log files
+static const char EVENT_LOG_MAGIC[8] = {'N', 'S', 'E', 'V', 'T', 1, 0, 0};
+
+///@}
+
+/// The virtual device of a sender, where its frames are written
+class OutputSink {
+public:
+	virtual ~OutputSink() = default;
+
+	/**
+	 * Create the device.
+	 *
+	 * \param name The name of the sender, for the device and the messages
+	 * \param geometry The ranges of the axes, they never change
+	 * \param resolutionX The units of ABS_X per mm of the sender
+	 * \param resolutionY The units of ABS_Y per mm of the sender
+	 */
+	virtual bool open(const std::string &name, const Geometry &geometry,
+		int32_t resolutionX, int32_t resolutionY) = 0;
+
+	/**
+	 * Write a frame.
+	 *
+	 * \param events The events of the frame, SYN_REPORT included
+	 * \return 0 on success, a negative errno otherwise
+	 */
+	virtual int write(const input_event *events, unsigned int count) = 0;
+};
+
+/// Where the frames of all the senders go, it creates the sinks of the sessions
+class OutputBackend {
+public:
+	virtual ~OutputBackend() = default;
+
+	/**
+	 * Create the backend chosen in the options, but uinput.
+	 *
+	 * \return nullptr on failure, or when uinput is chosen
+	 */
+	static std::unique_ptr<OutputBackend> create(const Options &options);
+
+	/**
+	 * Create the backend of the uinput devices.
+	 *
+	 * It is in uinput_sink.cpp, so that only the server needs libevdev.
+	 */
+	static std::unique_ptr<OutputBackend> createUinput();
+
+	virtual std::unique_ptr<OutputSink> createSink() = 0;
+
+	/// Write the buffered data, it is called every second
+	virtual void flush()
+	{
+	}
+
+	virtual void printStats() const
+	{
+	}
+};
+
+/// A frame passed through the ring of RingBackend
+struct OutputFrame {
+	uint64_t time; ///< The monotonic time of the write, in µs
+	unsigned int device; ///< The index of the sink, in order of creation
+	unsigned int count; ///< The number of events, SYN_REPORT included
+	input_event events[EventFrame::maxEvents + 1];
+};
+
+/**
+ * Passes the frames to another thread of the process through a lock-free ring,
+ * e.g., to check what the pipeline produces without any device.
+ *
+ * The frames have one producer (the thread of the event loop) and one
+ * consumer. When the ring is full, the new frames are dropped.
+ * The drain thread sleeps while the ring is empty, and the producer wakes it.
+ */
+class RingBackend : public OutputBackend {
+public:
+	/// The number of frames of the ring, a power of two
+	static const size_t capacity = 1024;
+
+	/**
+	 * \param drain Whether to start a thread that consumes the frames and only
+	 *  counts them, instead of leaving them to pop()
+	 */
+	explicit RingBackend(bool drain);
+	RingBackend(const RingBackend &) = delete;
+	RingBackend &operator=(const RingBackend &) = delete;
+	~RingBackend() override;
+
+	std::unique_ptr<OutputSink> createSink() override;
+
+	void printStats() const override;
+
+	/// Add a frame, from the producer; return false if the ring is full
+	bool push(unsigned int device, const input_event *events,
+		unsigned int count);
+
+	/// Take the oldest frame, from the consumer; return false if it is empty
+	bool pop(OutputFrame &frame);
+
+	/// The frames taken by the consumer
+	uint64_t consumed() const
+	{
+		return mConsumed.load(std::memory_order_relaxed);
+	}
+
+private:
+	void drain();
+
+	OutputFrame mFrames[capacity];
+	/// The next frame to pop, written only by the consumer
+	alignas(64) std::atomic<size_t> mHead{0};
+	/// The next frame to push, written only by the producer
+	alignas(64) std::atomic<size_t> mTail{0};
+
+	// Producer side
+	unsigned int mSinks = 0;
+	uint64_t mDropped = 0;
+
+	// Consumer side, read by printStats
+	std::atomic<uint64_t> mConsumed{0};
+	std::atomic<bool> mStop{false};
+	std::thread mDrainThread;
+	/// The drain thread waits on mWake while the ring is empty
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	std::atomic<bool> mSleeping{false};
+};
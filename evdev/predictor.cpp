@@ -0,0 +1,163 @@
+/**
+ * Stroke prediction for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the alpha-beta predictor of the stylus position.
+ */
+
+#include "predictor.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+/// The weights of the residuals for the values and the velocities
+const double alpha = 0.5;
+const double beta = 0.2;
+
+/// The real samples after a reset before we start predicting
+const unsigned int warmupSamples = 3;
+
+/// A longer pause between two samples makes the velocities meaningless, in µs
+const uint64_t maxGap = 50000;
+
+double clamp(double value, double low, double high)
+{
+	return value < low ? low : (value > high ? high : value);
+}
+
+} // namespace
+
+Predictor::Predictor(uint64_t horizon) : mHorizon(horizon)
+{
+}
+
+void Predictor::Axis::reset(double measured)
+{
+	value = measured;
+	velocity = 0;
+}
+
+void Predictor::Axis::update(double measured, double dt)
+{
+	const double predicted = value + velocity * dt;
+	const double residual = measured - predicted;
+	value = predicted + alpha * residual;
+	velocity += beta * residual / dt;
+}
+
+Sample Predictor::predict(const Sample &real, uint64_t time,
+	const Geometry &geometry)
+{
+	if (!mStarted || time <= mLastTime || time - mLastTime > maxGap
+			|| ((real.status ^ mLast.status) & PACKET_TRANSITIONS)) {
+		reset(real, time);
+		return real;
+	}
+
+	measureErrors(real, time);
+
+	const double dt = static_cast<double>(time - mLastTime);
+	mX.update(real.x, dt);
+	mY.update(real.y, dt);
+	mPressure.update(real.pressure, dt);
+	mLast = real;
+	mLastTime = time;
+	if (++mSamples < warmupSamples) {
+		return real;
+	}
+
+	const double horizon = static_cast<double>(mHorizon);
+	Sample predicted = real;
+	const double x = clamp(real.x + mX.velocity * horizon, 0, geometry.maxX);
+	const double y = clamp(real.y + mY.velocity * horizon, 0, geometry.maxY);
+	predicted.x = static_cast<uint32_t>(x + 0.5);
+	predicted.y = static_cast<uint32_t>(y + 0.5);
+	if ((real.status & PacketHasPressure) && real.pressure) {
+		// Going to 0 would look like the stylus was lifted
+		const double pressure = real.pressure
+			+ mPressure.velocity * horizon;
+		predicted.pressure = static_cast<uint32_t>(clamp(pressure, 1,
+			geometry.maxPressure) + 0.5);
+	}
+
+	if (mPendingCount == maxPending) {
+		mPendingFirst = (mPendingFirst + 1) % maxPending;
+		mPendingCount--;
+	}
+	Pending &pending = mPending[(mPendingFirst + mPendingCount) % maxPending];
+	pending = {time + mHorizon, x, y, static_cast<double>(real.x),
+		static_cast<double>(real.y)};
+	mPendingCount++;
+
+	return predicted;
+}
+
+void Predictor::reset(const Sample &real, uint64_t time)
+{
+	if (mStarted) {
+		mResets++;
+	}
+	mStarted = true;
+	mLast = real;
+	mLastTime = time;
+	mSamples = 0;
+	mX.reset(real.x);
+	mY.reset(real.y);
+	mPressure.reset(real.pressure);
+	// They would be compared with a different stroke
+	mPendingCount = 0;
+}
+
+void Predictor::measureErrors(const Sample &real, uint64_t time)
+{
+	while (mPendingCount) {
+		const Pending &pending = mPending[mPendingFirst];
+		if (pending.time > time) {
+			break;
+		}
+
+		// The real position at the predicted time, between the last two samples
+		double t = 1;
+		if (pending.time > mLastTime) {
+			t = static_cast<double>(pending.time - mLastTime)
+				/ static_cast<double>(time - mLastTime);
+		}
+		const double x = mLast.x + t * (static_cast<double>(real.x) - mLast.x);
+		const double y = mLast.y + t * (static_cast<double>(real.y) - mLast.y);
+		mError.record(static_cast<uint64_t>(
+			std::hypot(pending.x - x, pending.y - y) + 0.5));
+		mBaseline.record(static_cast<uint64_t>(
+			std::hypot(pending.lastX - x, pending.lastY - y) + 0.5));
+
+		mPendingFirst = (mPendingFirst + 1) % maxPending;
+		mPendingCount--;
+	}
+}
+
+void Predictor::print(const char *name) const
+{
+	std::string label = name;
+	label += ": prediction error";
+	mError.print(label.c_str(), "device units");
+	label = name;
+	label += ": error without prediction";
+	mBaseline.print(label.c_str(), "device units");
+	printf("%s: prediction %" PRIu64 "ms ahead, %" PRIu64 " resets\n", name,
+		mHorizon / 1000, mResets);
+}
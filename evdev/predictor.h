@@ -0,0 +1,96 @@
+/**
+ * Stroke prediction for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include "stats.h"
+
+#include <packet_codec.h>
+
+#include <cstdint>
+
+/**
+ * Extrapolates the stylus a fixed time ahead, to hide the network latency.
+ *
+ * The velocities of x, y and pressure are estimated with an alpha-beta filter
+ * (the steady state of a Kalman filter with a constant-velocity model).
+ * Every prediction starts from the last real sample, so the real samples
+ * correct the trajectory as soon as they arrive.
+ *
+ * Touch, eraser and button transitions reset the model, and the samples are
+ * passed through until it has seen a few samples of the new state.
+ *
+ * To measure the quality of the predictions, they are compared with the real
+ * trajectory, once the samples of the predicted time arrive.
+ */
+class Predictor {
+public:
+	/// \param horizon How far ahead to predict, in µs
+	explicit Predictor(uint64_t horizon);
+
+	/**
+	 * Update the model with a real sample.
+	 *
+	 * \param time The time of the sample, in µs
+	 * \return The sample to inject
+	 */
+	Sample predict(const Sample &real, uint64_t time, const Geometry &geometry);
+
+	/// Print the errors on stdout
+	void print(const char *name) const;
+
+private:
+	/// The state of the filter of a value
+	struct Axis {
+		double value = 0;
+		double velocity = 0; ///< In units per µs
+
+		void reset(double measured);
+		void update(double measured, double dt);
+	};
+
+	/// A prediction, waiting for the real samples of its time
+	struct Pending {
+		uint64_t time;
+		double x, y; ///< The prediction
+		double lastX, lastY; ///< The real sample it started from
+	};
+
+	static const unsigned int maxPending = 64;
+
+	void reset(const Sample &real, uint64_t time);
+	void measureErrors(const Sample &real, uint64_t time);
+
+	uint64_t mHorizon;
+
+	bool mStarted = false;
+	Sample mLast;
+	uint64_t mLastTime = 0;
+	/// The real samples since the last reset
+	unsigned int mSamples = 0;
+
+	Axis mX;
+	Axis mY;
+	Axis mPressure;
+
+	Pending mPending[maxPending];
+	unsigned int mPendingFirst = 0;
+	unsigned int mPendingCount = 0;
+
+	/// The distance between predictions and real trajectory, in device units
+	LatencyHistogram mError;
+	/// The distance we would have without prediction, in device units
+	LatencyHistogram mBaseline;
+	uint64_t mResets = 0;
+};
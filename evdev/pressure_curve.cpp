@@ -0,0 +1,438 @@
+/**
+ * Pressure curves of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the parser of the pressure curves, and their compilation
+ * to tables.
+ */
+
+#include "pressure_curve.h"
+
+#include "coordinate_map.h"
+
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+/// The largest exponent of gamma, and the inverse of the smallest one
+const double maxGamma = 10;
+
+/// The most points of a table
+const size_t maxPoints = 64;
+
+/// The largest table, the senders with a larger maximum share the entries
+const uint32_t maxEntries = 65536;
+
+/// The Newton iterations to find the parameter of a Bézier
+const int newtonIterations = 8;
+/// The bisection iterations when Newton does not converge, enough for 16 bits
+const int bisectionIterations = 32;
+/// The error on X of the parameter of a Bézier, well below 16 bits
+const double bezierEpsilon = 1e-7;
+
+/// The longest line of a file of curves
+const size_t maxLine = 1024;
+
+/// The generation of the next CurveSet, the loader thread creates them, too
+std::atomic<uint64_t> nextGeneration{1};
+
+/// Parse a number and the separator after it, advance text past them
+bool parseValue(const char *&text, char separator, double &value)
+{
+	char *end;
+	value = strtod(text, &end);
+	if (end == text || *end != separator || !std::isfinite(value)) {
+		return false;
+	}
+	text = *end ? end + 1 : end;
+	return true;
+}
+
+/// Parse numbers separated by commas until the end of the text
+bool parseList(const char *text, std::vector<double> &values)
+{
+	values.clear();
+	while (*text) {
+		double value;
+		const char *comma = strchr(text, ',');
+		if (!parseValue(text, comma ? ',' : '\0', value)) {
+			return false;
+		}
+		values.push_back(value);
+		if (comma && !*text) {
+			// A comma at the end
+			return false;
+		}
+	}
+	return true;
+}
+
+bool inUnit(double value)
+{
+	return value >= 0 && value <= 1;
+}
+
+double cubic(double a, double b, double t)
+{
+	// The ends are 0 and 1
+	const double u = 1 - t;
+	return 3 * u * u * t * a + 3 * u * t * t * b + t * t * t;
+}
+
+double cubicSlope(double a, double b, double t)
+{
+	const double u = 1 - t;
+	return 3 * u * u * a + 6 * u * t * (b - a) + 3 * t * t * (1 - b);
+}
+
+} // namespace
+
+bool PressureCurve::parse(const char *text, PressureCurve &curve)
+{
+	PressureCurve parsed;
+	if (!strcmp(text, "linear")) {
+		curve = parsed;
+		return true;
+	}
+
+	const char *colon = strchr(text, ':');
+	if (!colon) {
+		return false;
+	}
+	const std::string name(text, colon);
+	const char *args = colon + 1;
+	std::vector<double> &params = parsed.mParams;
+	if (name == "gamma") {
+		parsed.mType = Type::Gamma;
+		if (!parseList(args, params) || params.size() != 1
+				|| !(params[0] >= 1 / maxGamma && params[0] <= maxGamma)) {
+			return false;
+		}
+	} else if (name == "bezier") {
+		parsed.mType = Type::Bezier;
+		// The Xs must stay in [0, 1] for the curve to be a function; the Ys
+		// can overshoot, the result is clamped anyway
+		if (!parseList(args, params) || params.size() != 4
+				|| !inUnit(params[0]) || !inUnit(params[2])) {
+			return false;
+		}
+	} else if (name == "table") {
+		parsed.mType = Type::Table;
+		// Points as X:Y, separated by commas
+		while (*args) {
+			double x, y;
+			if (!parseValue(args, ':', x)) {
+				return false;
+			}
+			const char *comma = strchr(args, ',');
+			if (!parseValue(args, comma ? ',' : '\0', y)
+					|| (comma && !*args)) {
+				return false;
+			}
+			if (!inUnit(x) || !inUnit(y) || params.size() >= maxPoints * 2
+					|| (!params.empty() && x <= params[params.size() - 2])) {
+				return false;
+			}
+			params.push_back(x);
+			params.push_back(y);
+		}
+		if (params.empty()) {
+			return false;
+		}
+	} else {
+		return false;
+	}
+
+	curve = parsed;
+	return true;
+}
+
+double PressureCurve::eval(double x) const
+{
+	x = x < 0 ? 0 : (x > 1 ? 1 : x);
+	double y;
+	switch (mType) {
+	case Type::Gamma:
+		y = std::pow(x, mParams[0]);
+		break;
+	case Type::Bezier:
+		y = bezier(x);
+		break;
+	case Type::Table:
+		y = table(x);
+		break;
+	default:
+		y = x;
+	}
+	return y < 0 ? 0 : (y > 1 ? 1 : y);
+}
+
+double PressureCurve::bezier(double x) const
+{
+	const double x1 = mParams[0];
+	const double x2 = mParams[2];
+	double t = x;
+	for (int i = 0; i < newtonIterations; i++) {
+		const double error = cubic(x1, x2, t) - x;
+		if (std::fabs(error) < bezierEpsilon) {
+			return cubic(mParams[1], mParams[3], t);
+		}
+		const double slope = cubicSlope(x1, x2, t);
+		if (std::fabs(slope) < bezierEpsilon) {
+			break;
+		}
+		t -= error / slope;
+	}
+
+	// X grows with t, so a bisection always converges
+	double low = 0, high = 1;
+	for (int i = 0; i < bisectionIterations; i++) {
+		t = (low + high) / 2;
+		if (cubic(x1, x2, t) < x) {
+			low = t;
+		} else {
+			high = t;
+		}
+	}
+	return cubic(mParams[1], mParams[3], (low + high) / 2);
+}
+
+double PressureCurve::table(double x) const
+{
+	const size_t count = mParams.size() / 2;
+	if (x <= mParams[0]) {
+		return mParams[1];
+	}
+	for (size_t i = 1; i < count; i++) {
+		const double x1 = mParams[i * 2];
+		if (x <= x1) {
+			const double x0 = mParams[i * 2 - 2];
+			const double y0 = mParams[i * 2 - 1];
+			const double y1 = mParams[i * 2 + 1];
+			return y0 + (y1 - y0) * (x - x0) / (x1 - x0);
+		}
+	}
+	return mParams[count * 2 - 1];
+}
+
+std::shared_ptr<const PressureTable> PressureCurve::compile(uint32_t max)
+	const
+{
+	if (linear() || !max) {
+		return nullptr;
+	}
+
+	auto compiled = std::make_shared<PressureTable>();
+	compiled->max = max;
+	while ((max >> compiled->shift) >= maxEntries) {
+		compiled->shift++;
+	}
+	const uint32_t entries = (max >> compiled->shift) + 1;
+	compiled->values.resize(entries);
+	for (uint32_t i = 0; i < entries; i++) {
+		const double x = static_cast<double>(uint64_t(i) << compiled->shift)
+			/ max;
+		compiled->values[i] = static_cast<uint16_t>(std::lround(eval(x)
+			* CoordinateMap::devicePressure));
+	}
+	return compiled;
+}
+
+TableCompiler::~TableCompiler()
+{
+	if (mThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStopping = true;
+		}
+		mWake.notify_one();
+		mThread.join();
+	}
+	if (mEvent >= 0) {
+		close(mEvent);
+	}
+}
+
+bool TableCompiler::init()
+{
+	mEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEvent < 0) {
+		perror("Could not create the eventfd of the pressure tables");
+		return false;
+	}
+	return true;
+}
+
+void TableCompiler::submit(Job job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQueue.push_back(std::move(job));
+	}
+	if (!mThread.joinable()) {
+		mThread = std::thread([this]() { run(); });
+	} else {
+		mWake.notify_one();
+	}
+}
+
+std::vector<TableCompiler::Job> TableCompiler::finished()
+{
+	uint64_t count;
+	if (read(mEvent, &count, sizeof(count)) != sizeof(count)) {
+		return {};
+	}
+	std::vector<Job> done;
+	std::lock_guard<std::mutex> lock(mMutex);
+	done.swap(mDone);
+	return done;
+}
+
+void TableCompiler::run()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true) {
+		mWake.wait(lock, [this]() { return mStopping || !mQueue.empty(); });
+		if (mStopping) {
+			return;
+		}
+		Job job = std::move(mQueue.front());
+		mQueue.pop_front();
+
+		lock.unlock();
+		job.table = job.curve.compile(job.max);
+		lock.lock();
+
+		mDone.push_back(std::move(job));
+		const uint64_t done = 1;
+		if (write(mEvent, &done, sizeof(done)) != sizeof(done)) {
+			perror("Could not signal the pressure tables");
+		}
+	}
+}
+
+CurveSet::CurveSet() : mGeneration(nextGeneration++)
+{
+}
+
+void CurveSet::setDefault(const PressureCurve &curve)
+{
+	mCurves[0].curve = curve;
+	mCurves[0].tables.clear();
+	mCurves[0].pending.clear();
+	// The tables of the previous default are not valid anymore
+	mGeneration = nextGeneration++;
+}
+
+bool CurveSet::load(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	char line[maxLine];
+	unsigned int number = 0;
+	bool valid = true;
+	while (valid && fgets(line, sizeof(line), fp)) {
+		number++;
+		char address[32], curveText[maxLine];
+		const int fields = sscanf(line, "%31s %1023s", address, curveText);
+		if (fields <= 0 || address[0] == '#') {
+			continue;
+		}
+
+		PressureCurve curve;
+		in_addr parsed;
+		if (fields != 2 || !PressureCurve::parse(curveText, curve)) {
+			fprintf(stderr, "%s:%u: invalid curve\n", path, number);
+			valid = false;
+		} else if (!strcmp(address, "*")) {
+			setDefault(curve);
+		} else if (inet_pton(AF_INET, address, &parsed) == 1) {
+			mAddresses[parsed.s_addr] = mCurves.size();
+			mCurves.push_back({curve, {}, {}});
+		} else {
+			fprintf(stderr, "%s:%u: invalid address %s\n", path, number,
+				address);
+			valid = false;
+		}
+	}
+
+	if (ferror(fp)) {
+		fprintf(stderr, "Could not read %s\n", path);
+		valid = false;
+	}
+	fclose(fp);
+	return valid;
+}
+
+bool CurveSet::table(uint32_t address, int32_t maxPressure,
+	std::shared_ptr<const PressureTable> &table)
+{
+	table.reset();
+	if (maxPressure <= 0) {
+		return true;
+	}
+	mRequests.emplace(address, maxPressure);
+
+	const auto it = mAddresses.find(address);
+	const size_t index = it != mAddresses.end() ? it->second : 0;
+	Entry &entry = mCurves[index];
+	const uint32_t max = static_cast<uint32_t>(maxPressure);
+	const auto cached = entry.tables.find(max);
+	if (cached != entry.tables.end()) {
+		table = cached->second;
+		return true;
+	}
+	if (!mCompiler || entry.curve.linear()) {
+		table = entry.tables[max] = entry.curve.compile(max);
+		return true;
+	}
+	if (entry.pending.insert(max).second) {
+		mCompiler->submit({mGeneration, index, entry.curve, max, nullptr});
+	}
+	return false;
+}
+
+bool CurveSet::install(const TableCompiler::Job &job)
+{
+	if (job.generation != mGeneration) {
+		return false;
+	}
+	Entry &entry = mCurves[job.entry];
+	entry.pending.erase(job.max);
+	entry.tables[job.max] = job.table;
+	return true;
+}
+
+void CurveSet::precompile(const Requests &requests)
+{
+	std::shared_ptr<const PressureTable> compiled;
+	for (const auto &request : requests) {
+		table(request.first, request.second, compiled);
+	}
+}
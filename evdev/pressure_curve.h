@@ -0,0 +1,246 @@
+/**
+ * Pressure curves of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * A pressure curve compiled for a maximum pressure of the sender.
+ *
+ * It maps the pressure of the sender directly to the pressure of the device,
+ * with one load.
+ */
+struct PressureTable {
+	/// The maximum pressure of the sender, larger values are clamped
+	uint32_t max = 0;
+	/// Above 65535, consecutive values share an entry
+	unsigned int shift = 0;
+	/// The device pressure of each entry
+	std::vector<uint16_t> values;
+
+	uint32_t map(uint32_t value) const
+	{
+		// Like the coordinates, a negative value is below the minimum
+		const int32_t signedValue = static_cast<int32_t>(value);
+		uint32_t clamped = signedValue < 0 ? 0 : value;
+		clamped = clamped < max ? clamped : max;
+		return values[clamped >> shift];
+	}
+};
+
+/**
+ * The response of the stylus to the pressure, as a function from [0, 1] to
+ * [0, 1].
+ *
+ * The curves are written as:
+ * - linear: the identity, i.e., the plain scale of the coordinate map;
+ * - gamma:G: x^G, G < 1 is softer, G > 1 is harder;
+ * - bezier:X1,Y1,X2,Y2: a cubic Bézier from (0, 0) to (1, 1), like the CSS
+ *   cubic-bezier() and the curves of the tablet drivers, X1 and X2 in [0, 1];
+ * - table:X:Y,X:Y,...: a piecewise linear function through the points, with
+ *   increasing X; it is flat before the first point and after the last one.
+ */
+class PressureCurve {
+public:
+	/// Parse a curve, return false if it is not valid
+	static bool parse(const char *text, PressureCurve &curve);
+
+	bool linear() const
+	{
+		return mType == Type::Linear;
+	}
+
+	/// The value of the curve, clamped to [0, 1]
+	double eval(double x) const;
+
+	/**
+	 * Compute the table of the curve for a maximum pressure of the sender.
+	 *
+	 * \return The table, or nullptr if the curve is linear or max is 0
+	 */
+	std::shared_ptr<const PressureTable> compile(uint32_t max) const;
+
+private:
+	enum class Type {
+		Linear,
+		Gamma,
+		Bezier,
+		Table,
+	};
+
+	double bezier(double x) const;
+	double table(double x) const;
+
+	Type mType = Type::Linear;
+	/// The exponent for gamma, the control points for bezier, the X and Y of
+	/// the points for table
+	std::vector<double> mParams;
+};
+
+/**
+ * A thread that compiles the pressure tables, so that the event loop does not
+ * wait for them.
+ *
+ * The loop submits the jobs, and it takes them back with finished() when the
+ * eventfd returned by fd() is readable.
+ */
+class TableCompiler {
+public:
+	struct Job {
+		/// The generation of the CurveSet that asked for the table
+		uint64_t generation = 0;
+		/// The index of the curve in the CurveSet
+		size_t entry = 0;
+		PressureCurve curve;
+		uint32_t max = 0;
+		/// The result, set by the thread
+		std::shared_ptr<const PressureTable> table;
+	};
+
+	TableCompiler() = default;
+	TableCompiler(const TableCompiler &other) = delete;
+	TableCompiler &operator=(const TableCompiler &other) = delete;
+	~TableCompiler();
+
+	/// Create the eventfd, the thread starts with the first job
+	bool init();
+
+	int fd() const
+	{
+		return mEvent;
+	}
+
+	void submit(Job job);
+
+	/// Take the jobs that the thread has completed
+	std::vector<Job> finished();
+
+private:
+	void run();
+
+	int mEvent = -1;
+	std::thread mThread;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::deque<Job> mQueue;
+	std::vector<Job> mDone;
+	bool mStopping = false;
+};
+
+/**
+ * The curves of the senders, with the tables compiled for them.
+ *
+ * A sender uses the curve of its address, or the default one.
+ * The tables are shared by the senders with the same curve and maximum
+ * pressure, and they are compiled when the first of them asks for them, on
+ * the thread of the compiler if the set has one.
+ */
+class CurveSet {
+public:
+	CurveSet();
+
+	/// Compile the tables on the thread of a compiler, nullptr to compile them
+	/// when they are asked
+	void setCompiler(TableCompiler *compiler)
+	{
+		mCompiler = compiler;
+	}
+
+	/// Use the curve for the senders without a curve of their own
+	void setDefault(const PressureCurve &curve);
+
+	/**
+	 * Read the curves from a file.
+	 *
+	 * Each line is an IPv4 address, or * for the default, and a curve.
+	 * Empty lines and lines that start with # are ignored.
+	 *
+	 * \return false if the file cannot be read or it is not valid
+	 */
+	bool load(const char *path);
+
+	/**
+	 * The table for a sender.
+	 *
+	 * Without a compiler, it compiles the table when needed, so it is better
+	 * to call it only when the geometry of the sender changes.
+	 * With a compiler, it submits the table to it, and the table is ready
+	 * after install() receives it.
+	 *
+	 * \param address The IPv4 address, in network order
+	 * \param maxPressure The maximum pressure of the sender
+	 * \param table Receives the table, or nullptr to scale the pressure
+	 *  linearly
+	 * \return false if the table is not ready yet
+	 */
+	bool table(uint32_t address, int32_t maxPressure,
+		std::shared_ptr<const PressureTable> &table);
+
+	/**
+	 * Store a table compiled by the compiler.
+	 *
+	 * \return false if the table was asked by another set, or before the
+	 *  default curve changed
+	 */
+	bool install(const TableCompiler::Job &job);
+
+	/// Pairs of IPv4 address and maximum pressure of the senders
+	using Requests = std::set<std::pair<uint32_t, int32_t>>;
+
+	/// The senders that have asked for a table
+	const Requests &requests() const
+	{
+		return mRequests;
+	}
+
+	/// Compile the tables of the senders of another set, so that they do not
+	/// wait for them when this set replaces the other
+	void precompile(const Requests &requests);
+
+	/// The number of curves, including the default one
+	size_t size() const
+	{
+		return mCurves.size();
+	}
+
+private:
+	struct Entry {
+		PressureCurve curve;
+		/// Indexed by the maximum pressure of the senders
+		std::map<uint32_t, std::shared_ptr<const PressureTable>> tables;
+		/// The maximum pressures submitted to the compiler
+		std::set<uint32_t> pending;
+	};
+
+	/// The default is the first entry
+	std::vector<Entry> mCurves{1};
+	/// The index of the entry of each address, in network order
+	std::map<uint32_t, size_t> mAddresses;
+	Requests mRequests;
+
+	TableCompiler *mCompiler = nullptr;
+	/// Tells the jobs of this set from the ones of the sets it replaced
+	uint64_t mGeneration;
+};
@@ -0,0 +1,242 @@
+/**
+ * Session recordings of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the writer and the reader of the recording files.
+ */
+
+#include "recording.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cstring>
+
+namespace {
+
+/// The buffer of the recorder: records reach the disk at most once a second
+const size_t writeBuffer = 1 << 16;
+
+void putLittleEndian(uint8_t *dst, uint64_t value, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i++) {
+		dst[i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+}
+
+uint64_t getLittleEndian(const uint8_t *src, unsigned int size)
+{
+	uint64_t value = 0;
+	for (unsigned int i = 0; i < size; i++) {
+		value |= static_cast<uint64_t>(src[i]) << (8 * i);
+	}
+	return value;
+}
+
+/**
+ * Cut the record that a crash left incomplete at the end of a recording.
+ *
+ * Otherwise, the reader would take the records appended after it as its
+ * data, and it would lose all of them.
+ */
+bool dropPartialRecord(FILE *fp, const char *path)
+{
+	struct stat st;
+	if (fstat(fileno(fp), &st)) {
+		perror("Could not read the size of the recording");
+		return false;
+	}
+	const uint64_t size = static_cast<uint64_t>(st.st_size);
+
+	// Only the headers are read, the datagrams are skipped
+	uint64_t end = sizeof(RECORDING_MAGIC);
+	uint8_t header[RECORD_HEADER_SIZE];
+	while (size - end >= RECORD_HEADER_SIZE) {
+		if (fseeko(fp, static_cast<off_t>(end), SEEK_SET)
+				|| fread(header, sizeof(header), 1, fp) != 1) {
+			perror("Could not read the recording");
+			return false;
+		}
+		const uint64_t length = getLittleEndian(header + 14, 2);
+		if (size - end - RECORD_HEADER_SIZE < length) {
+			break;
+		}
+		end += RECORD_HEADER_SIZE + length;
+	}
+
+	if (end == size) {
+		return true;
+	}
+	fprintf(stderr, "%s ends with a truncated record, dropping its %" PRIu64
+		" bytes\n", path, size - end);
+	if (ftruncate(fileno(fp), static_cast<off_t>(end))) {
+		perror("Could not truncate the recording");
+		return false;
+	}
+	return true;
+}
+
+} // namespace
+
+Recorder::~Recorder()
+{
+	close();
+}
+
+bool Recorder::open(const char *path)
+{
+	close();
+
+	// "a+" never overwrites, and lets us check the header of existing files
+	mFile = fopen(path, "a+b");
+	if (!mFile) {
+		perror("Could not open the recording");
+		return false;
+	}
+	setvbuf(mFile, nullptr, _IOFBF, writeBuffer);
+
+	char magic[sizeof(RECORDING_MAGIC)];
+	const size_t read = fread(magic, 1, sizeof(magic), mFile);
+	if (ferror(mFile)) {
+		perror("Could not read the recording");
+		close();
+		return false;
+	}
+	if (read && (read != sizeof(magic)
+			|| memcmp(magic, RECORDING_MAGIC, sizeof(magic)))) {
+		fprintf(stderr, "%s is not a NetStylus recording\n", path);
+		close();
+		return false;
+	}
+	if (read && !dropPartialRecord(mFile, path)) {
+		close();
+		return false;
+	}
+	// A stream opened for update needs a seek between a read and a write,
+	// even if "a" writes at the end anyway
+	if (fseek(mFile, 0, SEEK_END)) {
+		perror("Could not seek the recording");
+		close();
+		return false;
+	}
+	if (!read && fwrite(RECORDING_MAGIC, 1, sizeof(RECORDING_MAGIC), mFile)
+			!= sizeof(RECORDING_MAGIC)) {
+		perror("Could not write the recording");
+		close();
+		return false;
+	}
+	return true;
+}
+
+void Recorder::append(uint64_t arrival, const sockaddr_in &peer,
+	const uint8_t *data, size_t length)
+{
+	if (!mFile) {
+		return;
+	}
+
+	uint8_t header[RECORD_HEADER_SIZE];
+	putLittleEndian(header, arrival, 8);
+	memcpy(header + 8, &peer.sin_addr.s_addr, 4);
+	memcpy(header + 12, &peer.sin_port, 2);
+	putLittleEndian(header + 14, length, 2);
+	if (fwrite(header, sizeof(header), 1, mFile) != 1
+			|| fwrite(data, length, 1, mFile) != 1) {
+		perror("Could not write the recording, stopping it");
+		close();
+		return;
+	}
+	mCount++;
+}
+
+void Recorder::flush()
+{
+	if (mFile && fflush(mFile)) {
+		perror("Could not write the recording, stopping it");
+		close();
+	}
+}
+
+void Recorder::close()
+{
+	if (mFile) {
+		fclose(mFile);
+		mFile = nullptr;
+	}
+}
+
+Recording::~Recording()
+{
+	if (mData) {
+		munmap(const_cast<uint8_t *>(mData), mSize);
+	}
+}
+
+bool Recording::open(const char *path)
+{
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("Could not open the recording");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		perror("Could not read the size of the recording");
+		::close(fd);
+		return false;
+	}
+	mSize = static_cast<size_t>(st.st_size);
+	if (mSize < sizeof(RECORDING_MAGIC)) {
+		fprintf(stderr, "%s is not a NetStylus recording\n", path);
+		::close(fd);
+		return false;
+	}
+
+	void *map = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		perror("Could not map the recording");
+		return false;
+	}
+	mData = static_cast<const uint8_t *>(map);
+	madvise(map, mSize, MADV_SEQUENTIAL);
+
+	if (memcmp(mData, RECORDING_MAGIC, sizeof(RECORDING_MAGIC))) {
+		fprintf(stderr, "%s is not a NetStylus recording\n", path);
+		return false;
+	}
+	mPos = sizeof(RECORDING_MAGIC);
+	return true;
+}
+
+bool Recording::peek(Record &record) const
+{
+	if (mSize - mPos < RECORD_HEADER_SIZE) {
+		return false;
+	}
+	const uint8_t *header = mData + mPos;
+	record.arrival = getLittleEndian(header, 8);
+	record.peer = {};
+	record.peer.sin_family = AF_INET;
+	memcpy(&record.peer.sin_addr.s_addr, header + 8, 4);
+	memcpy(&record.peer.sin_port, header + 12, 2);
+	record.length = getLittleEndian(header + 14, 2);
+	record.data = header + RECORD_HEADER_SIZE;
+	// A truncated record, e.g., the server crashed while writing it
+	return mSize - mPos - RECORD_HEADER_SIZE >= record.length;
+}
@@ -0,0 +1,129 @@
+/**
+ * Session recordings of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * \name Recording files
+ *
+ * A recording starts with the 8-byte header "NSREC", the version (1) and two
+ * zero bytes, and continues with a record for each received datagram:
+ * - the monotonic time of arrival on the recording server, in µs (8 bytes,
+ *   little endian);
+ * - the IPv4 address and the port of the sender (4 + 2 bytes, network order,
+ *   as in sockaddr_in);
+ * - the length of the datagram (2 bytes, little endian);
+ * - the datagram.
+ *
+ * Files are only appended to, so a recording can continue in a later run of
+ * the server; a truncated record at the end is ignored, and it is removed
+ * before appending.
+ */
+///@{
+
+/// The header of recording files
+static const char RECORDING_MAGIC[8] = {'N', 'S', 'R', 'E', 'C', 1, 0, 0};
+
+/// The size of the header of a record
+static const size_t RECORD_HEADER_SIZE = 16;
+
+///@}
+
+/// Appends the received datagrams to a recording file
+class Recorder {
+public:
+	Recorder() = default;
+	Recorder(const Recorder &) = delete;
+	Recorder &operator=(const Recorder &) = delete;
+	~Recorder();
+
+	/**
+	 * Open a file, and write the header if it is empty.
+	 *
+	 * A file that is not empty must start with the header, even if it is
+	 * shorter than it: then it is not a recording, or it is truncated, and
+	 * appending to it would make it unreadable.
+	 * A truncated record at the end of the file is removed, so that the new
+	 * records are not read as its data.
+	 *
+	 * \return false if the file cannot be opened or it is not a recording
+	 */
+	bool open(const char *path);
+
+	bool isOpen() const
+	{
+		return mFile != nullptr;
+	}
+
+	/**
+	 * Add a datagram.
+	 *
+	 * The records are buffered, flush() writes them to the file.
+	 */
+	void append(uint64_t arrival, const sockaddr_in &peer, const uint8_t *data,
+		size_t length);
+
+	void flush();
+
+	/// The number of recorded datagrams
+	uint64_t count() const
+	{
+		return mCount;
+	}
+
+private:
+	void close();
+
+	FILE *mFile = nullptr;
+	uint64_t mCount = 0;
+};
+
+/// Reads a recording file, mapped in memory
+class Recording {
+public:
+	/// A datagram of the recording, its data points to the mapping
+	struct Record {
+		uint64_t arrival;
+		sockaddr_in peer;
+		const uint8_t *data;
+		size_t length;
+	};
+
+	Recording() = default;
+	Recording(const Recording &) = delete;
+	Recording &operator=(const Recording &) = delete;
+	~Recording();
+
+	bool open(const char *path);
+
+	/// Read the next record, return false at the end of the file
+	bool peek(Record &record) const;
+
+	/// Go past the record returned by peek
+	void advance(const Record &record)
+	{
+		mPos += RECORD_HEADER_SIZE + record.length;
+	}
+
+private:
+	const uint8_t *mData = nullptr;
+	size_t mSize = 0;
+	size_t mPos = 0;
+};
@@ -16,83 +16,211 @@
  * \file
  * This file contains a server to command a Linux computer using NetStylus.
  *
- * To compile: g++ -I../common/ -I/usr/include/libevdev-1.0/ server_evdev.cpp -levdev -o server
+ * To compile:
+ *   g++ -I../common/ -I/usr/include/libevdev-1.0/ *.cpp \
+ *     ../common/packet_codec.cpp -levdev -pthread -o server
  */
 
-#include <netstylus_packet.h>
-
-#include <libevdev/libevdev.h>
-#include <libevdev/libevdev-uinput.h>
+#include "batch_receiver.h"
+#include "clock.h"
+#include "event_loop.h"
+#include "options.h"
+#include "output_sink.h"
+#include "pressure_curve.h"
+#include "recording.h"
+#include "session.h"
+#include "stats.h"
 
-#include <linux/input.h> // input_absinfo
+#include <netstylus_packet.h>
 
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <cassert>
+#include <cinttypes>
 #include <cerrno>
-#include <cmath> // M_PI
 #include <cstdio>
-#include <cstring> // strncmp
+#include <cstring> // strerror
+#include <memory>
+#include <thread>
+#include <unordered_map>
 
 class Server {
 public:
+	explicit Server(const Options &options);
 	~Server();
 	int run();
 
 private:
 	bool setupSocket();
-	void readFirst();
-	bool setupDevice();
-	void readEvents();
+	bool setupLoop();
+	bool setupReplay();
+	void readEvents(uint32_t events);
+	void markActive();
+	void housekeeping();
+	void watchdog();
+
+	bool receiveBatch();
+	void processBatch();
+
+	/// Inject the datagrams of the recording that are due
+	void replay();
+
+	/**
+	 * Decode and inject a datagram.
+	 *
+	 * \return true if at least a frame was written to the device, and not
+	 *  only buffered by the jitter buffer or the upsampler
+	 */
+	bool processDatagram(const uint8_t *data, size_t length,
+		const sockaddr_in &peer, uint64_t arrival);
+
+	/// Send a report, that is also an acknowledgment, to a version 2 sender
+	void sendReport(const sockaddr_in &peer, Session &session);
+
+	void printStats() const;
+
+	/// Read the curve file again on another thread
+	void reloadCurves();
+	/// Use the curves read by reloadCurves, from the loop
+	void curvesLoaded();
+	/// Use the tables compiled by mCompiler, from the loop
+	void tablesCompiled();
+
+	Session *findSession(const sockaddr_in &peer);
+	void evictSessions(uint64_t now);
+
+	Options mOptions;
+
+	EventLoop mLoop;
+	int mExitCode = 0;
+
+	/// The timer for periodic tasks, armed only while packets are arriving
+	int mHousekeeping = -1;
+	bool mHousekeepingArmed = false;
+	/// Whether we received anything since the last housekeeping
+	bool mActive = false;
+
+	/// The timer that releases the styluses of silent senders, armed only while
+	/// some stylus is touching
+	int mWatchdog = -1;
+	bool mWatchdogArmed = false;
+
+	BatchReceiver mReceiver;
+
+	/// From the arrival in the kernel to the return of recvmmsg
+	LatencyHistogram mQueueLatency;
+	/// From the return of recvmmsg to the end of the uinput writes
+	LatencyHistogram mInjectLatency;
+	/// From the arrival in the kernel to the end of the uinput writes
+	LatencyHistogram mTotalLatency;
 
-	void packetToEvent(const Packet &p);
+	int mSocket = -1;
 
-	Packet readOne();
+	/// Where the sessions write their frames, it outlives them
+	std::unique_ptr<OutputBackend> mOutput;
+
+	/// Compiles the tables of the senders that connect or change geometry
+	TableCompiler mCompiler;
+	/// The pressure curves of the sessions, they outlive them
+	CurveSet mCurves;
+	/**
+	 * The thread that reads the curve file and compiles the tables of the
+	 * senders, so that the injection does not wait for them.
+	 * It stores the curves in mLoadedCurves, if they are valid, and it
+	 * signals mCurveEvent; the loop joins it before touching them.
+	 */
+	std::thread mCurveLoader;
+	std::unique_ptr<CurveSet> mLoadedCurves;
+	int mCurveEvent = -1;
+	/// Whether another reload was asked while loading
+	bool mCurvesPending = false;
+
+	/// The senders, indexed by Session::key
+	std::unordered_map<uint64_t, std::unique_ptr<Session>> mSessions;
+	/// The last session we used, since batches often come from one sender
+	Session *mLastSession = nullptr;
+	uint64_t mLastSessionKey = 0;
+
+	Recorder mRecorder;
+
+	/// The recording we replay, and the timer of its next datagram
+	Recording mRecording;
+	int mReplayTimer = -1;
+	/// When the replay started, in monotonic µs
+	uint64_t mReplayStart = 0;
+	/// The recorded time from the first datagram, without the long pauses
+	uint64_t mReplayElapsed = 0;
+	/// The recorded arrival of the last replayed datagram
+	uint64_t mReplayLast = 0;
+	uint64_t mReplayed = 0;
+	bool mReplayDone = false;
+};
 
-	libevdev *mDev = nullptr;
-	libevdev_uinput *mUidev = nullptr;
+/// The interval between two housekeeping rounds, in µs
+static const uint64_t housekeepingInterval = 1000000;
 
-	int mSocket = -1;
+/// Active senders get a report at least this often, in µs
+static const uint64_t reportInterval = 200000;
 
-	uint64_t mLastSeq = 0;
+/// Sessions without packets for this time are closed, in µs
+static const uint64_t sessionTimeout = 30000000;
 
-	uint32_t mMaxX = 16000;
-	uint32_t mMaxY = 9000;
-	int mMaxPressure = 4096;
-};
+/// The maximum number of senders we serve at the same time
+static const size_t maxSessions = 64;
 
-// For the signal handler, cannot think of anything better :(
-static bool canRun = true;
+/**
+ * A stylus that touches the surface without samples for this time is released,
+ * in µs.
+ * Clients repeat the state every 100ms while touching.
+ */
+static const uint64_t contactTimeout = 500000;
 
-static void handleSigInt(int s);
+/// The interval of the checks of the watchdog, in µs
+static const uint64_t watchdogInterval = 100000;
 
-int main()
-{
-	struct sigaction action;
-	action.sa_handler = handleSigInt;
-	sigemptyset(&action.sa_mask);
-	action.sa_flags = 0;
-	sigaction(SIGINT, &action, NULL);
+/// Longer pauses of a recording are shortened to this, in µs
+static const uint64_t maxReplayPause = 1000000;
 
-	Server s;
+/// At the maximum speed, let the timers run after this number of datagrams
+static const unsigned int replayBatch = 64;
+
+/// After the replay, wait this long for the jitter buffers (besides their
+/// maximum hold), in µs
+static const uint64_t replayDrain = 100000;
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!options.parse(argc, argv)) {
+		return 1;
+	}
+	Server s(options);
 	return s.run();
 }
 
 
+Server::Server(const Options &options) : mOptions(options)
+{
+}
+
 Server::~Server()
 {
-	if (mUidev) {
-		libevdev_uinput_destroy(mUidev);
-		mUidev = nullptr;
+	mSessions.clear();
+
+	if (mCurveLoader.joinable()) {
+		mCurveLoader.join();
 	}
-	if (mDev) {
-		libevdev_free(mDev);
-		mDev = nullptr;
+	if (mCurveEvent >= 0) {
+		close(mCurveEvent);
+		mCurveEvent = -1;
 	}
 
 	if (mSocket >= 0) {
@@ -103,42 +231,89 @@ Server::~Server()
 
 int Server::run()
 {
-	if (!setupSocket()) {
+	mCurves.setDefault(mOptions.pressureCurve);
+	if (mOptions.curveFile && !mCurves.load(mOptions.curveFile)) {
+		return 1;
+	}
+	if (!setupLoop()) {
+		return 1;
+	}
+	mOutput = mOptions.output == Options::Output::Uinput
+		? OutputBackend::createUinput() : OutputBackend::create(mOptions);
+	if (!mOutput) {
+		return 1;
+	}
+	if (mOptions.record && !mRecorder.open(mOptions.record)) {
+		return 1;
+	}
+	if (!(mOptions.replay ? setupReplay() : setupSocket())) {
 		return 1;
 	}
 
 	try {
-		readFirst();
-		if (!canRun) {
-			return 0;
-		}
-		if (!setupDevice()) {
-			return 3;
-		}
-		readEvents();
+		mLoop.run();
 	} catch (std::exception &e) {
 		fprintf(stderr, "Exiting: %s\n", e.what());
-		return 2;
+		mExitCode = 2;
 	}
 
-	return 0;
+	printStats();
+	return mExitCode;
+}
+
+bool Server::setupLoop()
+{
+	if (!mLoop.init()) {
+		return false;
+	}
+
+	auto stop = [this]() { mLoop.stop(); };
+	if (!mLoop.watchSignal(SIGINT, stop) || !mLoop.watchSignal(SIGTERM, stop)) {
+		return false;
+	}
+
+	// kill -USR1 prints the statistics without stopping the server
+	if (!mLoop.watchSignal(SIGUSR1, [this]() { printStats(); })) {
+		return false;
+	}
+
+	if (mOptions.curveFile || !mOptions.pressureCurve.linear()) {
+		auto compiled = [this](uint32_t) { tablesCompiled(); };
+		if (!mCompiler.init()
+				|| !mLoop.add(mCompiler.fd(), EPOLLIN, compiled)) {
+			return false;
+		}
+		mCurves.setCompiler(&mCompiler);
+	}
+
+	if (mOptions.curveFile) {
+		mCurveEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (mCurveEvent < 0) {
+			perror("Could not create the eventfd of the curves");
+			return false;
+		}
+		// kill -HUP reads the curve file again
+		auto loaded = [this](uint32_t) { curvesLoaded(); };
+		if (!mLoop.add(mCurveEvent, EPOLLIN, loaded)
+				|| !mLoop.watchSignal(SIGHUP, [this]() { reloadCurves(); })) {
+			return false;
+		}
+	}
+
+	mHousekeeping = mLoop.addTimer([this]() { housekeeping(); });
+	mWatchdog = mLoop.addTimer([this]() { watchdog(); });
+	return mHousekeeping >= 0 && mWatchdog >= 0;
 }
 
 bool Server::setupSocket()
 {
-	mSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	// Non-blocking: epoll tells us when to read
+	mSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (mSocket < 0) {
 		perror("Could not open a socket");
 		return false;
 	}
 
-	// Set a timeout, to handle Ctrl-C if needed
-	timeval tv = {};
-	tv.tv_sec = 0;
-	tv.tv_usec = 100000; // 100ms
-	setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO,
-		reinterpret_cast<const char*>(&tv), sizeof(tv));
-
 	sockaddr_in addr = {};
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -163,205 +338,340 @@ bool Server::setupSocket()
 	assert(len == sizeof(addr));
 	printf("Listening on port %hu\n", ntohs(addr.sin_port));
 
-	return true;
-}
+	// Not fatal, we would just measure a little less
+	BatchReceiver::enableTimestamps(mSocket);
 
-void Server::readFirst()
-{
-	Packet p = readOne();
-	mMaxX = p.maxX;
-	mMaxY = p.maxY;
-	mMaxPressure = p.maxPressure;
+	return mLoop.add(mSocket, EPOLLIN,
+		[this](uint32_t events) { readEvents(events); });
 }
 
-bool Server::setupDevice()
+bool Server::setupReplay()
 {
-	mDev = libevdev_new();
-	if (!mDev) {
-		fputs("libevdev_new returned null\n", stderr);
+	if (!mRecording.open(mOptions.replay)) {
 		return false;
 	}
-
-	libevdev_set_name(mDev, "NetStylus");
-
-	int err;
-	input_absinfo absValues;
-
-	err = libevdev_enable_event_type(mDev, EV_ABS);
-	if (err) {
-		printf("Failed to enable abs %d\n", err);
+	mReplayTimer = mLoop.addTimer([this]() { replay(); });
+	if (mReplayTimer < 0) {
+		return false;
 	}
+	printf("Replaying %s\n", mOptions.replay);
+	mReplayStart = monotonicTime();
+	// As soon as the loop starts
+	return mLoop.setTimerAt(mReplayTimer, 0);
+}
 
-	absValues = {0, 0, static_cast<int>(mMaxX), 0, 0, 100};
-	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_X, &absValues);
-	if (err) {
-		printf("Failed to enable abs X %d\n", err);
+void Server::readEvents(uint32_t)
+{
+	if (!receiveBatch()) {
+		return;
 	}
-	absValues = {0, 0, static_cast<int>(mMaxY), 0, 0, 100};
-	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_Y, &absValues);
-	if (err) {
-		printf("Failed to enable abs Y %d\n", err);
+	processBatch();
+	markActive();
+}
+
+void Server::markActive()
+{
+	mActive = true;
+	if (!mHousekeepingArmed) {
+		mHousekeepingArmed = mLoop.setTimer(mHousekeeping,
+			housekeepingInterval);
 	}
+}
 
-	absValues = {0, 0, mMaxPressure, 0, 0, 1};
-	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_PRESSURE, &absValues);
-	if (err) {
-		printf("Failed to enable abs pressure %d\n", err);
+void Server::housekeeping()
+{
+	evictSessions(monotonicTime());
+	for (auto &session : mSessions) {
+		session.second->rotateStats();
 	}
 
-	// 1 unit = 0.01 deg = 0.01 * pi / 180 rad
-	absValues = {0, 0, 18000, 0, 0, static_cast<int>(100 * 180 / M_PI)};
-	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_TILT_X, &absValues);
-	if (err) {
-		printf("Failed to enable abs tilt X %d\n", err);
+	// Do not wake up when idle: the next packet will arm the timer again.
+	// Sessions need it anyway, to be evicted.
+	mHousekeepingArmed = (mActive || !mSessions.empty())
+		&& mLoop.setTimer(mHousekeeping, housekeepingInterval);
+	mActive = false;
+
+	mRecorder.flush();
+	mOutput->flush();
+	fflush(stdout);
+}
+
+void Server::watchdog()
+{
+	const uint64_t now = monotonicTime();
+	bool touching = false;
+	for (auto &it : mSessions) {
+		Session &session = *it.second;
+		if (!session.touching()) {
+			continue;
+		}
+		if (now - session.lastActivity < contactTimeout) {
+			touching = true;
+			continue;
+		}
+		printf("%s went silent while touching, releasing the stylus\n",
+			session.name());
+		session.releaseContact();
 	}
-	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_TILT_Y, &absValues);
-	if (err) {
-		printf("Failed to enable abs tilt Y %d\n", err);
+
+	if (!touching) {
+		mLoop.setTimer(mWatchdog, 0);
+		mWatchdogArmed = false;
 	}
+}
 
-	err = libevdev_enable_event_type(mDev, EV_KEY);
-	if (err) {
-		printf("Failed to enable key %d\n", err);
+bool Server::receiveBatch()
+{
+	if (mReceiver.receive(mSocket) > 0) {
+		return true;
 	}
-	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_TOUCH, nullptr);
-	if (err) {
-		printf("Failed to enable key touch %d\n", err);
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		std::string msg = "Error while reading the packets: ";
+		msg += strerror(errno);
+		throw std::runtime_error(msg);
 	}
-	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_TOOL_PEN, nullptr);
-	if (err) {
-		printf("Failed to enable key pen %d\n", err);
+	return false;
+}
+
+void Server::processBatch()
+{
+	const uint64_t received = mReceiver.receiveTime();
+	for (unsigned int i = 0; i < mReceiver.size(); i++) {
+		const uint8_t *data = mReceiver.data(i);
+		const size_t length = mReceiver.length(i);
+		const sockaddr_in &peer = mReceiver.address(i);
+		const uint64_t arrival = mReceiver.arrival(i);
+		if (length && mRecorder.isOpen()) {
+			mRecorder.append(arrival, peer, data, length);
+		}
+
+		if (processDatagram(data, length, peer, arrival)) {
+			const uint64_t injected = monotonicTime();
+			mQueueLatency.record(received - arrival);
+			mInjectLatency.record(injected - received);
+			mTotalLatency.record(injected - arrival);
+		}
 	}
-	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_TOOL_RUBBER, nullptr);
-	if (err) {
-		printf("Failed to enable key rubber %d\n", err);
+}
+
+void Server::replay()
+{
+	if (mReplayDone) {
+		mLoop.stop();
+		return;
 	}
-	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_STYLUS, nullptr);
-	if (err) {
-		printf("Failed to enable key stylus %d\n", err);
+
+	const uint64_t now = monotonicTime();
+	Recording::Record record;
+	unsigned int processed = 0;
+	while (mRecording.peek(record)) {
+		uint64_t elapsed = mReplayElapsed;
+		if (mReplayed) {
+			// Also recordings continued after a reboot go back in time
+			const uint64_t pause = record.arrival > mReplayLast
+				? record.arrival - mReplayLast : 0;
+			elapsed += std::min(pause, maxReplayPause);
+		}
+
+		uint64_t arrival = now;
+		if (mOptions.replaySpeed > 0) {
+			arrival = mReplayStart + static_cast<uint64_t>(
+				static_cast<double>(elapsed) / mOptions.replaySpeed);
+			if (arrival > now) {
+				mLoop.setTimerAt(mReplayTimer, arrival);
+				return;
+			}
+		} else if (processed == replayBatch) {
+			mLoop.setTimerAt(mReplayTimer, 0);
+			return;
+		}
+
+		if (mRecorder.isOpen()) {
+			mRecorder.append(arrival, record.peer, record.data,
+				record.length);
+		}
+		processDatagram(record.data, record.length, record.peer, arrival);
+		mRecording.advance(record);
+		mReplayElapsed = elapsed;
+		mReplayLast = record.arrival;
+		mReplayed++;
+		processed++;
+	}
+	if (processed) {
+		markActive();
+	}
+
+	const double duration = (monotonicTime() - mReplayStart) / 1e6;
+	printf("Replayed %" PRIu64 " datagrams in %.3fs (%.0f datagrams/s)\n",
+		mReplayed, duration, duration > 0 ? mReplayed / duration : 0.0);
+	mReplayDone = true;
+	mLoop.setTimer(mReplayTimer, mOptions.jitterBuffer + replayDrain);
+}
+
+bool Server::processDatagram(const uint8_t *data, size_t length,
+	const sockaddr_in &peer, uint64_t arrival)
+{
+	const int version = packetVersion(data, length);
+	if (!version) {
+		return false;
 	}
 
-	err = libevdev_uinput_create_from_device(mDev, LIBEVDEV_UINPUT_OPEN_MANAGED,
-		&mUidev);
-	if (err) {
-		fprintf(stderr, "Could not create the device, error %d\n", err);
+	Session *session = findSession(peer);
+	if (!session) {
 		return false;
 	}
+	// The latency is until a frame reaches the device, the samples that wait
+	// in the jitter buffer or in the upsampler are written later
+	const uint64_t frames = session->framesWritten();
+	session->receive(data, length, version, arrival);
+	const bool injected = session->framesWritten() > frames;
 
-	return true;
+	if (version == 2 && (ackRequested(data, length)
+			|| arrival - session->lastReport >= reportInterval)) {
+		sendReport(peer, *session);
+	}
+	if (!mWatchdogArmed && session->touching()) {
+		mWatchdogArmed = mLoop.setTimer(mWatchdog, watchdogInterval,
+			watchdogInterval);
+	}
+	return injected;
 }
 
-void Server::readEvents()
+void Server::sendReport(const sockaddr_in &peer, Session &session)
 {
-	while (canRun) {
-		Packet p = readOne();
-		if (canRun) {
-			packetToEvent(p);
-		}
+	if (mSocket < 0) {
+		// Replaying, the sender is not there
+		return;
+	}
+
+	FeedbackReport report = session.report();
+	report.sent = monotonicTime();
+	session.lastReport = report.sent;
+	uint8_t buffer[64];
+	const size_t size = encodeReport(report, buffer, sizeof(buffer));
+	// If the socket buffer is full, the client will just ask again
+	if (sendto(mSocket, buffer, size, MSG_DONTWAIT,
+			reinterpret_cast<const sockaddr *>(&peer), sizeof(peer)) < 0
+			&& errno != EAGAIN && errno != EWOULDBLOCK) {
+		perror("Could not send a report");
 	}
 }
 
-static inline void reportError(const Packet &p, const char *descr, int err)
+void Server::printStats() const
 {
-	if (err < 0) {
-		printf("Packet %lu: failed to write %s (%d)\n",
-			p.seqNumber, descr, err);
+	mReceiver.printStats();
+	mQueueLatency.print("Socket queue latency");
+	mInjectLatency.print("Injection latency");
+	mTotalLatency.print("Total latency");
+	if (mOutput) {
+		mOutput->printStats();
+	}
+	for (const auto &session : mSessions) {
+		session.second->printStats();
 	}
+	fflush(stdout);
 }
 
-void Server::packetToEvent(const Packet &p)
+void Server::reloadCurves()
 {
-	if (!(p.status & PacketHasPressure)) {
-		// Might be a mouse event, discard it
+	if (mCurveLoader.joinable()) {
+		mCurvesPending = true;
 		return;
 	}
 
-	int err = 0;
+	// The loop keeps using mCurves, so the thread gets a copy of what it needs
+	const CurveSet::Requests requests = mCurves.requests();
+	mCurveLoader = std::thread([this, requests]() {
+		auto curves = std::make_unique<CurveSet>();
+		curves->setDefault(mOptions.pressureCurve);
+		if (curves->load(mOptions.curveFile)) {
+			curves->precompile(requests);
+			mLoadedCurves = std::move(curves);
+		}
+		const uint64_t done = 1;
+		if (write(mCurveEvent, &done, sizeof(done)) != sizeof(done)) {
+			perror("Could not signal the new curves");
+		}
+	});
+}
 
-	if (p.maxX != mMaxX) {
-		puts("Maximum X changed. "
-			"This will not work as expected, accordingly to my experience");
-		libevdev_set_abs_maximum(mDev, ABS_X, p.maxX);
-		mMaxX = p.maxX;
-	}
-	if (p.maxY != mMaxY) {
-		puts("Maximum Y changed. "
-			"This will not work as expected, accordingly to my experience");
-		libevdev_set_abs_maximum(mDev, ABS_Y, p.maxY);
-		mMaxY = p.maxY;
+void Server::curvesLoaded()
+{
+	uint64_t count;
+	if (read(mCurveEvent, &count, sizeof(count)) != sizeof(count)) {
+		return;
 	}
+	mCurveLoader.join();
 
-	err = libevdev_uinput_write_event(mUidev, EV_ABS, ABS_X, p.x);
-	reportError(p, "X", err);
-	err = libevdev_uinput_write_event(mUidev, EV_ABS, ABS_Y, p.y);
-	reportError(p, "Y", err);
-	err = libevdev_uinput_write_event(mUidev, EV_ABS, ABS_PRESSURE, p.pressure);
-	reportError(p, "pressure", err);
-
-	err = libevdev_uinput_write_event(mUidev, EV_KEY, BTN_TOUCH,
-		p.status & PacketIsTouching ? 1 : 0);
-	reportError(p, "touch", err);
-
-	if (p.status & PacketIsEraser) {
-		err = libevdev_uinput_write_event(mUidev, EV_KEY, BTN_TOOL_RUBBER, 1);
+	if (mLoadedCurves) {
+		mCurves = std::move(*mLoadedCurves);
+		mLoadedCurves.reset();
+		mCurves.setCompiler(&mCompiler);
+		// The tables are ready, this only swaps pointers
+		for (const auto &session : mSessions) {
+			session.second->updateCurve();
+		}
+		printf("Loaded %zu pressure curves from %s\n", mCurves.size(),
+			mOptions.curveFile);
 	} else {
-		err = libevdev_uinput_write_event(mUidev, EV_KEY, BTN_TOOL_PEN, 1);
+		fprintf(stderr, "Keeping the previous pressure curves\n");
 	}
-	reportError(p, "tool", err);
 
-	err = libevdev_uinput_write_event(mUidev, EV_KEY, BTN_STYLUS,
-		p.status & PacketButtonPressed);
-	reportError(p, "button", err);
+	if (mCurvesPending) {
+		mCurvesPending = false;
+		reloadCurves();
+	}
+}
 
-	if (p.status & PacketHasTiltX) {
-		err = libevdev_uinput_write_event(mUidev, EV_ABS, ABS_TILT_X, p.tiltX);
-		reportError(p, "tilt X", err);
+void Server::tablesCompiled()
+{
+	bool installed = false;
+	for (const TableCompiler::Job &job : mCompiler.finished()) {
+		installed |= mCurves.install(job);
+	}
+	if (installed) {
+		// The sessions that are not waiting find the tables they already use
+		for (const auto &session : mSessions) {
+			session.second->updateCurve();
+		}
 	}
+}
 
-	if (p.status & PacketHasTiltY) {
-		err = libevdev_uinput_write_event(mUidev, EV_ABS, ABS_TILT_Y, p.tiltY);
-		reportError(p, "tilt Y", err);
+Session *Server::findSession(const sockaddr_in &peer)
+{
+	const uint64_t key = Session::key(peer);
+	if (mLastSession && key == mLastSessionKey) {
+		return mLastSession;
 	}
 
-	err = libevdev_uinput_write_event(mUidev, EV_SYN, SYN_REPORT, 0);
-	if (err < 0) {
-		printf("Packet %lu: failed to syn (%d)\n", p.seqNumber, err);
+	auto it = mSessions.find(key);
+	if (it == mSessions.end()) {
+		if (mSessions.size() >= maxSessions) {
+			return nullptr;
+		}
+		it = mSessions.emplace(key, std::make_unique<Session>(peer, mOptions,
+			mCurves, mLoop, *mOutput)).first;
+		printf("New sender: %s\n", it->second->name());
 	}
+
+	mLastSession = it->second.get();
+	mLastSessionKey = key;
+	return mLastSession;
 }
 
-Packet Server::readOne()
+void Server::evictSessions(uint64_t now)
 {
-	const uint64_t shouldReset = 100;
-
-	Packet p;
-	ssize_t bytes;
-	do {
-		bytes = read(mSocket, reinterpret_cast<char *>(&p), sizeof(p));
-		if (bytes <= 0) {
-			continue;
-		}
-		p.magic[sizeof(p.magic) - 1] = 0;
-		if (strncmp(p.magic, PACKET_MAGIC, sizeof(p.magic))) {
+	for (auto it = mSessions.begin(); it != mSessions.end(); ) {
+		if (now - it->second->lastActivity < sessionTimeout) {
+			++it;
 			continue;
 		}
-
-		if (p.seqNumber <= mLastSeq && (mLastSeq - p.seqNumber) < shouldReset) {
-			continue;
+		printf("Sender %s timed out\n", it->second->name());
+		it->second->printStats();
+		if (it->second.get() == mLastSession) {
+			mLastSession = nullptr;
 		}
-
-		mLastSeq = p.seqNumber;
-		break;
-	} while ((bytes >= 0 || errno == EAGAIN) && canRun);
-
-	if (bytes < 0 && canRun) {
-		std::string msg = "Error while reading the packet: ";
-		msg += strerror(errno);
-		throw std::runtime_error(msg);
+		it = mSessions.erase(it);
 	}
-	return p;
-}
-
-void handleSigInt(int s)
-{
-	canRun = false;
 }
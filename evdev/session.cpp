@@ -0,0 +1,345 @@
+/**
+ * Sender sessions of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the per-sender state of the evdev server, including its
+ * virtual device.
+ */
+
+#include "session.h"
+
+#include "clock.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring> // strerror
+
+Session::Session(const sockaddr_in &peer, const Options &options,
+	CurveSet &curves, EventLoop &loop, OutputBackend &output)
+	: mAddress(peer.sin_addr.s_addr), mOutput(output), mMap(options),
+	mCurves(curves), mFilter(options.smoothing), mLoop(loop)
+{
+	char addr[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &peer.sin_addr, addr, sizeof(addr));
+	mName = addr;
+	mName += ":" + std::to_string(ntohs(peer.sin_port));
+
+	if (options.prediction) {
+		mPredictor = std::make_unique<Predictor>(options.prediction);
+	}
+
+	if (options.jitterBuffer) {
+		mPlayoutTimer = mLoop.addTimer([this]() { playout(); });
+		// Without a timer, the samples are just injected immediately
+		if (mPlayoutTimer >= 0) {
+			mJitterBuffer = std::make_unique<JitterBuffer>(
+				options.jitterBuffer);
+		}
+	}
+
+	if (options.outputRate) {
+		mUpsampler = std::make_unique<Upsampler>(options.outputRate,
+			options.interpolation);
+	}
+}
+
+Session::~Session()
+{
+	if (mPlayoutTimer >= 0) {
+		mLoop.removeTimer(mPlayoutTimer);
+		mPlayoutTimer = -1;
+	}
+}
+
+size_t Session::receive(const uint8_t *data, size_t length, int version,
+	uint64_t arrival)
+{
+	Sample samples[PacketDecoder::maxSamples];
+	size_t count;
+	Geometry geometry;
+	if (version == 1) {
+		count = decodePacketV1(data, length, samples[0], geometry) ? 1 : 0;
+	} else {
+		count = mDecoder.decode(data, length, samples);
+		geometry = mDecoder.geometry();
+	}
+
+	if (!count) {
+		return 0;
+	}
+
+	if (mLastArrival && arrival >= mLastArrival) {
+		mInterArrival.record(arrival - mLastArrival);
+	}
+	mLastArrival = arrival;
+
+	// The last sample is the closest to the moment the packet was sent
+	const uint64_t timestamp = samples[count - 1].timestamp;
+	if (timestamp) {
+		mTransit.add(timestamp, arrival);
+		if (mDecoder.hasClockOffset()) {
+			const int64_t oneWay = static_cast<int64_t>(arrival - timestamp)
+				- mDecoder.clockOffset();
+			// The offset has an error, the delay cannot be negative
+			mOneWay.record(oneWay > 0 ? static_cast<uint64_t>(oneWay) : 0);
+		}
+	}
+
+	// The redundant copies come first, so they fill the gaps before the new
+	// samples are injected
+	size_t injected = 0;
+	for (size_t i = 0; i < count; i++) {
+		Sample &sample = samples[i];
+		if (!mSequence.accept(sample.seqNumber, sample.redundant)) {
+			continue;
+		}
+		lastActivity = arrival;
+		if (sample.timestamp) {
+			mEchoTimestamp = sample.timestamp;
+			mEchoArrival = arrival;
+		}
+
+		if (!mSink) {
+			if (!setupDevice(geometry)) {
+				return injected;
+			}
+			printf("New device for %s\n", name());
+		} else if (geometry != mGeometry) {
+			setGeometry(geometry);
+		}
+		mMap.apply(sample);
+		if (mFilter.enabled()) {
+			// Old clients do not send the time of the samples
+			mFilter.apply(sample, sample.timestamp ? sample.timestamp
+				: arrival);
+		}
+
+		if (mUpsampler) {
+			Sample output[Upsampler::maxOutput];
+			const size_t produced = mUpsampler->push(sample,
+				CoordinateMap::deviceGeometry(), output);
+			for (size_t j = 0; j < produced; j++) {
+				schedule(output[j], arrival);
+			}
+		} else {
+			schedule(sample, arrival);
+		}
+		injected++;
+	}
+
+	// The due times only grow, so the timer needs to change only in playout()
+	if (mJitterBuffer && !mJitterBuffer->empty() && !mPlayoutArmed) {
+		mPlayoutArmed = mLoop.setTimerAt(mPlayoutTimer,
+			mJitterBuffer->nextDue());
+	}
+	return injected;
+}
+
+void Session::schedule(const Sample &sample, uint64_t arrival)
+{
+	const bool transition = (sample.status ^ mScheduledStatus)
+		& PACKET_TRANSITIONS;
+	mScheduledStatus = sample.status;
+	if (!mJitterBuffer) {
+		inject(sample, arrival);
+		return;
+	}
+
+	if (mUpsampler && transition) {
+		// Interpolation already delays the stream, do not delay touch changes
+		// too: play what we have and the transition immediately
+		Sample held;
+		while (mJitterBuffer->pop(UINT64_MAX, held)) {
+			inject(held, arrival);
+		}
+		inject(sample, arrival);
+		return;
+	}
+
+	if (!mJitterBuffer->push(sample, arrival)) {
+		inject(sample, arrival);
+	}
+}
+
+void Session::inject(const Sample &sample, uint64_t arrival)
+{
+	// Each sample of a batch is a frame on its own
+	if (mPredictor) {
+		// Old clients do not send the time of the samples
+		const uint64_t time = sample.timestamp ? sample.timestamp : arrival;
+		packetToEvent(mPredictor->predict(sample, time,
+			CoordinateMap::deviceGeometry()));
+	} else {
+		packetToEvent(sample);
+	}
+}
+
+void Session::playout()
+{
+	const uint64_t now = monotonicTime();
+	Sample sample;
+	while (mJitterBuffer->pop(now, sample)) {
+		inject(sample, now);
+	}
+
+	mPlayoutArmed = !mJitterBuffer->empty()
+		&& mLoop.setTimerAt(mPlayoutTimer, mJitterBuffer->nextDue());
+}
+
+bool Session::setupDevice(const Geometry &geometry)
+{
+	if (mDeviceFailed) {
+		// Do not retry at every packet, the session will be evicted eventually
+		return false;
+	}
+
+	setGeometry(geometry);
+	mSink = mOutput.createSink();
+	if (!mSink->open(mName, CoordinateMap::deviceGeometry(),
+			mMap.resolutionX(), mMap.resolutionY())) {
+		mSink.reset();
+		mDeviceFailed = true;
+		return false;
+	}
+	mFrame.invalidate();
+	return true;
+}
+
+void Session::setGeometry(const Geometry &geometry)
+{
+	// The device does not change, only the transform to it
+	mMap.setGeometry(geometry);
+	mGeometry = geometry;
+	updateCurve();
+}
+
+void Session::updateCurve()
+{
+	std::shared_ptr<const PressureTable> table;
+	if (mCurves.table(mAddress, mGeometry.maxPressure, table)) {
+		mMap.setPressureTable(std::move(table));
+		return;
+	}
+	// A table for another maximum would clamp the pressure to the wrong range,
+	// the linear scale is closer until the new one arrives
+	const PressureTable *previous = mMap.pressureTable();
+	if (previous
+			&& previous->max != static_cast<uint32_t>(mGeometry.maxPressure)) {
+		mMap.setPressureTable(nullptr);
+	}
+}
+
+void Session::releaseContact()
+{
+	Sample released = mLastSample;
+	released.status &= ~(PacketIsTouching | PacketButtonPressed);
+	released.pressure = 0;
+	// It is not a sample of the sender
+	released.timestamp = 0;
+	packetToEvent(released);
+}
+
+void Session::packetToEvent(const Sample &p)
+{
+	if (!(p.status & PacketHasPressure)) {
+		// Might be a mouse event, discard it
+		return;
+	}
+	mLastSample = p;
+
+	mFrame.setAbs(ABS_X, p.x);
+	mFrame.setAbs(ABS_Y, p.y);
+	mFrame.setAbs(ABS_PRESSURE, p.pressure);
+
+	mFrame.setKey(BTN_TOUCH, p.status & PacketIsTouching);
+
+	const bool eraser = p.status & PacketIsEraser;
+	mFrame.setKey(BTN_TOOL_RUBBER, eraser);
+	mFrame.setKey(BTN_TOOL_PEN, !eraser);
+
+	mFrame.setKey(BTN_STYLUS, p.status & PacketButtonPressed);
+
+	if (p.status & PacketHasTiltX) {
+		mFrame.setAbs(ABS_TILT_X, p.tiltX);
+	}
+	if (p.status & PacketHasTiltY) {
+		mFrame.setAbs(ABS_TILT_Y, p.tiltY);
+	}
+
+	// MSC_TIMESTAMP is a µs counter that is allowed to wrap
+	if (p.timestamp && mFrame.pending()) {
+		if (!mTimestampBase) {
+			mTimestampBase = p.timestamp;
+		}
+		const uint32_t elapsed = static_cast<uint32_t>(p.timestamp
+			- mTimestampBase);
+		mFrame.add(EV_MSC, MSC_TIMESTAMP, static_cast<int>(elapsed));
+	}
+
+	const bool pending = mFrame.pending();
+	int err = mFrame.commit(*mSink);
+	if (!err && pending) {
+		mFramesWritten++;
+	}
+	if (err < 0) {
+		printf("%s, packet %" PRIu64 ": failed to write the events (%s)\n",
+			name(), p.seqNumber, strerror(-err));
+	}
+}
+
+FeedbackReport Session::report() const
+{
+	const SequenceTracker::Counters &total = mSequence.total();
+	FeedbackReport report;
+	report.highestSeq = mSequence.highest();
+	report.complete = true;
+	report.received = static_cast<uint64_t>(std::max<int64_t>(total.received,
+		0));
+	report.lost = static_cast<uint64_t>(std::max<int64_t>(total.lost, 0));
+	report.echo = mEchoTimestamp;
+	report.arrival = mEchoArrival;
+	return report;
+}
+
+void Session::printStats() const
+{
+	// The server rotates the statistics every second
+	mSequence.print(name(), "last 10s");
+	mTransit.print(name());
+	std::string label = name();
+	label += ": inter-arrival";
+	mInterArrival.print(label.c_str());
+	if (mOneWay.count()) {
+		label = name();
+		label += ": one-way latency";
+		mOneWay.print(label.c_str());
+	}
+	const PacketDecoder::Stats &decoder = mDecoder.stats();
+	printf("%s: %" PRIu64 " malformed packets, %" PRIu64 " samples without "
+		"keyframe, %" PRIu64 " without geometry\n", name(),
+		decoder.malformed, decoder.missingKeyframe, decoder.missingGeometry);
+	if (mPredictor) {
+		mPredictor->print(name());
+	}
+	if (mJitterBuffer) {
+		mJitterBuffer->print(name());
+	}
+	if (mUpsampler) {
+		mUpsampler->print(name());
+	}
+}
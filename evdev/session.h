@@ -0,0 +1,196 @@
+/**
+ * Sender sessions of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include "coordinate_map.h"
+#include "event_frame.h"
+#include "event_loop.h"
+#include "jitter_buffer.h"
+#include "options.h"
+#include "output_sink.h"
+#include "predictor.h"
+#include "pressure_curve.h"
+#include "stats.h"
+#include "stroke_filter.h"
+
+#include <packet_codec.h>
+
+#include <netinet/in.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * The state of a sender, i.e., of a tablet.
+ *
+ * Each session has its own sequence numbers, its own geometry and its own
+ * output sink (usually a virtual device), that is created when the first valid
+ * packet arrives.
+ * The samples are mapped to the fixed range of the device as soon as they
+ * arrive, so the rest of the pipeline works in device units.
+ */
+class Session {
+public:
+	/// The curves and the output outlive the session
+	Session(const sockaddr_in &peer, const Options &options, CurveSet &curves,
+		EventLoop &loop, OutputBackend &output);
+	Session(const Session &) = delete;
+	Session &operator=(const Session &) = delete;
+	~Session();
+
+	/// Convert a sender address to the key of the session table
+	static uint64_t key(const sockaddr_in &peer)
+	{
+		return (static_cast<uint64_t>(peer.sin_addr.s_addr) << 16)
+			| peer.sin_port;
+	}
+
+	/// The address of the sender, for log messages
+	const char *name() const
+	{
+		return mName.c_str();
+	}
+
+	/**
+	 * Decode a datagram of the sender and inject its samples, or add them to
+	 * the jitter buffer.
+	 *
+	 * \param version The version returned by packetVersion
+	 * \param arrival The monotonic time of arrival of the datagram, in µs
+	 * \return The number of injected or buffered samples
+	 */
+	size_t receive(const uint8_t *data, size_t length, int version,
+		uint64_t arrival);
+
+	/// The frames written to the device, not the ones still in the buffers
+	uint64_t framesWritten() const
+	{
+		return mFramesWritten;
+	}
+
+	/// Print the statistics of the sender on stdout
+	void printStats() const;
+
+	/// Start a new slot of the sliding windows of the statistics
+	void rotateStats()
+	{
+		mSequence.rotate();
+	}
+
+	/// The highest sequence number received, for the acknowledgments
+	uint64_t highestSeq() const
+	{
+		return mSequence.highest();
+	}
+
+	/// The feedback for the sender, without the time it is sent
+	FeedbackReport report() const;
+
+	/// Whether the stylus of the device is touching the surface
+	bool touching() const
+	{
+		return mSink && (mLastSample.status & PacketIsTouching);
+	}
+
+	/// Lift the stylus, when the sender stopped sending while touching
+	void releaseContact();
+
+	/**
+	 * Take the pressure curve again, after the curves or the geometry changed,
+	 * or after a table has been compiled.
+	 *
+	 * Until the table is ready, it keeps the previous one.
+	 */
+	void updateCurve();
+
+	/// The monotonic time of the last valid packet, in µs
+	uint64_t lastActivity = 0;
+
+	/// The monotonic time of the last report to the sender, in µs
+	uint64_t lastReport = 0;
+
+private:
+	/// Create the device, and map the geometry of the first packet to it
+	bool setupDevice(const Geometry &geometry);
+
+	void setGeometry(const Geometry &geometry);
+
+	/// Inject a sample, or add it to the jitter buffer
+	void schedule(const Sample &sample, uint64_t arrival);
+
+	/// Inject a sample, after the prediction
+	void inject(const Sample &sample, uint64_t arrival);
+
+	/// Inject the samples of the jitter buffer that are due
+	void playout();
+
+	void packetToEvent(const Sample &s);
+
+	std::string mName;
+	/// The IPv4 address of the sender, in network order
+	uint32_t mAddress;
+
+	OutputBackend &mOutput;
+	/// Only after the device has been created
+	std::unique_ptr<OutputSink> mSink;
+	EventFrame mFrame;
+	uint64_t mFramesWritten = 0;
+	/// Whether we already failed to create the device
+	bool mDeviceFailed = false;
+
+	PacketDecoder mDecoder;
+	SequenceTracker mSequence;
+
+	/// The sender time that corresponds to 0 in MSC_TIMESTAMP
+	uint64_t mTimestampBase = 0;
+	TransitStats mTransit;
+
+	/// The time between two datagrams
+	LatencyHistogram mInterArrival;
+	uint64_t mLastArrival = 0;
+
+	/// The newest sample and its arrival, to echo them in the reports
+	uint64_t mEchoTimestamp = 0;
+	uint64_t mEchoArrival = 0;
+
+	/// From the sample to the arrival, when the sender knows our clock
+	LatencyHistogram mOneWay;
+
+	/// The geometry of the sender, and its transform to the device
+	Geometry mGeometry;
+	CoordinateMap mMap;
+	CurveSet &mCurves;
+
+	/// Smooths the samples after the map, if enabled by the options
+	StrokeFilter mFilter;
+
+	/// The last injected sample
+	Sample mLastSample;
+
+	/// Only if enabled by the options
+	std::unique_ptr<Predictor> mPredictor;
+
+	EventLoop &mLoop;
+	/// Only if enabled by the options, with its timer
+	std::unique_ptr<JitterBuffer> mJitterBuffer;
+	int mPlayoutTimer = -1;
+	bool mPlayoutArmed = false;
+
+	/// Only if enabled by the options
+	std::unique_ptr<Upsampler> mUpsampler;
+	/// The status of the last sample we scheduled, to detect the transitions
+	uint16_t mScheduledStatus = 0;
+};
@@ -0,0 +1,250 @@
+/**
+ * Statistics of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the statistics that the evdev server collects about its
+ * senders.
+ */
+
+#include "stats.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+void LatencyHistogram::record(uint64_t value)
+{
+	const uint64_t maxValue = (uint64_t(1) << maxBits) - 1;
+	if (value > maxValue) {
+		value = maxValue;
+	}
+	mBuckets[bucketOf(value)]++;
+	mCount++;
+	mSum += value;
+	if (value > mMax) {
+		mMax = value;
+	}
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+	const uint64_t wanted = static_cast<uint64_t>(fraction * mCount + 0.5);
+	uint64_t seen = 0;
+	for (unsigned int i = 0; i < numBuckets; i++) {
+		seen += mBuckets[i];
+		if (seen >= wanted && seen) {
+			const uint64_t highest = highestOf(i);
+			return highest < mMax ? highest : mMax;
+		}
+	}
+	return mMax;
+}
+
+void LatencyHistogram::print(const char *label, const char *unit) const
+{
+	if (!mCount) {
+		printf("%s: no data\n", label);
+		return;
+	}
+	printf("%s (%s): avg %" PRIu64 ", p50 %" PRIu64 ", p99 %" PRIu64
+		", p99.9 %" PRIu64 ", max %" PRIu64 " (%" PRIu64 " samples)\n",
+		label, unit, mSum / mCount, percentile(0.5), percentile(0.99),
+		percentile(0.999), mMax, mCount);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+	for (unsigned int i = 0; i < numBuckets; i++) {
+		mBuckets[i] += other.mBuckets[i];
+	}
+	mCount += other.mCount;
+	mSum += other.mSum;
+	if (other.mMax > mMax) {
+		mMax = other.mMax;
+	}
+}
+
+void LatencyHistogram::reset()
+{
+	*this = LatencyHistogram();
+}
+
+unsigned int LatencyHistogram::bucketOf(uint64_t value)
+{
+	if (value < subBuckets) {
+		return static_cast<unsigned int>(value);
+	}
+	// The position of the highest bit, at least subBucketBits
+	const unsigned int msb = 63 - __builtin_clzll(value);
+	const unsigned int shift = msb - subBucketBits + 1;
+	// value >> shift is in [subBuckets / 2, subBuckets)
+	return shift * subBuckets / 2 + static_cast<unsigned int>(value >> shift);
+}
+
+uint64_t LatencyHistogram::highestOf(unsigned int bucket)
+{
+	if (bucket < subBuckets) {
+		return bucket;
+	}
+	const unsigned int shift = bucket / (subBuckets / 2) - 1;
+	const uint64_t sub = bucket % (subBuckets / 2) + subBuckets / 2;
+	return ((sub + 1) << shift) - 1;
+}
+
+SequenceTracker::Counters &SequenceTracker::Counters::operator+=(
+	const Counters &other)
+{
+	received += other.received;
+	lost += other.lost;
+	late += other.late;
+	duplicate += other.duplicate;
+	resets += other.resets;
+	recovered += other.recovered;
+	return *this;
+}
+
+bool SequenceTracker::accept(uint64_t seq, bool redundant)
+{
+	const uint64_t bitmapSize = 8 * sizeof(mReceived);
+	static_assert(resetDistance <= 8 * sizeof(mReceived),
+		"The bitmap must cover all the packets that are not a reset");
+
+	if (mStarted && seq <= mHighest && mHighest - seq < resetDistance) {
+		const uint64_t age = mHighest - seq;
+		uint64_t &word = mReceived[age / 64];
+		const uint64_t bit = uint64_t(1) << (age % 64);
+		if (word & bit) {
+			if (!redundant) {
+				count(&Counters::duplicate);
+			}
+		} else {
+			word |= bit;
+			count(&Counters::late);
+			// We had counted it as lost, unless it was sent before the packet
+			// that started the stream
+			if (seq > mFirst) {
+				count(&Counters::lost, -1);
+			}
+		}
+		return false;
+	}
+
+	if (!mStarted || seq < mHighest) {
+		if (mStarted) {
+			count(&Counters::resets);
+		}
+		mStarted = true;
+		mFirst = seq;
+		mReceived[0] = mReceived[1] = 0;
+	} else {
+		// Shift the bitmap, and count the holes that fall out of it
+		const uint64_t shift = seq - mHighest;
+		count(&Counters::lost, static_cast<int64_t>(shift - 1));
+		if (redundant) {
+			count(&Counters::recovered);
+		}
+		if (shift >= bitmapSize) {
+			mReceived[0] = mReceived[1] = 0;
+		} else if (shift >= 64) {
+			mReceived[1] = mReceived[0] << (shift - 64);
+			mReceived[0] = 0;
+		} else {
+			mReceived[1] = (mReceived[1] << shift)
+				| (mReceived[0] >> (64 - shift));
+			mReceived[0] <<= shift;
+		}
+	}
+
+	mHighest = seq;
+	mReceived[0] |= 1;
+	count(&Counters::received);
+	return true;
+}
+
+void SequenceTracker::rotate()
+{
+	mSlot = (mSlot + 1) % windowSlots;
+	mWindow[mSlot] = Counters();
+}
+
+SequenceTracker::Counters SequenceTracker::window() const
+{
+	Counters sum;
+	for (const Counters &slot : mWindow) {
+		sum += slot;
+	}
+	return sum;
+}
+
+void SequenceTracker::count(int64_t Counters::*counter, int64_t value)
+{
+	mTotal.*counter += value;
+	mWindow[mSlot].*counter += value;
+}
+
+static void printCounters(const char *name, const char *label,
+	const SequenceTracker::Counters &c)
+{
+	const int64_t expected = c.received + c.lost;
+	printf("%s: %s received %" PRId64 ", lost %" PRId64 " (%.2f%%), "
+		"late %" PRId64 ", duplicate %" PRId64 ", resets %" PRId64 ", "
+		"recovered %" PRId64 "\n",
+		name, label, c.received, c.lost,
+		expected > 0 ? 100.0 * c.lost / expected : 0.0, c.late, c.duplicate,
+		c.resets, c.recovered);
+}
+
+void SequenceTracker::print(const char *name, const char *window) const
+{
+	printCounters(name, "total", mTotal);
+	printCounters(name, window, this->window());
+}
+
+void TransitStats::add(uint64_t sent, uint64_t arrived)
+{
+	// Only differences make sense, so the offset of the clocks does not matter
+	const int64_t transit = static_cast<int64_t>(arrived - sent);
+
+	if (mCount) {
+		const int64_t d = transit - mLastTransit;
+		mJitter += ((d < 0 ? -d : d) - mJitter) / 16;
+	}
+
+	if (!mCount || transit < mMinTransit) {
+		// The delays refer to the old minimum, start over
+		mMinTransit = transit;
+		mMaxDelay = 0;
+		mDelaySum = 0;
+		mDelayCount = 0;
+	}
+
+	const int64_t delay = transit - mMinTransit;
+	if (delay > mMaxDelay) {
+		mMaxDelay = delay;
+	}
+	mDelaySum += delay;
+	mDelayCount++;
+	mLastTransit = transit;
+	mCount++;
+}
+
+void TransitStats::print(const char *name) const
+{
+	if (!mCount) {
+		return;
+	}
+	printf("%s: network delay avg %" PRId64 "µs, max %" PRId64 "µs, "
+		"jitter %.0fµs (%" PRIu64 " packets)\n", name,
+		mDelaySum / mDelayCount, mMaxDelay, mJitter, mCount);
+}
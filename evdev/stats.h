@@ -0,0 +1,200 @@
+/**
+ * Statistics of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * A histogram of durations with a bounded relative error, like HdrHistogram.
+ *
+ * Values are in µs, unless told otherwise. Values below subBuckets are exact,
+ * larger ones go to linear buckets, subBuckets / 2 for each power of two, so
+ * the relative error is below 2 / subBuckets. The buckets are a fixed array,
+ * so recording a value never allocates and takes a handful of instructions.
+ */
+class LatencyHistogram {
+public:
+	/// log2 of the number of buckets for every power of two
+	static const unsigned int subBucketBits = 5;
+	static const unsigned int subBuckets = 1u << subBucketBits;
+
+	/// The largest value we can record, larger values are clamped (~1h)
+	static const unsigned int maxBits = 32;
+
+	void record(uint64_t value);
+
+	/// The value below which there is the given fraction of the records
+	uint64_t percentile(double fraction) const;
+
+	uint64_t count() const
+	{
+		return mCount;
+	}
+
+	uint64_t max() const
+	{
+		return mMax;
+	}
+
+	/**
+	 * Print the percentiles on stdout.
+	 *
+	 * \param label The name of the measure
+	 * \param unit The unit of the values
+	 */
+	void print(const char *label, const char *unit = "µs") const;
+
+	/// Add the records of another histogram, e.g., of another thread
+	void merge(const LatencyHistogram &other);
+
+	void reset();
+
+private:
+	static unsigned int bucketOf(uint64_t value);
+	static uint64_t highestOf(unsigned int bucket);
+
+	static const unsigned int numBuckets = (maxBits - subBucketBits + 2)
+		* (subBuckets / 2);
+
+	uint64_t mBuckets[numBuckets] = {};
+	uint64_t mCount = 0;
+	uint64_t mMax = 0;
+	uint64_t mSum = 0;
+};
+
+/**
+ * Checks the sequence numbers of a sender and counts the anomalies.
+ *
+ * Packets older than the newest one are rejected, because they would move the
+ * stylus back in time.
+ * A gap in the sequence is counted as lost, until the missing packets arrive
+ * late. Older packets are told apart from duplicates by a bitmap of the last
+ * received sequence numbers.
+ *
+ * Redundant copies of packets fill the gaps when they are newer than the
+ * others, and they are ignored without counting them as duplicates otherwise.
+ *
+ * Besides the totals, the counters are kept for the last windowSlots calls to
+ * rotate(), so that the recent state of the network is visible, too.
+ */
+class SequenceTracker {
+public:
+	/// A packet that much older than the newest one means a new stream
+	static const uint64_t resetDistance = 100;
+
+	/// The number of slots of the sliding window
+	static const unsigned int windowSlots = 10;
+
+	/// The counters of the anomalies
+	struct Counters {
+		int64_t received = 0; ///< Accepted packets
+		int64_t lost = 0; ///< Packets that never arrived (yet)
+		int64_t late = 0; ///< Packets that arrived after a newer one
+		int64_t duplicate = 0; ///< Packets that we had already received
+		int64_t resets = 0; ///< Times the sender restarted the sequence
+		int64_t recovered = 0; ///< Packets received only as redundant copies
+
+		Counters &operator+=(const Counters &other);
+	};
+
+	/**
+	 * Check a sequence number.
+	 *
+	 * \param redundant Whether this is a copy carried by a later packet
+	 * \return true if the packet is newer than the others and should be used
+	 */
+	bool accept(uint64_t seq, bool redundant = false);
+
+	/// Start a new slot of the sliding window
+	void rotate();
+
+	/// The highest sequence number we have received
+	uint64_t highest() const
+	{
+		return mHighest;
+	}
+
+	const Counters &total() const
+	{
+		return mTotal;
+	}
+
+	/// The sum of the counters of the sliding window
+	Counters window() const;
+
+	/**
+	 * Print the statistics on stdout.
+	 *
+	 * \param name The name of the sender
+	 * \param window A description of the duration of the sliding window
+	 */
+	void print(const char *name, const char *window) const;
+
+private:
+	void count(int64_t Counters::*counter, int64_t value = 1);
+
+	bool mStarted = false;
+	uint64_t mHighest = 0;
+	/// The first number of the stream, the older ones were never lost
+	uint64_t mFirst = 0;
+	/// Bit i tells whether mHighest - i has been received
+	uint64_t mReceived[2] = {};
+
+	Counters mTotal;
+	Counters mWindow[windowSlots];
+	unsigned int mSlot = 0;
+};
+
+/**
+ * Transit times of the packets of a sender.
+ *
+ * The clocks of the sender and of the server are not synchronized, so the
+ * absolute transit time is unknown. However, the difference between the
+ * transit time of a packet and the fastest one we have seen tells how much the
+ * packet has been delayed by the network.
+ */
+class TransitStats {
+public:
+	/**
+	 * Add a packet.
+	 *
+	 * \param sent The time of the packet, in the clock of the sender (µs)
+	 * \param arrived The time of the arrival, in the clock of the server (µs)
+	 */
+	void add(uint64_t sent, uint64_t arrived);
+
+	/// The delay of the last packet with respect to the fastest one, in µs
+	int64_t lastDelay() const
+	{
+		return mCount ? mLastTransit - mMinTransit : 0;
+	}
+
+	/// Print the statistics on stdout, prefixed by the name of the sender
+	void print(const char *name) const;
+
+private:
+	uint64_t mCount = 0;
+
+	int64_t mMinTransit = 0;
+	int64_t mLastTransit = 0;
+	/// The largest difference from mMinTransit (reset when it changes)
+	int64_t mMaxDelay = 0;
+	/// The sum of the delays since mMinTransit changed, to compute the average
+	int64_t mDelaySum = 0;
+	uint64_t mDelayCount = 0;
+
+	/// The interarrival jitter of RFC 3550, in µs
+	double mJitter = 0;
+};
@@ -0,0 +1,113 @@
+/**
+ * Stroke smoothing for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the implementation of the One-Euro filter of the strokes.
+ */
+
+#include "stroke_filter.h"
+
+#include <cmath>
+
+namespace {
+
+/// A longer pause between two samples starts a new stroke, in µs
+const uint64_t maxGap = 100000;
+
+const double twoPi = 6.283185307179586;
+
+/**
+ * The weight of a new value in a low-pass filter.
+ *
+ * \param omega The cutoff, in radians per second
+ * \param dt The time from the previous value, in seconds
+ */
+double smoothing(double omega, double dt)
+{
+	const double r = omega * dt;
+	return r / (r + 1);
+}
+
+} // namespace
+
+StrokeFilter::StrokeFilter(const Settings &settings)
+	: mX(coefficients(settings.x)), mY(coefficients(settings.y)),
+	mPressure(coefficients(settings.pressure)), mEnabled(settings.enabled())
+{
+}
+
+void StrokeFilter::apply(Sample &sample, uint64_t time)
+{
+	State &state = mState;
+	if (!state.started || time <= state.time || time - state.time > maxGap
+			|| ((sample.status ^ state.status) & PACKET_TRANSITIONS)) {
+		reset(sample, time);
+		return;
+	}
+
+	const double dt = static_cast<double>(time - state.time) * 1e-6;
+	const double rate = 1 / dt;
+	state.time = time;
+	state.status = sample.status;
+	// The values are in device units, so they are never negative
+	if (mX.minCutoff > 0) {
+		sample.x = static_cast<uint32_t>(filter(mX, state.x, sample.x,
+			dt, rate) + 0.5);
+	}
+	if (mY.minCutoff > 0) {
+		sample.y = static_cast<uint32_t>(filter(mY, state.y, sample.y,
+			dt, rate) + 0.5);
+	}
+	// The average of positive pressures is positive, so a stroke is never
+	// lifted by the filter
+	if (mPressure.minCutoff > 0) {
+		sample.pressure = static_cast<uint32_t>(filter(mPressure,
+			state.pressure, sample.pressure, dt, rate) + 0.5);
+	}
+}
+
+StrokeFilter::Coefficients StrokeFilter::coefficients(
+	const Parameters &parameters)
+{
+	Coefficients scaled;
+	if (parameters.enabled()) {
+		scaled.minCutoff = twoPi * parameters.minCutoff;
+		scaled.beta = twoPi * parameters.beta;
+		scaled.derivativeCutoff = twoPi * parameters.derivativeCutoff;
+	}
+	return scaled;
+}
+
+double StrokeFilter::filter(const Coefficients &coefficients, Axis &axis,
+	double measured, double dt, double rate)
+{
+	const double derivative = (measured - axis.value) * rate;
+	axis.derivative += smoothing(coefficients.derivativeCutoff, dt)
+		* (derivative - axis.derivative);
+	const double cutoff = coefficients.minCutoff
+		+ coefficients.beta * std::fabs(axis.derivative);
+	axis.value += smoothing(cutoff, dt) * (measured - axis.value);
+	return axis.value;
+}
+
+void StrokeFilter::reset(const Sample &sample, uint64_t time)
+{
+	mState.x = {static_cast<double>(sample.x), 0};
+	mState.y = {static_cast<double>(sample.y), 0};
+	mState.pressure = {static_cast<double>(sample.pressure), 0};
+	mState.time = time;
+	mState.status = sample.status;
+	mState.started = true;
+}
@@ -0,0 +1,111 @@
+/**
+ * Stroke smoothing for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <packet_codec.h>
+
+#include <cstdint>
+
+/**
+ * Removes the jitter of the digitizer with a One-Euro filter (Casiez et al.,
+ * CHI 2012).
+ *
+ * Each axis goes through a low-pass filter whose cutoff grows with the speed:
+ * at rest, the cutoff is low and the small changes of a still stylus are
+ * flattened; in fast motion, it is high and the delay of the filter,
+ * 1 / (2π cutoff), becomes negligible.
+ *
+ * Touch, eraser and button transitions and long gaps reset the filter, so the
+ * strokes start and end exactly on the samples of the sender.
+ */
+class StrokeFilter {
+public:
+	/// The settings of an axis; a minCutoff of 0 leaves the axis unchanged
+	struct Parameters {
+		/// The cutoff at rest, in Hz
+		double minCutoff = 0;
+		/// How fast the cutoff grows with the speed, in Hz per device units
+		/// per second
+		double beta = 0;
+		/// The cutoff of the estimate of the speed, in Hz
+		double derivativeCutoff = 1;
+
+		bool enabled() const
+		{
+			return minCutoff > 0;
+		}
+	};
+
+	struct Settings {
+		Parameters x;
+		Parameters y;
+		Parameters pressure;
+
+		bool enabled() const
+		{
+			return x.enabled() || y.enabled() || pressure.enabled();
+		}
+	};
+
+	explicit StrokeFilter(const Settings &settings);
+
+	bool enabled() const
+	{
+		return mEnabled;
+	}
+
+	/**
+	 * Smooth x, y and pressure of a sample, in device units.
+	 *
+	 * \param time The time of the sample, in µs
+	 */
+	void apply(Sample &sample, uint64_t time);
+
+private:
+	/// The coefficients of an axis, 2π times the cutoffs
+	struct Coefficients {
+		double minCutoff = 0;
+		double beta = 0;
+		double derivativeCutoff = 0;
+	};
+
+	/// The state of the filter of an axis
+	struct Axis {
+		double value;
+		double derivative; ///< In device units per second
+	};
+
+	static Coefficients coefficients(const Parameters &parameters);
+	/// \param rate 1 / dt, shared by the axes
+	static double filter(const Coefficients &coefficients, Axis &axis,
+		double measured, double dt, double rate);
+	void reset(const Sample &sample, uint64_t time);
+
+	/// The state is touched at every sample, keep it on one cache line
+	struct alignas(64) State {
+		Axis x;
+		Axis y;
+		Axis pressure;
+		uint64_t time;
+		uint16_t status;
+		bool started;
+	};
+
+	State mState = {};
+	Coefficients mX;
+	Coefficients mY;
+	Coefficients mPressure;
+	bool mEnabled;
+};
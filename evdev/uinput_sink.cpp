@@ -0,0 +1,184 @@
+/**
+ * Uinput devices of the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the output of the evdev server to uinput devices, the
+ * only backend that needs libevdev.
+ */
+
+#include "output_sink.h"
+
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath> // M_PI
+#include <cstdio>
+
+namespace {
+
+/// A virtual device created through uinput
+class UinputSink : public OutputSink {
+public:
+	UinputSink() = default;
+	UinputSink(const UinputSink &) = delete;
+	UinputSink &operator=(const UinputSink &) = delete;
+	~UinputSink() override;
+
+	bool open(const std::string &name, const Geometry &geometry,
+		int32_t resolutionX, int32_t resolutionY) override;
+	int write(const input_event *events, unsigned int count) override;
+
+private:
+	libevdev *mDev = nullptr;
+	libevdev_uinput *mUidev = nullptr;
+	/// The file descriptor of mUidev, to write the frames directly
+	int mUinputFd = -1;
+};
+
+UinputSink::~UinputSink()
+{
+	if (mUidev) {
+		libevdev_uinput_destroy(mUidev);
+		mUidev = nullptr;
+	}
+	if (mDev) {
+		libevdev_free(mDev);
+		mDev = nullptr;
+	}
+}
+
+bool UinputSink::open(const std::string &name, const Geometry &geometry,
+	int32_t resolutionX, int32_t resolutionY)
+{
+	mDev = libevdev_new();
+	if (!mDev) {
+		fputs("libevdev_new returned null\n", stderr);
+		return false;
+	}
+
+	std::string devName = "NetStylus " + name;
+	libevdev_set_name(mDev, devName.c_str());
+
+	int err;
+	input_absinfo absValues;
+
+	err = libevdev_enable_event_type(mDev, EV_ABS);
+	if (err) {
+		printf("Failed to enable abs %d\n", err);
+	}
+
+	absValues = {0, 0, static_cast<int>(geometry.maxX), 0, 0, resolutionX};
+	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_X, &absValues);
+	if (err) {
+		printf("Failed to enable abs X %d\n", err);
+	}
+	absValues = {0, 0, static_cast<int>(geometry.maxY), 0, 0, resolutionY};
+	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_Y, &absValues);
+	if (err) {
+		printf("Failed to enable abs Y %d\n", err);
+	}
+
+	absValues = {0, 0, geometry.maxPressure, 0, 0, 1};
+	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_PRESSURE, &absValues);
+	if (err) {
+		printf("Failed to enable abs pressure %d\n", err);
+	}
+
+	// 1 unit = 0.01 deg = 0.01 * pi / 180 rad
+	absValues = {0, 0, 18000, 0, 0, static_cast<int>(100 * 180 / M_PI)};
+	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_TILT_X, &absValues);
+	if (err) {
+		printf("Failed to enable abs tilt X %d\n", err);
+	}
+	err = libevdev_enable_event_code(mDev, EV_ABS, ABS_TILT_Y, &absValues);
+	if (err) {
+		printf("Failed to enable abs tilt Y %d\n", err);
+	}
+
+	// Tell applications when the samples were taken, as the network might
+	// have changed their cadence
+	err = libevdev_enable_event_type(mDev, EV_MSC);
+	if (err) {
+		printf("Failed to enable msc %d\n", err);
+	}
+	err = libevdev_enable_event_code(mDev, EV_MSC, MSC_TIMESTAMP, nullptr);
+	if (err) {
+		printf("Failed to enable msc timestamp %d\n", err);
+	}
+
+	err = libevdev_enable_event_type(mDev, EV_KEY);
+	if (err) {
+		printf("Failed to enable key %d\n", err);
+	}
+	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_TOUCH, nullptr);
+	if (err) {
+		printf("Failed to enable key touch %d\n", err);
+	}
+	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_TOOL_PEN, nullptr);
+	if (err) {
+		printf("Failed to enable key pen %d\n", err);
+	}
+	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_TOOL_RUBBER, nullptr);
+	if (err) {
+		printf("Failed to enable key rubber %d\n", err);
+	}
+	err = libevdev_enable_event_code(mDev, EV_KEY, BTN_STYLUS, nullptr);
+	if (err) {
+		printf("Failed to enable key stylus %d\n", err);
+	}
+
+	err = libevdev_uinput_create_from_device(mDev, LIBEVDEV_UINPUT_OPEN_MANAGED,
+		&mUidev);
+	if (err) {
+		fprintf(stderr, "Could not create the device for %s, error %d\n",
+			name.c_str(), err);
+		return false;
+	}
+	mUinputFd = libevdev_uinput_get_fd(mUidev);
+	return true;
+}
+
+int UinputSink::write(const input_event *events, unsigned int count)
+{
+	const size_t size = count * sizeof(input_event);
+	ssize_t written;
+	do {
+		written = ::write(mUinputFd, events, size);
+	} while (written < 0 && errno == EINTR);
+
+	if (written < 0) {
+		return -errno;
+	}
+	// uinput accepts only whole events, and we write much less than a page
+	return static_cast<size_t>(written) == size ? 0 : -EIO;
+}
+
+class UinputBackend : public OutputBackend {
+public:
+	std::unique_ptr<OutputSink> createSink() override
+	{
+		return std::make_unique<UinputSink>();
+	}
+};
+
+} // namespace
+
+std::unique_ptr<OutputBackend> OutputBackend::createUinput()
+{
+	return std::make_unique<UinputBackend>();
+}
@@ -0,0 +1,222 @@
+/**
+ * Fixed-rate upsampling for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the interpolation of the fixed-rate output mode.
+ */
+
+#include "upsampler.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+/// Do not interpolate across a longer pause between two samples, in µs
+const uint64_t maxGap = 50000;
+
+static_assert(maxGap * Upsampler::maxRate / 1000000 < Upsampler::maxOutput,
+	"A segment must fit the output");
+
+/// The values we interpolate
+enum Channel {
+	ChannelX,
+	ChannelY,
+	ChannelPressure,
+	ChannelTiltX,
+	ChannelTiltY,
+	NumChannels,
+};
+
+void getChannels(const Sample &s, float values[NumChannels])
+{
+	values[ChannelX] = static_cast<float>(s.x);
+	values[ChannelY] = static_cast<float>(s.y);
+	values[ChannelPressure] = static_cast<float>(s.pressure);
+	values[ChannelTiltX] = static_cast<float>(static_cast<int32_t>(s.tiltX));
+	values[ChannelTiltY] = static_cast<float>(static_cast<int32_t>(s.tiltY));
+}
+
+float clamp(float value, float low, float high)
+{
+	return value < low ? low : (value > high ? high : value);
+}
+
+/**
+ * The kernel: evaluate a cubic Hermite segment at count points at once.
+ *
+ * The basis functions depend only on the positions, so they are computed once
+ * for all the channels. The loops have no branches, so that the compiler can
+ * vectorize them.
+ */
+struct HermiteBasis {
+	float h00[Upsampler::maxOutput];
+	float h10[Upsampler::maxOutput];
+	float h01[Upsampler::maxOutput];
+	float h11[Upsampler::maxOutput];
+
+	/// \param u The positions in the segment, in (0, 1]
+	void compute(const float *u, size_t count)
+	{
+		for (size_t i = 0; i < count; i++) {
+			const float t = u[i];
+			const float t2 = t * t;
+			const float t3 = t2 * t;
+			h00[i] = 2 * t3 - 3 * t2 + 1;
+			h10[i] = t3 - 2 * t2 + t;
+			h01[i] = 3 * t2 - 2 * t3;
+			h11[i] = t3 - t2;
+		}
+	}
+
+	/// \param m1, m2 The tangents, already scaled to the segment
+	void evaluate(size_t count, float p1, float p2, float m1, float m2,
+		float *out) const
+	{
+		for (size_t i = 0; i < count; i++) {
+			out[i] = h00[i] * p1 + h10[i] * m1 + h01[i] * p2 + h11[i] * m2;
+		}
+	}
+};
+
+} // namespace
+
+Upsampler::Upsampler(unsigned int rate, Interpolation interpolation)
+	: mPeriod(1000000 / rate), mInterpolation(interpolation)
+{
+}
+
+size_t Upsampler::push(const Sample &sample, const Geometry &geometry,
+	Sample *output)
+{
+	mReal++;
+	const Sample *newest = mCount ? &mPoints[mCount - 1] : nullptr;
+	if (!sample.timestamp || !newest
+			|| ((sample.status ^ newest->status) & PACKET_TRANSITIONS)
+			|| sample.timestamp <= newest->timestamp
+			|| sample.timestamp - newest->timestamp > maxGap) {
+		size_t count = 0;
+		if (mInterpolation == Interpolation::CatmullRom && mCount >= 2) {
+			// The last segment of the stroke was waiting for this sample
+			count = segment(true, geometry, output);
+		}
+		output[count++] = sample;
+		mPassedThrough++;
+		mPoints[0] = sample;
+		mCount = sample.timestamp ? 1 : 0;
+		return count;
+	}
+
+	if (mCount == 4) {
+		mPoints[0] = mPoints[1];
+		mPoints[1] = mPoints[2];
+		mPoints[2] = mPoints[3];
+		mCount--;
+	}
+	mPoints[mCount++] = sample;
+
+	if (mInterpolation == Interpolation::CatmullRom && mCount < 3) {
+		return 0;
+	}
+	return segment(false, geometry, output);
+}
+
+size_t Upsampler::segment(bool last, const Geometry &geometry, Sample *output)
+{
+	// The points around the segment, p1 -> p2
+	const Sample *p0, *p1, *p2, *p3;
+	if (mInterpolation == Interpolation::Linear) {
+		p1 = &mPoints[mCount - 2];
+		p2 = &mPoints[mCount - 1];
+		p0 = p1;
+		p3 = p2;
+	} else if (last) {
+		p1 = &mPoints[mCount - 2];
+		p2 = &mPoints[mCount - 1];
+		p0 = mCount >= 3 ? &mPoints[mCount - 3] : p1;
+		p3 = p2;
+	} else {
+		p1 = &mPoints[mCount - 3];
+		p2 = &mPoints[mCount - 2];
+		p0 = mCount >= 4 ? &mPoints[mCount - 4] : p1;
+		p3 = &mPoints[mCount - 1];
+	}
+
+	// The ticks of the grid in (p1, p2]
+	const uint64_t first = (p1->timestamp / mPeriod + 1) * mPeriod;
+	if (first > p2->timestamp) {
+		return 0;
+	}
+	const size_t count = (p2->timestamp - first) / mPeriod + 1;
+	const float duration = static_cast<float>(p2->timestamp - p1->timestamp);
+	float u[maxOutput];
+	for (size_t i = 0; i < count; i++) {
+		u[i] = static_cast<float>(first + i * mPeriod - p1->timestamp)
+			/ duration;
+	}
+	HermiteBasis basis;
+	basis.compute(u, count);
+
+	float v0[NumChannels], v1[NumChannels], v2[NumChannels], v3[NumChannels];
+	getChannels(*p0, v0);
+	getChannels(*p1, v1);
+	getChannels(*p2, v2);
+	getChannels(*p3, v3);
+	float values[NumChannels][maxOutput];
+	for (int c = 0; c < NumChannels; c++) {
+		float m1 = v2[c] - v1[c];
+		float m2 = m1;
+		if (mInterpolation == Interpolation::CatmullRom) {
+			// Finite differences over the neighbors, scaled to this segment,
+			// since the real samples are not evenly spaced
+			if (p0 != p1) {
+				m1 = (v2[c] - v0[c]) * duration
+					/ static_cast<float>(p2->timestamp - p0->timestamp);
+			}
+			if (p3 != p2) {
+				m2 = (v3[c] - v1[c]) * duration
+					/ static_cast<float>(p3->timestamp - p1->timestamp);
+			}
+		}
+		basis.evaluate(count, v1[c], v2[c], m1, m2, values[c]);
+	}
+
+	// A spline might overshoot, but not out of the device
+	const bool touching = p1->status & PacketIsTouching;
+	const float maxPressure = static_cast<float>(geometry.maxPressure);
+	for (size_t i = 0; i < count; i++) {
+		Sample &s = output[i];
+		s = *p2;
+		s.timestamp = first + i * mPeriod;
+		s.x = static_cast<uint32_t>(clamp(values[ChannelX][i], 0,
+			static_cast<float>(geometry.maxX)) + 0.5f);
+		s.y = static_cast<uint32_t>(clamp(values[ChannelY][i], 0,
+			static_cast<float>(geometry.maxY)) + 0.5f);
+		s.pressure = static_cast<uint32_t>(clamp(values[ChannelPressure][i],
+			touching ? 1 : 0, maxPressure) + 0.5f);
+		s.tiltX = static_cast<uint32_t>(std::lround(values[ChannelTiltX][i]));
+		s.tiltY = static_cast<uint32_t>(std::lround(values[ChannelTiltY][i]));
+	}
+	mInterpolated += count;
+	return count;
+}
+
+void Upsampler::print(const char *name) const
+{
+	printf("%s: upsampling at %" PRIu64 "µs, %" PRIu64 " real samples, "
+		"%" PRIu64 " interpolated, %" PRIu64 " passed through\n", name,
+		mPeriod, mReal, mInterpolated, mPassedThrough);
+}
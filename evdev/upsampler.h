@@ -0,0 +1,82 @@
+/**
+ * Fixed-rate upsampling for the NetStylus evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+#pragma once
+
+#include <packet_codec.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Resamples the stream of a sender at a fixed rate.
+ *
+ * The output samples lie on a grid of the sender clock, and their values are
+ * interpolated between the real samples around them, either linearly or with a
+ * Catmull-Rom spline (which needs the following sample too, so it adds the
+ * interval of a real sample to the latency).
+ *
+ * Strokes are never interpolated across transitions or long pauses: the first
+ * sample after them is passed through as it is, so touch changes are not
+ * delayed.
+ * Samples without a sender timestamp cannot be placed on the grid, and are
+ * passed through, too.
+ */
+class Upsampler {
+public:
+	enum class Interpolation {
+		Linear,
+		CatmullRom,
+	};
+
+	/// The maximum number of samples returned by push()
+	static const size_t maxOutput = 128;
+
+	/// The highest rate we support, so that a segment fits maxOutput
+	static const unsigned int maxRate = 1000;
+
+	Upsampler(unsigned int rate, Interpolation interpolation);
+
+	/**
+	 * Add a real sample.
+	 *
+	 * \param output An array of maxOutput elements, that receives the samples
+	 *  that are complete now, in order
+	 * \return The number of output samples
+	 */
+	size_t push(const Sample &sample, const Geometry &geometry, Sample *output);
+
+	/// Print the statistics on stdout
+	void print(const char *name) const;
+
+private:
+	/**
+	 * Interpolate the segment between the two newest points (linear), or
+	 * between the second and the third newest (Catmull-Rom).
+	 *
+	 * \param last Whether the newest point ends the stroke
+	 */
+	size_t segment(bool last, const Geometry &geometry, Sample *output);
+
+	uint64_t mPeriod;
+	Interpolation mInterpolation;
+
+	/// The last real samples of the current stroke, the newest last
+	Sample mPoints[4];
+	unsigned int mCount = 0;
+
+	uint64_t mReal = 0;
+	uint64_t mInterpolated = 0;
+	uint64_t mPassedThrough = 0;
+};
@@ -0,0 +1,64 @@
+/**
+ * Checks of the NetStylus tests
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the helpers of the tests.
+ *
+ * Each test is a program on its own: it runs its cases, prints the failed
+ * checks, and exits with 1 if any of them failed.
+ */
+
+#pragma once
+
+#include <cstdio>
+
+/// The number of failed checks of the program
+inline unsigned int &checkFailures()
+{
+	static unsigned int failures = 0;
+	return failures;
+}
+
+inline bool checkResult(bool passed, const char *expression, const char *file,
+	int line)
+{
+	if (!passed) {
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+		checkFailures()++;
+	}
+	return passed;
+}
+
+/// Check a condition, and go on with the test anyway
+#define CHECK(condition) \
+	checkResult(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
+
+/// Run a case, and print its name
+#define RUN_TEST(function) \
+	do { \
+		printf("%s\n", #function); \
+		function(); \
+	} while (0)
+
+/// Print the result of the program, and return its exit code
+inline int testsDone()
+{
+	if (checkFailures()) {
+		printf("%u checks failed\n", checkFailures());
+		return 1;
+	}
+	puts("All checks passed");
+	return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * Tests of the NetStylus estimation of the clock of the server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of ClockSync.
+ *
+ * Each report is built from the time of a sample in our clock, the time it
+ * took in each direction and the offset of the server, so the expected round
+ * trip and offset are known.
+ *
+ * To compile and run:
+ *   g++ -Wall -Wextra -I../common/ clock_sync_test.cpp \
+ *     ../common/clock_sync.cpp -o clock-sync-test && ./clock-sync-test
+ */
+
+#include "check.h"
+
+#include <clock_sync.h>
+
+namespace {
+
+/// A time of our clock far from 0, so that the server can be behind us
+const uint64_t start = 1000000000000;
+
+/// A report and the time it arrives in our clock
+struct Exchange {
+	FeedbackReport report;
+	uint64_t now;
+};
+
+/**
+ * Simulate the exchange of a sample and of its report.
+ *
+ * \param echo The time of the sample, in our clock
+ * \param forward The time to reach the server
+ * \param backward The time of the report to reach us
+ * \param offset The clock of the server minus ours
+ * \param hold The time the server waits before sending the report
+ */
+Exchange exchange(uint64_t echo, uint64_t forward, uint64_t backward,
+	int64_t offset, uint64_t hold = 3000)
+{
+	Exchange e;
+	e.report.complete = true;
+	e.report.echo = echo;
+	e.report.arrival = static_cast<uint64_t>(
+		static_cast<int64_t>(echo + forward) + offset);
+	e.report.sent = e.report.arrival + hold;
+	e.now = echo + forward + hold + backward;
+	return e;
+}
+
+bool add(ClockSync &sync, const Exchange &e)
+{
+	return sync.add(e.report, e.now);
+}
+
+/// Symmetric directions give the exact offset, whatever its sign
+void testOffset()
+{
+	const int64_t offsets[] = {0, 123456789, -987654321, 5, -5};
+	for (int64_t offset : offsets) {
+		ClockSync sync;
+		CHECK(!sync.valid());
+		const Exchange e = exchange(start, 4000, 4000, offset);
+		CHECK(add(sync, e));
+		CHECK(sync.valid());
+		CHECK(sync.roundTrip() == 8000);
+		CHECK(sync.offset() == offset);
+		CHECK(sync.oneWay(e.report) == 4000);
+	}
+
+	// The clock of the server is near its start, ours is not
+	ClockSync behind;
+	const int64_t offset = 1000 - static_cast<int64_t>(start);
+	CHECK(add(behind, exchange(start, 2500, 2500, offset)));
+	CHECK(behind.offset() == offset);
+	CHECK(behind.roundTrip() == 5000);
+}
+
+/// Asymmetric directions move the offset by half their difference
+void testAsymmetry()
+{
+	ClockSync sync;
+	const Exchange e = exchange(start, 9000, 1000, 50000);
+	CHECK(add(sync, e));
+	CHECK(sync.roundTrip() == 10000);
+	CHECK(sync.offset() == 50000 + 4000);
+	CHECK(sync.oneWay(e.report) == 5000);
+
+	ClockSync reverse;
+	CHECK(add(reverse, exchange(start, 1000, 9000, -50000)));
+	CHECK(reverse.offset() == -50000 - 4000);
+}
+
+/// The measure with the shortest round trip wins over the queued ones
+void testMinimum()
+{
+	ClockSync sync;
+	const int64_t offset = -300000;
+	uint64_t echo = start;
+	CHECK(add(sync, exchange(echo, 20000, 2000, offset)));
+	CHECK(sync.offset() == offset + 9000);
+
+	echo += 10000;
+	CHECK(add(sync, exchange(echo, 3000, 3000, offset)));
+	CHECK(sync.offset() == offset);
+
+	// Longer round trips do not change the estimate
+	for (uint64_t queue = 1000; queue <= 5000; queue += 1000) {
+		echo += 10000;
+		CHECK(add(sync, exchange(echo, 3000 + queue, 3000, offset)));
+		CHECK(sync.offset() == offset);
+		CHECK(sync.roundTrip() == 6000 + queue);
+	}
+	echo += 10000;
+	CHECK(add(sync, exchange(echo, 3000, 7000, offset)));
+	CHECK(sync.offset() == offset);
+
+	// A shorter one replaces it
+	echo += 10000;
+	CHECK(add(sync, exchange(echo, 2000, 2200, offset)));
+	CHECK(sync.offset() == offset - 100);
+	CHECK(sync.roundTrip() == 4200);
+}
+
+/// The best measure is forgotten after a window of newer ones
+void testStale()
+{
+	ClockSync sync;
+	uint64_t echo = start;
+	CHECK(add(sync, exchange(echo, 1000, 1000, 0)));
+
+	// The clock of the server drifted, and the network got slower
+	const int64_t offset = 20000;
+	for (unsigned int i = 1; i < ClockSync::windowSize; i++) {
+		echo += 10000;
+		CHECK(add(sync, exchange(echo, 5000 + i, 5000 + i, offset)));
+		CHECK(sync.offset() == 0);
+	}
+	echo += 10000;
+	CHECK(add(sync, exchange(echo, 6000, 6000, offset)));
+	CHECK(sync.offset() == offset);
+	CHECK(sync.roundTrip() == 12000);
+}
+
+/// Inconsistent reports do not change the estimate
+void testRejected()
+{
+	ClockSync sync;
+	const int64_t offset = -70000;
+	CHECK(add(sync, exchange(start, 2000, 2000, offset)));
+
+	Exchange e = exchange(start, 100, 100, 9999);
+	e.report.complete = false;
+	CHECK(!add(sync, e));
+
+	e = exchange(start, 100, 100, 9999);
+	e.report.echo = 0;
+	CHECK(!add(sync, e));
+
+	// The report arrives before its sample was taken
+	e = exchange(start, 100, 100, 9999);
+	e.now = start - 1;
+	CHECK(!add(sync, e));
+
+	// The report is sent before the sample arrives
+	e = exchange(start, 100, 100, 9999);
+	e.report.sent = e.report.arrival - 1;
+	CHECK(!add(sync, e));
+
+	// A round trip of zero, then the server held the report longer than the
+	// whole exchange
+	e = exchange(start, 0, 0, 9999);
+	CHECK(!add(sync, e));
+	e.now--;
+	CHECK(!add(sync, e));
+	CHECK(sync.offset() == offset);
+	CHECK(add(sync, exchange(start, 1, 1, 9999)));
+	CHECK(sync.roundTrip() == 2);
+	CHECK(sync.offset() == 9999);
+
+	// The shortest round trip is still the one of 2µs
+	CHECK(add(sync, exchange(start + 10000, 2000, 2000, offset)));
+	CHECK(sync.offset() == 9999);
+
+	ClockSync empty;
+	CHECK(!add(empty, exchange(start, 0, 0, offset)));
+	CHECK(!empty.valid());
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testOffset);
+	RUN_TEST(testAsymmetry);
+	RUN_TEST(testMinimum);
+	RUN_TEST(testStale);
+	RUN_TEST(testRejected);
+	return testsDone();
+}
@@ -0,0 +1,471 @@
+/**
+ * Tests of the NetStylus packet codecs
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of the version 1 and 2 codecs.
+ *
+ * The streams go through a simulated link, that drops the datagrams chosen by
+ * the test.
+ *
+ * To compile and run:
+ *   g++ -Wall -Wextra -I../common/ packet_codec_test.cpp \
+ *     ../common/packet_codec.cpp -o packet-codec-test && ./packet-codec-test
+ */
+
+#include "check.h"
+
+#include <packet_codec.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+const Geometry testGeometry = {30000, 20000, 4096};
+
+/// Compare the values of two samples, not how they were received
+bool sameValues(const Sample &a, const Sample &b)
+{
+	return a.seqNumber == b.seqNumber && a.status == b.status
+		&& a.x == b.x && a.y == b.y && a.pressure == b.pressure
+		&& a.tiltX == b.tiltX && a.tiltY == b.tiltY
+		&& a.timestamp == b.timestamp;
+}
+
+/// A stroke with all the values, that touches the surface for a while
+std::vector<Sample> makeStream(size_t count)
+{
+	std::vector<Sample> stream(count);
+	for (size_t i = 0; i < count; i++) {
+		Sample &s = stream[i];
+		s.seqNumber = i + 1;
+		s.status = PacketHasPressure | PacketHasTiltX | PacketHasTiltY;
+		if (i % 100 >= 20 && i % 100 < 80) {
+			s.status |= PacketIsTouching;
+			s.pressure = static_cast<uint32_t>(100 + i % 1000);
+		}
+		s.x = static_cast<uint32_t>(10000 + (i * 37) % 5000);
+		s.y = static_cast<uint32_t>(8000 + (i * 53) % 3000);
+		s.tiltX = static_cast<uint32_t>(static_cast<int32_t>(i % 60) - 30);
+		s.tiltY = static_cast<uint32_t>(static_cast<int32_t>(i % 40) - 20);
+		s.timestamp = 1000000 + i * 4167;
+	}
+	return stream;
+}
+
+/// Tells whether the datagram with this index is lost
+using Link = std::function<bool(size_t datagram)>;
+
+/// What arrived at the receiver
+struct Received {
+	/// The samples by sequence number, the first copy that arrived
+	std::map<uint64_t, Sample> samples;
+	/// The samples of the datagrams that the link dropped
+	size_t dropped = 0;
+	size_t datagrams = 0;
+	PacketDecoder::Stats stats;
+};
+
+/// Encode a stream in batches, and decode what the link lets through
+Received transmit(const std::vector<Sample> &stream, size_t batch,
+	unsigned int redundancy, const Link &lost)
+{
+	PacketEncoder encoder;
+	encoder.redundancy = redundancy;
+	PacketDecoder decoder;
+	Received received;
+
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+	for (size_t i = 0; i < stream.size(); ) {
+		size_t count = std::min(batch, stream.size() - i);
+		const size_t size = encoder.encode(&stream[i], count, testGeometry,
+			buffer, sizeof(buffer));
+		if (!CHECK(size && count)) {
+			break;
+		}
+
+		if (lost(received.datagrams++)) {
+			received.dropped += count;
+		} else {
+			Sample samples[PacketDecoder::maxSamples];
+			const size_t decoded = decoder.decode(buffer, size, samples);
+			for (size_t j = 0; j < decoded; j++) {
+				received.samples.emplace(samples[j].seqNumber, samples[j]);
+			}
+		}
+		i += count;
+	}
+	received.stats = decoder.stats();
+	return received;
+}
+
+/// Check that every sample that arrived has the values that were sent
+bool allCorrect(const std::vector<Sample> &stream, const Received &received)
+{
+	for (const auto &entry : received.samples) {
+		if (entry.first < 1 || entry.first > stream.size()
+				|| !sameValues(entry.second, stream[entry.first - 1])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Every sample and the geometry survive the encoding, with copies and acks
+void testRoundTrip()
+{
+	const std::vector<Sample> stream = makeStream(1000);
+	const Geometry otherGeometry = {15000, 10000, 1024};
+	PacketEncoder encoder;
+	encoder.redundancy = 3;
+	PacketDecoder decoder;
+	std::map<uint64_t, Sample> primary;
+	size_t copies = 0, acks = 0;
+
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+	for (size_t i = 0; i < stream.size(); ) {
+		// The sender moves to another screen halfway
+		const Geometry &geometry = i < stream.size() / 2 ? testGeometry
+			: otherGeometry;
+		size_t count = std::min<size_t>(7, stream.size() - i);
+		if (i == 70) {
+			encoder.sendClockOffset = true;
+			encoder.clockOffset = -123456789;
+		}
+		const size_t size = encoder.encode(&stream[i], count, geometry, buffer,
+			sizeof(buffer));
+		if (!CHECK(size && count)) {
+			break;
+		}
+		CHECK(packetVersion(buffer, size) == 2);
+		acks += ackRequested(buffer, size);
+
+		Sample samples[PacketDecoder::maxSamples];
+		const size_t decoded = decoder.decode(buffer, size, samples);
+		CHECK(decoded >= count);
+		for (size_t j = 0; j < decoded; j++) {
+			const Sample &s = samples[j];
+			CHECK(s.seqNumber >= 1 && s.seqNumber <= stream.size()
+				&& sameValues(s, stream[s.seqNumber - 1]));
+			if (s.redundant) {
+				CHECK(s.seqNumber < stream[i].seqNumber);
+				copies++;
+			} else {
+				CHECK(primary.emplace(s.seqNumber, s).second);
+			}
+		}
+		CHECK(decoder.geometry() == geometry);
+		i += count;
+	}
+
+	CHECK(primary.size() == stream.size());
+	CHECK(copies > 0);
+	// Touches and lifts ask for an acknowledgment
+	CHECK(acks > 0);
+	CHECK(decoder.hasClockOffset() && decoder.clockOffset() == -123456789);
+	CHECK(decoder.stats().malformed == 0);
+	CHECK(decoder.stats().missingKeyframe == 0);
+	CHECK(decoder.stats().missingGeometry == 0);
+}
+
+/// The version 1 packets are still understood, and told apart from the others
+void testVersion1()
+{
+	Sample sample;
+	sample.seqNumber = 0x123456789;
+	sample.status = PacketIsTouching | PacketHasPressure | PacketHasTiltX;
+	sample.pressure = 2000;
+	sample.x = 12345;
+	sample.y = 6789;
+	sample.tiltX = static_cast<uint32_t>(-40);
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+	CHECK(encodePacketV1(sample, testGeometry, buffer, PacketV1Size - 1) == 0);
+	const size_t size = encodePacketV1(sample, testGeometry, buffer,
+		sizeof(buffer));
+	CHECK(size == PacketV1Size);
+	CHECK(packetVersion(buffer, size) == 1);
+
+	Sample decoded;
+	Geometry geometry;
+	CHECK(decodePacketV1(buffer, size, decoded, geometry));
+	CHECK(sameValues(decoded, sample));
+	CHECK(geometry == testGeometry);
+	// The padding is optional
+	CHECK(decodePacketV1(buffer, PacketV1End, decoded, geometry));
+	CHECK(!decodePacketV1(buffer, PacketV1End - 1, decoded, geometry));
+	CHECK(packetVersion(buffer, PacketV1End - 1) == 0);
+
+	buffer[5] ^= 1;
+	CHECK(packetVersion(buffer, size) == 0);
+	CHECK(packetVersion(buffer, 0) == 0);
+}
+
+/// Acknowledgments and reports, that the server sends
+void testFeedback()
+{
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+	uint64_t seqNumber = 0;
+	size_t size = encodeAck(1234567, buffer, sizeof(buffer));
+	CHECK(size > 0);
+	CHECK(decodeAck(buffer, size, seqNumber) && seqNumber == 1234567);
+	FeedbackReport report;
+	report.complete = true;
+	CHECK(decodeReport(buffer, size, report) && !report.complete);
+	CHECK(encodeAck(1234567, buffer, 4) == 0);
+
+	FeedbackReport sent;
+	sent.highestSeq = 5000;
+	sent.received = 4990;
+	sent.lost = 10;
+	sent.echo = 987654321;
+	sent.arrival = 123456789;
+	sent.sent = 123456999;
+	size = encodeReport(sent, buffer, sizeof(buffer));
+	CHECK(size > 0);
+	CHECK(decodeReport(buffer, size, report) && report.complete);
+	CHECK(report.highestSeq == sent.highestSeq
+		&& report.received == sent.received && report.lost == sent.lost
+		&& report.echo == sent.echo && report.arrival == sent.arrival
+		&& report.sent == sent.sent);
+	// A truncated report is still an acknowledgment
+	CHECK(decodeReport(buffer, size - 1, report) && !report.complete);
+	CHECK(decodeAck(buffer, size, seqNumber) && seqNumber == 5000);
+
+	// The samples are not acknowledgments
+	const std::vector<Sample> stream = makeStream(4);
+	PacketEncoder encoder;
+	size_t count = stream.size();
+	size = encoder.encode(stream.data(), count, testGeometry, buffer,
+		sizeof(buffer));
+	CHECK(!decodeAck(buffer, size, seqNumber));
+}
+
+/// Broken packets are counted and never read beyond their end
+void testMalformed()
+{
+	const std::vector<Sample> stream = makeStream(40);
+	PacketEncoder encoder;
+	encoder.redundancy = 4;
+	// The first packet carries the geometry, the second one is truncated
+	uint8_t first[PacketEncoder::maxPacketSize];
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+	size_t count = 20;
+	const size_t firstSize = encoder.encode(stream.data(), count, testGeometry,
+		first, sizeof(first));
+	count = 20;
+	const size_t size = encoder.encode(&stream[20], count, testGeometry,
+		buffer, sizeof(buffer));
+	CHECK(count == 20);
+
+	Sample samples[PacketDecoder::maxSamples];
+	{
+		PacketDecoder decoder;
+		CHECK(decoder.decode(first, firstSize, samples) == 20);
+		CHECK(decoder.decode(buffer, size, samples) == 24);
+	}
+
+	// Every truncation loses samples, or it is counted as malformed
+	for (size_t length = 0; length < size; length++) {
+		PacketDecoder decoder;
+		decoder.decode(first, firstSize, samples);
+		const size_t decoded = decoder.decode(buffer, length, samples);
+		CHECK(decoded < 24 || decoder.stats().malformed > 0);
+		for (size_t j = 0; j < decoded; j++) {
+			CHECK(sameValues(samples[j], stream[samples[j].seqNumber - 1]));
+		}
+	}
+
+	const uint8_t header[] = {'N', 'S', PACKET_V2_VERSION};
+	const struct {
+		const char *name;
+		std::vector<uint8_t> body; ///< Flags, then the fields
+	} broken[] = {
+		{"no samples", {0, 1, 0}},
+		{"too many samples", {0, 1, PacketEncoder::maxSamples + 1}},
+		{"no count", {0, 1}},
+		{"too many copies", {PacketV2Redundant, 20, 1,
+			PacketEncoder::maxRedundancy + 1}},
+		{"copies before the first sample", {PacketV2Redundant, 1, 1, 2}},
+		{"truncated varint", {0, 0x80}},
+	};
+	for (const auto &b : broken) {
+		std::vector<uint8_t> packet(header, header + sizeof(header));
+		packet.insert(packet.end(), b.body.begin(), b.body.end());
+		PacketDecoder decoder;
+		if (!CHECK(decoder.decode(packet.data(), packet.size(), samples) == 0
+				&& decoder.stats().malformed == 1)) {
+			fprintf(stderr, "  %s\n", b.name);
+		}
+	}
+
+	// The server does not accept acknowledgments
+	PacketDecoder decoder;
+	const size_t ackSize = encodeAck(10, buffer, sizeof(buffer));
+	CHECK(decoder.decode(buffer, ackSize, samples) == 0);
+	CHECK(decoder.stats().malformed == 1);
+
+	// Random data must not crash the decoder
+	std::mt19937 random(6);
+	for (int i = 0; i < 10000; i++) {
+		uint8_t garbage[64];
+		for (uint8_t &byte : garbage) {
+			byte = static_cast<uint8_t>(random());
+		}
+		memcpy(garbage, header, 3);
+		const size_t length = random() % sizeof(garbage);
+		CHECK(decoder.decode(garbage, length, samples)
+			<= PacketDecoder::maxSamples);
+	}
+}
+
+/**
+ * Losing a datagram loses only its samples.
+ *
+ * Deltas used to refer to the last keyframe, sent every 16 samples, so losing
+ * the datagram with a keyframe made the following deltas undecodable.
+ */
+void testKeyframeLoss()
+{
+	const std::vector<Sample> stream = makeStream(2000);
+	for (size_t batch : {1, 4, 16}) {
+		// Every fifth datagram, and so also many keyframes
+		const Received received = transmit(stream, batch, 0,
+			[](size_t datagram) { return datagram % 5 == 2; });
+		CHECK(received.dropped > 0);
+		CHECK(received.samples.size() + received.dropped == stream.size());
+		CHECK(received.stats.missingKeyframe == 0);
+		CHECK(allCorrect(stream, received));
+	}
+
+	// 5% random loss must not lose more samples than the link dropped
+	std::mt19937 random(5);
+	std::bernoulli_distribution drop(0.05);
+	const Received received = transmit(stream, 4, 0,
+		[&](size_t) { return drop(random); });
+	CHECK(received.samples.size() + received.dropped == stream.size());
+	CHECK(received.stats.missingKeyframe == 0);
+	CHECK(allCorrect(stream, received));
+}
+
+/// The redundant copies fill the gaps of the datagrams that were lost
+void testRedundancy()
+{
+	const std::vector<Sample> stream = makeStream(2000);
+	const struct {
+		size_t batch;
+		unsigned int redundancy;
+	} cases[] = {{1, 2}, {4, 4}, {8, 8}};
+	for (const auto &c : cases) {
+		// Isolated losses, after the first datagram
+		const Received received = transmit(stream, c.batch, c.redundancy,
+			[](size_t datagram) { return datagram % 3 == 1; });
+		CHECK(received.dropped > 0);
+		// Nothing can repeat the samples of the last datagram
+		CHECK(!received.samples.empty()
+			&& received.samples.size() == received.samples.rbegin()->first);
+		CHECK(received.samples.size() + c.batch >= stream.size());
+		CHECK(received.stats.missingKeyframe == 0);
+		CHECK(allCorrect(stream, received));
+	}
+}
+
+/// A delta on a keyframe outside its packet, even a copy, is not decoded
+void testDeltaOutsidePacket()
+{
+	PacketEncoder encoder;
+	PacketDecoder decoder;
+	Sample samples[PacketDecoder::maxSamples];
+	uint8_t buffer[PacketEncoder::maxPacketSize];
+
+	// A first packet, for the geometry, whose keyframe is sample 10
+	Sample first = {};
+	first.seqNumber = 10;
+	size_t count = 1;
+	const size_t size = encoder.encode(&first, count, testGeometry, buffer,
+		sizeof(buffer));
+	CHECK(decoder.decode(buffer, size, samples) == 1);
+
+	// Sample 11 is a delta on sample 10, that is only a copy here
+	const uint8_t withCopy[] = {
+		'N', 'S', PACKET_V2_VERSION,
+		PacketV2Redundant,
+		11, // First sequence number
+		1, // Count
+		1, // Copies
+		0, 0, 100, 50, // Copy: time, status, x and y
+		0, 0, // Delta: flags and time
+		1, PacketV2DeltaX, 10, // Distance, mask and zigzag of 5
+	};
+	CHECK(decoder.decode(withCopy, sizeof(withCopy), samples) == 1);
+	CHECK(samples[0].seqNumber == 10 && samples[0].redundant);
+	CHECK(decoder.stats().missingKeyframe == 1);
+
+	// Sample 12 is a delta on the keyframe of the first packet
+	const uint8_t withoutCopy[] = {
+		'N', 'S', PACKET_V2_VERSION,
+		0,
+		12, // First sequence number
+		1, // Count
+		0, 0, // Delta: flags and time
+		2, PacketV2DeltaX, 10, // Distance, mask and zigzag of 5
+	};
+	CHECK(decoder.decode(withoutCopy, sizeof(withoutCopy), samples) == 0);
+	CHECK(decoder.stats().missingKeyframe == 2);
+	CHECK(decoder.stats().malformed == 0);
+}
+
+/// A late datagram is decoded even after a newer keyframe
+void testReordering()
+{
+	const std::vector<Sample> stream = makeStream(40);
+	PacketEncoder encoder;
+	PacketDecoder decoder;
+	uint8_t first[PacketEncoder::maxPacketSize];
+	uint8_t second[PacketEncoder::maxPacketSize];
+	size_t count = 8;
+	const size_t firstSize = encoder.encode(&stream[0], count, testGeometry,
+		first, sizeof(first));
+	CHECK(count == 8);
+	const size_t secondSize = encoder.encode(&stream[8], count, testGeometry,
+		second, sizeof(second));
+	CHECK(count == 8);
+
+	Sample samples[PacketDecoder::maxSamples];
+	CHECK(decoder.decode(second, secondSize, samples) == 8);
+	CHECK(decoder.decode(first, firstSize, samples) == 8);
+	for (size_t i = 0; i < 8; i++) {
+		CHECK(sameValues(samples[i], stream[i]));
+	}
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testRoundTrip);
+	RUN_TEST(testVersion1);
+	RUN_TEST(testFeedback);
+	RUN_TEST(testMalformed);
+	RUN_TEST(testKeyframeLoss);
+	RUN_TEST(testRedundancy);
+	RUN_TEST(testDeltaOutsidePacket);
+	RUN_TEST(testReordering);
+	return testsDone();
+}
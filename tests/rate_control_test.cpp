@@ -0,0 +1,346 @@
+/**
+ * Tests of the NetStylus adaptation of the send rate
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of RateController.
+ *
+ * A pen draws on a simulated link, in simulated time: the link drops packets
+ * and acknowledgments with a given probability, and delays the others by the
+ * round trip. The server can also send reports, like the evdev one.
+ *
+ * To compile and run:
+ *   g++ -Wall -Wextra -I../common/ rate_control_test.cpp \
+ *     ../common/rate_control.cpp \
+ *     -o rate-control-test && ./rate-control-test
+ */
+
+#include "check.h"
+
+#include <rate_control.h>
+
+#include <cmath>
+#include <map>
+#include <random>
+
+namespace {
+
+/// The time between two samples, at 240Hz, in µs
+const uint64_t sampleInterval = 4167;
+
+/// The samples of a packet
+const size_t batch = 4;
+
+/// The time between two reports of the server, in µs
+const uint64_t reportInterval = 100000;
+
+/// The state of the link for a phase of the simulation
+struct Link {
+	double loss = 0;
+	/// The round trip, in µs
+	uint64_t roundTrip = 20000;
+	bool reports = false;
+};
+
+/// What happened to the samples that decimate dropped
+struct Decimation {
+	uint64_t touching = 0; ///< Dropped samples that touched the surface
+	uint64_t transitions = 0; ///< Dropped samples that changed the status
+	uint64_t beyondTolerance = 0; ///< Dropped too far from the kept one
+};
+
+/**
+ * A pen and a server, connected by the simulated link.
+ *
+ * The pen alternates strokes and hover, and the server acknowledges the
+ * probes and counts the losses from the sequence numbers.
+ */
+class Simulation {
+public:
+	explicit Simulation(unsigned int seed) : mRandom(seed)
+	{
+	}
+
+	/**
+	 * Run the simulation for some time.
+	 *
+	 * \param duration In µs
+	 * \return The highest level during the phase
+	 */
+	unsigned int run(const Link &link, uint64_t duration)
+	{
+		unsigned int highest = mRate.level();
+		for (const uint64_t end = mNow + duration; mNow < end; ) {
+			Sample samples[batch];
+			for (size_t i = 0; i < batch; i++) {
+				samples[i] = nextSample();
+				mNow += sampleInterval;
+			}
+			deliver();
+			mRate.update(mNow);
+
+			const unsigned int tolerance = mRate.tolerance();
+			Sample sent[batch];
+			std::copy(samples, samples + batch, sent);
+			const size_t count = mRate.decimate(sent, batch);
+			check(samples, sent, count, tolerance);
+			// Like the client, number only the samples that are sent, so the
+			// server does not count the decimated ones as lost
+			for (size_t i = 0; i < count; i++) {
+				sent[i].seqNumber = ++mSeqNumber;
+			}
+			if (count) {
+				send(link, sent, count);
+			}
+			if (link.reports && mNow - mLastReport >= reportInterval) {
+				report(link);
+			}
+			highest = std::max(highest, mRate.level());
+		}
+		return highest;
+	}
+
+	const RateController &rate() const
+	{
+		return mRate;
+	}
+
+	const Decimation &decimation() const
+	{
+		return mDecimation;
+	}
+
+private:
+	/// A stroke every second, and hover in a circle between them
+	Sample nextSample()
+	{
+		Sample s;
+		s.timestamp = mNow;
+		s.status = PacketHasPressure;
+		const double t = mNow * 1e-6;
+		const bool touching = std::fmod(t, 1.0) < 0.4;
+		if (touching) {
+			s.status |= PacketIsTouching;
+			s.pressure = 2000;
+		}
+		// About 30 mm/s, so consecutive samples are 1.25 units apart
+		s.x = static_cast<uint32_t>(std::lround(20000 + 3000 * std::cos(t)));
+		s.y = static_cast<uint32_t>(std::lround(15000 + 3000 * std::sin(t)));
+		return s;
+	}
+
+	/// Check the samples that decimate dropped
+	void check(const Sample *samples, const Sample *sent, size_t count,
+		unsigned int tolerance)
+	{
+		size_t j = 0;
+		for (size_t i = 0; i < batch; i++) {
+			const Sample &s = samples[i];
+			if (j < count && sent[j].timestamp == s.timestamp) {
+				mHasKept = true;
+				mKept = s;
+				mLastStatus = s.status;
+				j++;
+				continue;
+			}
+			mDecimation.touching += (s.status & PacketIsTouching) != 0;
+			mDecimation.transitions += s.status != mLastStatus;
+			const double distance = std::hypot(double(s.x) - mKept.x,
+				double(s.y) - mKept.y);
+			mDecimation.beyondTolerance += !mHasKept || distance > tolerance;
+			mLastStatus = s.status;
+		}
+	}
+
+	void send(const Link &link, const Sample *samples, size_t count)
+	{
+		const uint64_t last = samples[count - 1].seqNumber;
+		const bool probe = mRate.probeDue(mNow);
+		if (probe) {
+			mRate.probeSent(last, mNow);
+		}
+		if (lost(link)) {
+			return;
+		}
+
+		// The server counts the gaps, like SequenceTracker
+		if (mHighest) {
+			mLost += samples[0].seqNumber - mHighest - 1;
+		}
+		mReceived += count;
+		mHighest = last;
+		if (probe && !lost(link)) {
+			mAcks.emplace(mNow + link.roundTrip, last);
+		}
+	}
+
+	void report(const Link &link)
+	{
+		mLastReport = mNow;
+		if (!mHighest || lost(link)) {
+			return;
+		}
+		FeedbackReport report;
+		report.complete = true;
+		report.highestSeq = mHighest;
+		report.received = mReceived;
+		report.lost = mLost;
+		mReports.emplace(mNow + link.roundTrip / 2, report);
+	}
+
+	/// Pass the acknowledgments and the reports that have arrived
+	void deliver()
+	{
+		while (!mAcks.empty() && mAcks.begin()->first <= mNow) {
+			mRate.acknowledged(mAcks.begin()->second, mAcks.begin()->first);
+			mAcks.erase(mAcks.begin());
+		}
+		while (!mReports.empty() && mReports.begin()->first <= mNow) {
+			mRate.reported(mReports.begin()->second, mReports.begin()->first);
+			mReports.erase(mReports.begin());
+		}
+	}
+
+	bool lost(const Link &link)
+	{
+		return std::bernoulli_distribution(link.loss)(mRandom);
+	}
+
+	RateController mRate;
+	std::mt19937 mRandom;
+	uint64_t mNow = 1000000;
+	uint64_t mSeqNumber = 0;
+
+	/// The acknowledgments and the reports on their way, by arrival time
+	std::multimap<uint64_t, uint64_t> mAcks;
+	std::multimap<uint64_t, FeedbackReport> mReports;
+	uint64_t mLastReport = 0;
+
+	/// The counters of the server
+	uint64_t mHighest = 0;
+	uint64_t mReceived = 0;
+	uint64_t mLost = 0;
+
+	/// The last sample that decimate kept
+	bool mHasKept = false;
+	Sample mKept;
+	uint16_t mLastStatus = 0;
+	Decimation mDecimation;
+};
+
+/// The decimation never drops ink or transitions, and respects the tolerance
+bool decimationSafe(const Simulation &simulation)
+{
+	const Decimation &d = simulation.decimation();
+	return !d.touching && !d.transitions && !d.beyondTolerance;
+}
+
+/// A clean link never thins the samples
+void testCleanLink()
+{
+	for (bool reports : {false, true}) {
+		Simulation simulation(1);
+		Link link;
+		link.reports = reports;
+		CHECK(simulation.run(link, 20000000) == 0);
+		CHECK(simulation.rate().stats().decimated == 0);
+		CHECK(simulation.rate().stats().lostProbes == 0);
+		CHECK(simulation.rate().loss() == 0);
+		CHECK(std::llabs(static_cast<long long>(
+			simulation.rate().roundTrip()) - 20000) <= 1);
+	}
+}
+
+/// Losses raise the level, and it goes back to 0 when they stop
+void testLoss()
+{
+	for (bool reports : {false, true}) {
+		Simulation simulation(2);
+		Link link;
+		link.reports = reports;
+		simulation.run(link, 2000000);
+
+		link.loss = 0.3;
+		const unsigned int highest = simulation.run(link, 10000000);
+		CHECK(highest > 0);
+		CHECK(simulation.rate().loss() > 0.1);
+		CHECK(simulation.rate().stats().decimated > 0);
+		CHECK(decimationSafe(simulation));
+
+		// Each level takes a second of clean link to go away
+		link.loss = 0;
+		simulation.run(link, (RateController::maxLevel + 5) * 1000000);
+		CHECK(simulation.rate().level() == 0);
+		CHECK(simulation.rate().loss() < 0.1);
+		const uint64_t decimated = simulation.rate().stats().decimated;
+		simulation.run(link, 2000000);
+		CHECK(simulation.rate().stats().decimated == decimated);
+	}
+}
+
+/// A few losses are not congestion
+void testLightLoss()
+{
+	Simulation simulation(3);
+	Link link;
+	link.reports = true;
+	link.loss = 0.01;
+	CHECK(simulation.run(link, 20000000) == 0);
+	CHECK(simulation.rate().stats().decimated == 0);
+}
+
+/// A round trip that grows means that the packets queue somewhere
+void testQueueing()
+{
+	Simulation simulation(4);
+	Link link;
+	simulation.run(link, 2000000);
+	CHECK(simulation.rate().level() == 0);
+
+	link.roundTrip = 150000;
+	CHECK(simulation.run(link, 5000000) > 0);
+	CHECK(decimationSafe(simulation));
+}
+
+/// The level rises one step at a time, and it stops at maxLevel
+void testMaxLevel()
+{
+	Simulation simulation(5);
+	Link link;
+	link.loss = 0.9;
+	unsigned int previous = 0;
+	bool steps = true;
+	for (int i = 0; i < 200; i++) {
+		const unsigned int level = simulation.run(link, 100000);
+		steps &= level <= previous + 1;
+		previous = simulation.rate().level();
+	}
+	CHECK(steps);
+	CHECK(simulation.rate().level() == RateController::maxLevel);
+	CHECK(simulation.rate().tolerance() == RateController::baseTolerance
+		<< (RateController::maxLevel - 1));
+	CHECK(decimationSafe(simulation));
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testCleanLink);
+	RUN_TEST(testLoss);
+	RUN_TEST(testLightLoss);
+	RUN_TEST(testQueueing);
+	RUN_TEST(testMaxLevel);
+	return testsDone();
+}
@@ -0,0 +1,221 @@
+/**
+ * Tests of the NetStylus recording files of the evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of Recorder and Recording.
+ *
+ * The contents of each datagram are derived from its index, so the replay can
+ * tell whether it read the records that were written.
+ *
+ * To compile and run:
+ *   g++ -Wall -Wextra -I../common/ -I../evdev/ recording_test.cpp \
+ *     ../evdev/recording.cpp -o recording-test && ./recording-test
+ */
+
+#include "check.h"
+
+#include <recording.h>
+
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+/// A recording in a temporary directory, removed at the end of the test
+class TemporaryFile {
+public:
+	TemporaryFile()
+	{
+		char dir[] = "/tmp/netstylus-recording-XXXXXX";
+		if (mkdtemp(dir)) {
+			mDir = dir;
+			mPath = mDir + "/test.nsrec";
+		}
+	}
+
+	~TemporaryFile()
+	{
+		if (!mDir.empty()) {
+			unlink(mPath.c_str());
+			rmdir(mDir.c_str());
+		}
+	}
+
+	const char *path() const
+	{
+		return mPath.c_str();
+	}
+
+	off_t size() const
+	{
+		struct stat st;
+		return stat(mPath.c_str(), &st) ? -1 : st.st_size;
+	}
+
+private:
+	std::string mDir;
+	std::string mPath;
+};
+
+/// The length of the datagram of an index, from 1 to 60 bytes
+size_t datagramLength(unsigned int index)
+{
+	return 1 + index * 7 % 60;
+}
+
+void makeDatagram(unsigned int index, uint8_t *data)
+{
+	for (size_t i = 0; i < datagramLength(index); i++) {
+		data[i] = static_cast<uint8_t>(index + i);
+	}
+}
+
+/// The size of the records of the indices [first, last)
+off_t recordsSize(unsigned int first, unsigned int last)
+{
+	off_t size = 0;
+	for (unsigned int i = first; i < last; i++) {
+		size += static_cast<off_t>(RECORD_HEADER_SIZE + datagramLength(i));
+	}
+	return size;
+}
+
+sockaddr_in makePeer(unsigned int index)
+{
+	sockaddr_in peer = {};
+	peer.sin_family = AF_INET;
+	peer.sin_addr.s_addr = htonl(0x0a000001 + index % 3);
+	peer.sin_port = htons(static_cast<uint16_t>(5000 + index % 5));
+	return peer;
+}
+
+/// Append the datagrams of the indices [first, last) in a run of the server
+bool record(const char *path, unsigned int first, unsigned int last)
+{
+	Recorder recorder;
+	if (!recorder.open(path)) {
+		return false;
+	}
+	uint8_t data[64];
+	for (unsigned int i = first; i < last; i++) {
+		makeDatagram(i, data);
+		recorder.append(1000000 + i * 4167, makePeer(i), data,
+			datagramLength(i));
+	}
+	recorder.flush();
+	return recorder.isOpen() && recorder.count() == last - first;
+}
+
+/**
+ * Replay a recording, and check that it has the expected indices.
+ *
+ * \param skipped An index that is expected to be missing, or -1
+ */
+bool replay(const char *path, unsigned int count, int skipped = -1)
+{
+	Recording recording;
+	if (!recording.open(path)) {
+		return false;
+	}
+	Recording::Record record;
+	unsigned int index = 0;
+	bool intact = true;
+	while (recording.peek(record)) {
+		if (static_cast<int>(index) == skipped) {
+			index++;
+		}
+		uint8_t expected[64];
+		makeDatagram(index, expected);
+		const sockaddr_in peer = makePeer(index);
+		intact &= record.arrival == 1000000 + index * 4167
+			&& record.peer.sin_addr.s_addr == peer.sin_addr.s_addr
+			&& record.peer.sin_port == peer.sin_port
+			&& record.length == datagramLength(index)
+			&& !memcmp(record.data, expected, record.length);
+		recording.advance(record);
+		index++;
+	}
+	return intact && index == count;
+}
+
+/// The records of several runs of the server follow each other
+void testAppend()
+{
+	TemporaryFile file;
+	CHECK(record(file.path(), 0, 10));
+	const off_t size = file.size();
+	CHECK(record(file.path(), 10, 25));
+	CHECK(file.size() > size);
+	CHECK(replay(file.path(), 25));
+}
+
+/// A run that crashed in the middle of a record does not hide the next runs
+void testTruncatedRecord()
+{
+	// Cut in the datagram of the last record, and in its header
+	for (off_t cut : {off_t(3), off_t(RECORD_HEADER_SIZE + 1)}) {
+		TemporaryFile file;
+		CHECK(record(file.path(), 0, 10));
+		const off_t complete = file.size();
+		CHECK(truncate(file.path(), complete - cut) == 0);
+		// The last record is lost, the previous ones remain
+		CHECK(replay(file.path(), 9));
+
+		CHECK(record(file.path(), 10, 20));
+		CHECK(replay(file.path(), 20, 9));
+		CHECK(file.size() == static_cast<off_t>(sizeof(RECORDING_MAGIC))
+			+ recordsSize(0, 9) + recordsSize(10, 20));
+	}
+
+	// Only the header of the file, and a part of a record header
+	TemporaryFile file;
+	CHECK(record(file.path(), 0, 1));
+	CHECK(truncate(file.path(), sizeof(RECORDING_MAGIC) + 5) == 0);
+	CHECK(record(file.path(), 1, 5));
+	CHECK(replay(file.path(), 5, 0));
+	CHECK(file.size() == static_cast<off_t>(sizeof(RECORDING_MAGIC))
+		+ recordsSize(1, 5));
+}
+
+/// Files that are not recordings are left alone
+void testNotRecording()
+{
+	TemporaryFile file;
+	FILE *fp = fopen(file.path(), "wb");
+	CHECK(fp != nullptr);
+	if (!fp) {
+		return;
+	}
+	fputs("NSR", fp);
+	fclose(fp);
+	Recorder recorder;
+	CHECK(!recorder.open(file.path()));
+	CHECK(file.size() == 3);
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testAppend);
+	RUN_TEST(testTruncatedRecord);
+	RUN_TEST(testNotRecording);
+	return testsDone();
+}
@@ -0,0 +1,217 @@
+/**
+ * Tests of the NetStylus output ring of the evdev server
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of RingBackend, through its sinks like the
+ * sessions of the server, and through pop() like a consumer of the frames.
+ *
+ * The events of each frame are derived from its index, so the consumer can
+ * tell whether it read a frame while the producer was writing it.
+ * The threaded cases are meant to be run also with -fsanitize=thread.
+ *
+ * To compile and run:
+ *   g++ -O2 -Wall -Wextra -I../common/ -I../evdev/ ring_backend_test.cpp \
+ *     ../evdev/output_sink.cpp ../evdev/event_frame.cpp -pthread \
+ *     -o ring-backend-test && ./ring-backend-test
+ */
+
+#include "check.h"
+
+#include <clock.h>
+#include <output_sink.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+/// The frames of the threaded tests
+const uint64_t stressFrames = 1000000;
+
+/// The frames pushed one at a time to the drain thread
+const uint64_t drainFrames = 200;
+
+/// Fill a frame of 1 to 4 events and a SYN_REPORT, return the count
+unsigned int makeFrame(uint64_t index, input_event *events)
+{
+	const unsigned int axes = 1 + index % 4;
+	for (unsigned int i = 0; i < axes; i++) {
+		events[i] = {};
+		events[i].type = EV_ABS;
+		events[i].code = static_cast<uint16_t>(i);
+		events[i].value = static_cast<int32_t>(index * 7 + i);
+	}
+	events[axes] = {};
+	events[axes].type = EV_SYN;
+	events[axes].code = SYN_REPORT;
+	return axes + 1;
+}
+
+/// Whether a frame popped from the ring is the one of an index
+bool intact(const OutputFrame &frame, uint64_t index, unsigned int device)
+{
+	input_event expected[EventFrame::maxEvents + 1];
+	const unsigned int count = makeFrame(index, expected);
+	if (frame.device != device || frame.count != count) {
+		return false;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		const input_event &e = frame.events[i];
+		if (e.type != expected[i].type || e.code != expected[i].code
+				|| e.value != expected[i].value) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// The frames come out in order and intact, and a full ring drops new frames
+void testPop()
+{
+	RingBackend ring(false);
+	auto first = ring.createSink();
+	auto second = ring.createSink();
+	const Geometry geometry = {20000, 10000, 4096};
+	CHECK(first->open("first", geometry, 100, 100)
+		&& second->open("second", geometry, 100, 100));
+
+	input_event events[EventFrame::maxEvents + 1];
+	OutputFrame frame;
+	CHECK(!ring.pop(frame));
+	uint64_t pushed = 0, popped = 0;
+	// Many times the capacity, so the indices wrap
+	for (int round = 0; round < 50; round++) {
+		for (size_t i = 0; i < 300; i++, pushed++) {
+			OutputSink &sink = pushed % 2 ? *second : *first;
+			CHECK(sink.write(events, makeFrame(pushed, events)) == 0);
+		}
+		while (ring.pop(frame)) {
+			CHECK(intact(frame, popped, popped % 2));
+			popped++;
+		}
+	}
+	CHECK(popped == pushed);
+	CHECK(ring.consumed() == popped);
+
+	for (size_t i = 0; i < RingBackend::capacity; i++) {
+		CHECK(first->write(events, makeFrame(i * 2, events)) == 0);
+	}
+	CHECK(first->write(events, makeFrame(0, events)) == -EAGAIN);
+	CHECK(ring.pop(frame) && intact(frame, 0, 0));
+	CHECK(first->write(events, makeFrame(RingBackend::capacity * 2, events))
+		== 0);
+	size_t count = 0;
+	while (ring.pop(frame)) {
+		count++;
+	}
+	CHECK(count == RingBackend::capacity);
+	CHECK(intact(frame, RingBackend::capacity * 2, 0));
+}
+
+/// A consumer thread pops while the sink writes
+void testConsumer()
+{
+	RingBackend ring(false);
+	auto sink = ring.createSink();
+	std::atomic<bool> done{false};
+	uint64_t dropped = 0;
+	std::thread producer([&]() {
+		input_event events[EventFrame::maxEvents + 1];
+		for (uint64_t i = 0; i < stressFrames; i++) {
+			if (sink->write(events, makeFrame(i, events))) {
+				// Like a slow device, let the consumer catch up
+				dropped++;
+				std::this_thread::yield();
+			}
+		}
+		done = true;
+	});
+
+	OutputFrame frame;
+	uint64_t received = 0, broken = 0, unordered = 0;
+	uint64_t next = 0;
+	while (true) {
+		const bool finished = done;
+		if (!ring.pop(frame)) {
+			if (finished) {
+				break;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+		// The dropped frames are skipped, so the index is found forward
+		const uint64_t index = static_cast<uint64_t>(frame.events[0].value)
+			/ 7;
+		unordered += index < next;
+		broken += !intact(frame, index, 0);
+		next = index + 1;
+		received++;
+	}
+	producer.join();
+
+	CHECK(unordered == 0);
+	CHECK(broken == 0);
+	CHECK(received + dropped == stressFrames);
+	CHECK(ring.consumed() == received);
+	printf("  %llu received, %llu dropped\n",
+		static_cast<unsigned long long>(received),
+		static_cast<unsigned long long>(dropped));
+}
+
+/// The drain thread wakes for each frame, and it takes them all
+void testDrain()
+{
+	RingBackend ring(true);
+	auto sink = ring.createSink();
+	input_event events[EventFrame::maxEvents + 1];
+	uint64_t waited = 0;
+	bool arrived = true;
+	for (uint64_t i = 0; i < drainFrames; i++) {
+		// Let the thread fall asleep before each frame
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+		const uint64_t start = monotonicTime();
+		CHECK(sink->write(events, makeFrame(i, events)) == 0);
+		while (ring.consumed() <= i && monotonicTime() - start < 1000000) {
+			std::this_thread::yield();
+		}
+		arrived &= ring.consumed() == i + 1;
+		waited += monotonicTime() - start;
+	}
+	CHECK(arrived);
+	printf("  %.1f µs from the write to the drain, on average\n",
+		static_cast<double>(waited) / drainFrames);
+
+	// The frames of a burst are all taken
+	for (uint64_t i = 0; i < RingBackend::capacity / 2; i++) {
+		CHECK(sink->write(events, makeFrame(i, events)) == 0);
+	}
+	const uint64_t start = monotonicTime();
+	while (ring.consumed() < drainFrames + RingBackend::capacity / 2
+			&& monotonicTime() - start < 1000000) {
+		std::this_thread::yield();
+	}
+	CHECK(ring.consumed() == drainFrames + RingBackend::capacity / 2);
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testPop);
+	RUN_TEST(testConsumer);
+	RUN_TEST(testDrain);
+	return testsDone();
+}
@@ -0,0 +1,233 @@
+/**
+ * Tests of the NetStylus conversion of tablet packets
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of SampleConverter.
+ *
+ * The conversion is compared with the one that the client did for each packet,
+ * with a division in double.
+ *
+ * To compile and run:
+ *   g++ -Wall -Wextra -I../common/ sample_converter_test.cpp \
+ *     ../common/sample_converter.cpp \
+ *     -o sample-converter-test && ./sample-converter-test
+ */
+
+#include "check.h"
+
+#include <sample_converter.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+
+/// The properties of a RealTimeStylus packet of a pen with everything
+enum Property {
+	PropertyX,
+	PropertyY,
+	PropertyStatus,
+	PropertyPressure,
+	PropertyTiltX,
+	PropertyTiltY,
+	Properties,
+};
+
+PacketLayout fullLayout()
+{
+	PacketLayout layout;
+	layout.x = PropertyX;
+	layout.y = PropertyY;
+	layout.status = PropertyStatus;
+	layout.pressure = PropertyPressure;
+	layout.tiltX = PropertyTiltX;
+	layout.tiltY = PropertyTiltY;
+	layout.maxPressure = 4096;
+	return layout;
+}
+
+/// Random packets, with the properties in the positions of fullLayout
+std::vector<int32_t> makePackets(size_t count, size_t stride)
+{
+	std::mt19937 random(19);
+	std::uniform_int_distribution<int32_t> coordinate(0, 40000);
+	std::uniform_int_distribution<int32_t> pressure(0, 4096);
+	std::uniform_int_distribution<int32_t> tilt(-9000, 9000);
+	std::vector<int32_t> packets(count * stride);
+	for (size_t i = 0; i < count; i++) {
+		int32_t *p = &packets[i * stride];
+		p[PropertyX] = coordinate(random);
+		p[PropertyY] = coordinate(random);
+		// Also the bits that we do not send
+		p[PropertyStatus] = static_cast<int32_t>(random() & 0xff);
+		p[PropertyPressure] = pressure(random);
+		p[PropertyTiltX] = tilt(random);
+		p[PropertyTiltY] = tilt(random);
+		for (size_t j = Properties; j < stride; j++) {
+			p[j] = -1;
+		}
+	}
+	return packets;
+}
+
+/// The coordinate that the client computed before the converter
+uint32_t reference(int32_t value, double scale)
+{
+	return static_cast<uint32_t>(value / scale);
+}
+
+/// The fixed point can differ from the division by its rounding
+bool closeCoordinate(uint32_t converted, int32_t value, double scale)
+{
+	const double error = std::fabs(static_cast<double>(converted)
+		- reference(value, scale));
+	return error <= 1 + std::fabs(value / scale) / 65536;
+}
+
+/// The values are the ones of the packets, with the scaled coordinates
+void testFullLayout()
+{
+	const size_t count = 1000, stride = Properties + 2;
+	const std::vector<int32_t> packets = makePackets(count, stride);
+	SampleConverter converter(fullLayout());
+	CHECK(converter.valid());
+	CHECK(converter.maxPressure() == 4096);
+
+	for (double scale : {1.0, 0.2645833, 0.75, 2.5}) {
+		converter.setScale(scale, scale * 1.5);
+		std::vector<Sample> samples(count);
+		converter.convert(packets.data(), count, stride, 100, 5000000, 4167,
+			samples.data());
+		for (size_t i = 0; i < count; i++) {
+			const int32_t *p = &packets[i * stride];
+			const Sample &s = samples[i];
+			CHECK(closeCoordinate(s.x, p[PropertyX], scale));
+			CHECK(closeCoordinate(s.y, p[PropertyY], scale * 1.5));
+			CHECK(s.status == ((p[PropertyStatus] & (PacketIsTouching
+				| PacketIsEraser | PacketButtonPressed)) | PacketHasPressure
+				| PacketHasTiltX | PacketHasTiltY));
+			CHECK(s.pressure == static_cast<uint32_t>(p[PropertyPressure]));
+			CHECK(s.tiltX == static_cast<uint32_t>(p[PropertyTiltX]));
+			CHECK(s.tiltY == static_cast<uint32_t>(p[PropertyTiltY]));
+			CHECK(s.seqNumber == 100 + i);
+			CHECK(!s.redundant);
+		}
+	}
+}
+
+/// With a scale of 1, the coordinates are copied exactly
+void testIdentity()
+{
+	const size_t count = 100;
+	const std::vector<int32_t> packets = makePackets(count, Properties);
+	SampleConverter converter(fullLayout());
+	converter.setScale(1, 1);
+	std::vector<Sample> samples(count);
+	converter.convert(packets.data(), count, Properties, 1, 1000000, 1000,
+		samples.data());
+	for (size_t i = 0; i < count; i++) {
+		CHECK(samples[i].x == static_cast<uint32_t>(packets[i * Properties]));
+		CHECK(samples[i].y
+			== static_cast<uint32_t>(packets[i * Properties + 1]));
+	}
+
+	// Invalid scales leave the coordinates unchanged, too
+	converter.setScale(0, -1);
+	converter.convert(packets.data(), 1, Properties, 1, 1000000, 1000,
+		samples.data());
+	CHECK(samples[0].x == static_cast<uint32_t>(packets[PropertyX]));
+	CHECK(samples[0].y == static_cast<uint32_t>(packets[PropertyY]));
+}
+
+/// The missing properties are 0, and their features are not announced
+void testMissingProperties()
+{
+	// A mouse-like pen: only coordinates and status, in another order
+	PacketLayout layout;
+	layout.status = 0;
+	layout.x = 1;
+	layout.y = 2;
+	layout.maxPressure = 1024;
+	SampleConverter converter(layout);
+	CHECK(converter.valid());
+	CHECK(converter.maxPressure() == 0);
+
+	const int32_t packets[] = {
+		PacketIsTouching, 300, 400,
+		PacketButtonPressed | 0x100, 500, 600,
+	};
+	Sample samples[2];
+	converter.convert(packets, 2, 3, 7, 1000000, 1000, samples);
+	CHECK(samples[0].status == PacketIsTouching);
+	CHECK(samples[0].x == 300 && samples[0].y == 400);
+	CHECK(samples[1].status == PacketButtonPressed);
+	CHECK(samples[1].x == 500 && samples[1].y == 600);
+	for (const Sample &s : samples) {
+		CHECK(s.pressure == 0 && s.tiltX == 0 && s.tiltY == 0);
+	}
+
+	// Only the tilt on y
+	layout.tiltY = 3;
+	const int32_t tilted[] = {0, 10, 20, -450};
+	SampleConverter withTilt(layout);
+	withTilt.convert(tilted, 1, 4, 1, 1000000, 1000, samples);
+	CHECK(samples[0].status == PacketHasTiltY);
+	CHECK(samples[0].tiltX == 0);
+	CHECK(samples[0].tiltY == static_cast<uint32_t>(-450));
+
+	// Without coordinates or status there is nothing to send
+	PacketLayout broken = layout;
+	broken.x = -1;
+	CHECK(!SampleConverter(broken).valid());
+	broken = layout;
+	broken.y = -1;
+	CHECK(!SampleConverter(broken).valid());
+	broken = layout;
+	broken.status = -1;
+	CHECK(!SampleConverter(broken).valid());
+	CHECK(!SampleConverter().valid());
+}
+
+/// The samples are evenly spaced, and the last one is at lastTime
+void testTimestamps()
+{
+	const size_t count = 8;
+	const std::vector<int32_t> packets = makePackets(count, Properties);
+	SampleConverter converter(fullLayout());
+	Sample samples[count];
+	converter.convert(packets.data(), count, Properties, 1, 1000000, 4167,
+		samples);
+	for (size_t i = 0; i < count; i++) {
+		CHECK(samples[i].timestamp == 1000000 - (count - 1 - i) * 4167);
+	}
+
+	// Nothing to convert, nothing written
+	samples[0].seqNumber = 42;
+	converter.convert(packets.data(), 0, Properties, 1, 1000000, 4167,
+		samples);
+	CHECK(samples[0].seqNumber == 42);
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testFullLayout);
+	RUN_TEST(testIdentity);
+	RUN_TEST(testMissingProperties);
+	RUN_TEST(testTimestamps);
+	return testsDone();
+}
@@ -0,0 +1,284 @@
+/**
+ * Tests of the NetStylus handoff of samples to the sender thread
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of SampleRing and SampleSender.
+ *
+ * The values of each sample are derived from its sequence number, so the
+ * consumer can tell whether it read a slot while the producer was writing it.
+ * The stress cases are meant to be run also with -fsanitize=thread.
+ *
+ * To compile and run:
+ *   g++ -O2 -Wall -Wextra -I../common/ sample_ring_test.cpp \
+ *     ../common/sample_ring.cpp -pthread \
+ *     -o sample-ring-test && ./sample-ring-test
+ */
+
+#include "check.h"
+
+#include <sample_ring.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/// The samples of the stress tests
+const uint64_t stressSamples = 2000000;
+
+/// A sample whose values all depend on its sequence number
+Sample makeSample(uint64_t seqNumber, bool touching)
+{
+	Sample s;
+	s.seqNumber = seqNumber;
+	s.status = PacketHasPressure | (touching ? PacketIsTouching : 0);
+	s.x = static_cast<uint32_t>(seqNumber * 3);
+	s.y = static_cast<uint32_t>(seqNumber * 5);
+	s.pressure = static_cast<uint32_t>(seqNumber & 0xffff);
+	s.tiltX = static_cast<uint32_t>(seqNumber * 7);
+	s.tiltY = ~static_cast<uint32_t>(seqNumber);
+	s.timestamp = seqNumber * 1000;
+	return s;
+}
+
+/// The sender moves between screens every few thousand samples, always at
+/// the start of a batch of 8
+Geometry makeGeometry(uint64_t seqNumber)
+{
+	const uint32_t screen = static_cast<uint32_t>((seqNumber - 1) / 4096 % 3);
+	return {20000 + screen, 10000 + screen, 4096};
+}
+
+/// Touches and lifts in runs of samples
+bool touching(uint64_t seqNumber)
+{
+	return seqNumber % 1000 < 600;
+}
+
+/// Whether a sample is intact, and has the geometry of its sequence number
+bool intact(const Sample &s, const Geometry &geometry)
+{
+	const Sample expected = makeSample(s.seqNumber, touching(s.seqNumber));
+	return s.status == expected.status && s.x == expected.x
+		&& s.y == expected.y && s.pressure == expected.pressure
+		&& s.tiltX == expected.tiltX && s.tiltY == expected.tiltY
+		&& s.timestamp == expected.timestamp && !s.redundant
+		&& geometry == makeGeometry(s.seqNumber);
+}
+
+/// The indices wrap many times, and the samples come out in order
+void testWraparound()
+{
+	SampleRing ring;
+	Sample samples[PacketEncoder::maxSamples];
+	uint64_t pushed = 1, popped = 1;
+	// Chunks that are not divisors of the capacity
+	for (size_t chunk : {1, 7, 63, 64, 100, 1000}) {
+		for (int round = 0; round < 50; round++) {
+			for (size_t i = 0; i < chunk; i++, pushed++) {
+				CHECK(ring.push(makeSample(pushed, touching(pushed)),
+					makeGeometry(pushed)));
+			}
+			while (!ring.empty()) {
+				Geometry geometry;
+				const size_t count = ring.pop(samples,
+					PacketEncoder::maxSamples, geometry);
+				CHECK(count > 0);
+				for (size_t i = 0; i < count; i++, popped++) {
+					CHECK(samples[i].seqNumber == popped);
+					CHECK(intact(samples[i], geometry));
+				}
+			}
+		}
+	}
+	CHECK(pushed == popped);
+	CHECK(pushed > SampleRing::capacity * 10);
+	CHECK(ring.stats().droppedOldest == 0 && ring.stats().droppedNew == 0);
+}
+
+/// A batch never mixes geometries
+void testGeometryBatches()
+{
+	SampleRing ring;
+	const Geometry first = {100, 200, 300};
+	const Geometry second = {400, 500, 600};
+	for (uint64_t i = 1; i <= 10; i++) {
+		ring.push(makeSample(i, false), i <= 4 ? first : second);
+	}
+	Sample samples[PacketEncoder::maxSamples];
+	Geometry geometry;
+	CHECK(ring.pop(samples, PacketEncoder::maxSamples, geometry) == 4);
+	CHECK(geometry == first && samples[3].seqNumber == 4);
+	CHECK(ring.pop(samples, 3, geometry) == 3);
+	CHECK(geometry == second && samples[0].seqNumber == 5);
+	CHECK(ring.pop(samples, PacketEncoder::maxSamples, geometry) == 3);
+	CHECK(ring.pop(samples, PacketEncoder::maxSamples, geometry) == 0);
+}
+
+/// The overflow policy: the oldest hover goes first, then the new hover
+void testOverflow()
+{
+	const Geometry geometry = makeGeometry(0);
+	Sample samples[PacketEncoder::maxSamples];
+	Geometry popped;
+
+	// Full of hover: a new sample replaces the oldest one
+	SampleRing hover;
+	for (uint64_t i = 1; i <= SampleRing::capacity; i++) {
+		CHECK(hover.push(makeSample(i, false), geometry));
+	}
+	CHECK(hover.push(makeSample(SampleRing::capacity + 1, false), geometry));
+	CHECK(hover.push(makeSample(SampleRing::capacity + 2, true), geometry));
+	CHECK(hover.stats().droppedOldest == 2);
+	CHECK(hover.pop(samples, 1, popped) == 1 && samples[0].seqNumber == 3);
+
+	// Full of ink: new hover is dropped, new ink replaces the oldest ink
+	SampleRing ink;
+	for (uint64_t i = 1; i <= SampleRing::capacity; i++) {
+		CHECK(ink.push(makeSample(i, true), geometry));
+	}
+	CHECK(!ink.push(makeSample(SampleRing::capacity + 1, false), geometry));
+	CHECK(ink.stats().droppedNew == 1);
+	CHECK(ink.push(makeSample(SampleRing::capacity + 2, true), geometry));
+	CHECK(ink.stats().droppedOldest == 1);
+	uint64_t count = 0, last = 0;
+	while (size_t n = ink.pop(samples, PacketEncoder::maxSamples, popped)) {
+		count += n;
+		last = samples[n - 1].seqNumber;
+	}
+	CHECK(count == SampleRing::capacity);
+	CHECK(last == SampleRing::capacity + 2);
+}
+
+/**
+ * A producer and a consumer at the same time.
+ *
+ * \param slowConsumer Whether the consumer pauses, so the ring fills and the
+ *  producer drops samples
+ */
+void stress(bool slowConsumer)
+{
+	SampleRing ring;
+	std::atomic<bool> done{false};
+	uint64_t refused = 0;
+	std::thread producer([&]() {
+		for (uint64_t i = 1; i <= stressSamples; i++) {
+			refused += !ring.push(makeSample(i, touching(i)), makeGeometry(i));
+		}
+		done = true;
+	});
+
+	Sample samples[PacketEncoder::maxSamples];
+	uint64_t received = 0, last = 0, broken = 0, unordered = 0;
+	while (true) {
+		const bool finished = done;
+		Geometry geometry;
+		const size_t count = ring.pop(samples, PacketEncoder::maxSamples,
+			geometry);
+		for (size_t i = 0; i < count; i++) {
+			unordered += samples[i].seqNumber <= last;
+			broken += !intact(samples[i], geometry);
+			last = samples[i].seqNumber;
+		}
+		received += count;
+		if (!count && finished) {
+			break;
+		}
+		if (!count) {
+			std::this_thread::yield();
+		} else if (slowConsumer && received % 4096 < count) {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+	producer.join();
+
+	const SampleRing::Stats &stats = ring.stats();
+	CHECK(unordered == 0);
+	CHECK(broken == 0);
+	CHECK(last == stressSamples || stats.droppedNew > 0);
+	CHECK(refused == stats.droppedNew);
+	CHECK(received + stats.droppedOldest + stats.droppedNew == stressSamples);
+	if (slowConsumer) {
+		CHECK(stats.droppedOldest + stats.droppedNew > 0);
+	}
+	printf("  %llu received, %llu oldest and %llu new dropped\n",
+		static_cast<unsigned long long>(received),
+		static_cast<unsigned long long>(stats.droppedOldest.load()),
+		static_cast<unsigned long long>(stats.droppedNew.load()));
+}
+
+void testStress()
+{
+	stress(false);
+}
+
+void testStressFull()
+{
+	stress(true);
+}
+
+/// The sender passes every sample that the ring kept, also when it stops
+void testSender()
+{
+	std::vector<Sample> received;
+	bool batchesIntact = true;
+	size_t dropped = 0;
+	{
+		SampleSender sender([&](Sample *samples, size_t count,
+				const Geometry &geometry) {
+			for (size_t i = 0; i < count; i++) {
+				batchesIntact &= intact(samples[i], geometry);
+				received.push_back(samples[i]);
+			}
+		});
+		Sample batch[8];
+		for (uint64_t i = 1; i <= stressSamples; i += 8) {
+			for (uint64_t j = 0; j < 8; j++) {
+				batch[j] = makeSample(i + j, touching(i + j));
+			}
+			dropped += sender.push(batch, 8, makeGeometry(i));
+			if (i % 4096 == 1) {
+				// Let the sender fall asleep, sometimes
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		}
+		CHECK(dropped == sender.stats().droppedNew);
+		dropped += sender.stats().droppedOldest;
+	}
+
+	CHECK(batchesIntact);
+	CHECK(received.size() + dropped == stressSamples);
+	bool ordered = true;
+	for (size_t i = 1; i < received.size(); i++) {
+		ordered &= received[i].seqNumber > received[i - 1].seqNumber;
+	}
+	CHECK(ordered);
+	CHECK(!received.empty() && received.back().seqNumber == stressSamples);
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testWraparound);
+	RUN_TEST(testGeometryBatches);
+	RUN_TEST(testOverflow);
+	RUN_TEST(testStress);
+	RUN_TEST(testStressFull);
+	RUN_TEST(testSender);
+	return testsDone();
+}
@@ -0,0 +1,277 @@
+/**
+ * Tests of the NetStylus accounting of the sequence numbers
+ *
+ * Written in 2021 by Pier Angelo Vendrame <vogliadifarniente AT gmail DOT com>
+ *
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * If your country does not recognize the public domain, or if you need a
+ * license, please refer to Creative Commons CC0 Public Domain Dedication
+ * <http://creativecommons.org/publicdomain/zero/1.0>.
+ */
+
+/**
+ * \file
+ * This file contains the tests of SequenceTracker.
+ *
+ * Each sequence number of a stream is received in order, late, or lost, so
+ * the three counters always add up to the numbers up to the highest one.
+ *
+ * To compile and run:
+ *   g++ -Wall -Wextra -I../common/ -I../evdev/ sequence_tracker_test.cpp \
+ *     ../evdev/stats.cpp -o sequence-tracker-test \
+ *     && ./sequence-tracker-test
+ */
+
+#include "check.h"
+
+#include <stats.h>
+
+namespace {
+
+using Counters = SequenceTracker::Counters;
+
+/// Accept the numbers [first, last], return whether all were newer
+bool acceptRange(SequenceTracker &tracker, uint64_t first, uint64_t last,
+	bool redundant = false)
+{
+	bool newer = true;
+	for (uint64_t seq = first; seq <= last; seq++) {
+		newer &= tracker.accept(seq, redundant);
+	}
+	return newer;
+}
+
+/// Every number from first to the highest one is counted once
+bool balanced(const SequenceTracker &tracker, uint64_t first = 1)
+{
+	const Counters &c = tracker.total();
+	return c.received + c.lost + c.late
+		== static_cast<int64_t>(tracker.highest() - first + 1);
+}
+
+bool sameCounters(const Counters &a, const Counters &b)
+{
+	return a.received == b.received && a.lost == b.lost && a.late == b.late
+		&& a.duplicate == b.duplicate && a.resets == b.resets
+		&& a.recovered == b.recovered;
+}
+
+/// The holes are lost, until the late packets fill them
+void testGaps()
+{
+	SequenceTracker tracker;
+	CHECK(acceptRange(tracker, 1, 3));
+	CHECK(tracker.accept(6));
+	CHECK(tracker.accept(7));
+	CHECK(tracker.highest() == 7);
+	CHECK(tracker.total().received == 5);
+	CHECK(tracker.total().lost == 2);
+	CHECK(balanced(tracker));
+
+	// Late packets are not used, but they are not lost anymore
+	CHECK(!tracker.accept(5));
+	CHECK(tracker.total().late == 1 && tracker.total().lost == 1);
+	CHECK(!tracker.accept(4));
+	CHECK(tracker.total().late == 2 && tracker.total().lost == 0);
+	CHECK(tracker.highest() == 7);
+	CHECK(balanced(tracker));
+
+	// A late packet counts once, then it is a duplicate
+	CHECK(!tracker.accept(4));
+	CHECK(tracker.total().late == 2 && tracker.total().duplicate == 1);
+	CHECK(tracker.total().resets == 0);
+	CHECK(balanced(tracker));
+}
+
+/// The first packets can arrive out of order, too
+void testStart()
+{
+	SequenceTracker tracker;
+	CHECK(tracker.accept(3));
+	CHECK(!tracker.accept(1));
+	CHECK(!tracker.accept(2));
+	CHECK(tracker.highest() == 3);
+	// They were never counted as lost
+	CHECK(tracker.total().late == 2 && tracker.total().lost == 0);
+	CHECK(tracker.total().received == 1);
+	CHECK(balanced(tracker));
+	CHECK(!tracker.accept(1));
+	CHECK(tracker.total().duplicate == 1);
+
+	// The same after a reset
+	CHECK(acceptRange(tracker, 4, 500));
+	CHECK(tracker.accept(2));
+	CHECK(!tracker.accept(1));
+	CHECK(tracker.total().resets == 1);
+	CHECK(tracker.total().late == 3 && tracker.total().lost == 0);
+}
+
+/// Duplicates are counted, the copies of received samples are not
+void testDuplicates()
+{
+	SequenceTracker tracker;
+	CHECK(acceptRange(tracker, 1, 8));
+	CHECK(!tracker.accept(8));
+	CHECK(!tracker.accept(5));
+	CHECK(tracker.total().duplicate == 2);
+
+	// The next packet repeats the last samples of this one
+	CHECK(!acceptRange(tracker, 7, 8, true));
+	CHECK(tracker.total().duplicate == 2);
+	CHECK(tracker.total().recovered == 0);
+	CHECK(acceptRange(tracker, 9, 12));
+
+	// A packet is lost, the copies in the next one are the only ones
+	CHECK(acceptRange(tracker, 15, 16, true));
+	CHECK(acceptRange(tracker, 17, 20));
+	CHECK(tracker.total().recovered == 2);
+	CHECK(tracker.total().lost == 2);
+	CHECK(tracker.total().received == 18);
+	CHECK(balanced(tracker));
+
+	// A copy that fills a hole behind the newest sample is late
+	CHECK(!tracker.accept(14, true));
+	CHECK(tracker.total().late == 1 && tracker.total().lost == 1);
+	CHECK(tracker.total().duplicate == 2);
+	CHECK(balanced(tracker));
+}
+
+/// The bitmap keeps the packets received before a shift of 64 or more
+void testLongShifts()
+{
+	// Many small shifts carry the bits to the second word
+	SequenceTracker tracker;
+	CHECK(tracker.accept(1));
+	CHECK(acceptRange(tracker, 3, 70));
+	CHECK(!tracker.accept(1));
+	CHECK(tracker.total().duplicate == 1);
+	CHECK(!tracker.accept(2));
+	CHECK(tracker.total().late == 1 && tracker.total().lost == 0);
+
+	// Exactly 64
+	SequenceTracker exact;
+	CHECK(exact.accept(10));
+	CHECK(exact.accept(74));
+	CHECK(exact.total().lost == 63);
+	CHECK(!exact.accept(10));
+	CHECK(exact.total().duplicate == 1);
+	CHECK(!exact.accept(11));
+	CHECK(exact.total().late == 1);
+	CHECK(balanced(exact, 10));
+
+	// More than 64 at once
+	SequenceTracker wide;
+	CHECK(acceptRange(wide, 1, 2));
+	CHECK(wide.accept(70));
+	CHECK(wide.total().lost == 67);
+	CHECK(!wide.accept(2));
+	CHECK(!wide.accept(1));
+	CHECK(wide.total().duplicate == 2);
+	CHECK(!wide.accept(3));
+	CHECK(wide.total().late == 1 && wide.total().lost == 66);
+	CHECK(balanced(wide));
+
+	// 128 or more clears the bitmap: nothing in it is a duplicate
+	const uint64_t jumps[] = {128, 129, 195, 100000};
+	for (uint64_t jump : jumps) {
+		SequenceTracker cleared;
+		CHECK(acceptRange(cleared, 1, 5));
+		CHECK(cleared.accept(5 + jump));
+		CHECK(cleared.total().lost == static_cast<int64_t>(jump - 1));
+		const uint64_t inside = 5 + jump + 1 - SequenceTracker::resetDistance;
+		CHECK(!cleared.accept(inside));
+		CHECK(cleared.total().late == 1 && cleared.total().duplicate == 0);
+		CHECK(!cleared.accept(inside));
+		CHECK(cleared.total().duplicate == 1);
+		CHECK(cleared.total().resets == 0);
+		CHECK(balanced(cleared));
+	}
+}
+
+/// A sender that starts over is a reset, a jump forward is only a loss
+void testResets()
+{
+	// Backward: the client restarted and numbers from 1 again
+	SequenceTracker tracker;
+	CHECK(acceptRange(tracker, 1, 500));
+	CHECK(tracker.accept(1));
+	CHECK(tracker.total().resets == 1);
+	CHECK(tracker.highest() == 1);
+	CHECK(acceptRange(tracker, 2, 10));
+	CHECK(!tracker.accept(5));
+	CHECK(tracker.total().duplicate == 1);
+	CHECK(tracker.total().lost == 0 && tracker.total().late == 0);
+	CHECK(tracker.total().received == 510);
+
+	// The boundary: within resetDistance it is late, beyond it a reset
+	SequenceTracker boundary;
+	CHECK(boundary.accept(1000));
+	CHECK(!boundary.accept(1000 - SequenceTracker::resetDistance + 1));
+	CHECK(boundary.total().late == 1 && boundary.total().resets == 0);
+	CHECK(boundary.total().lost == 0);
+	CHECK(boundary.accept(1000 - SequenceTracker::resetDistance));
+	CHECK(boundary.total().resets == 1);
+	CHECK(boundary.highest() == 1000 - SequenceTracker::resetDistance);
+
+	// Forward: an outage loses what was sent meanwhile, it is not a reset
+	SequenceTracker outage;
+	CHECK(acceptRange(outage, 1, 10));
+	CHECK(outage.accept(5000));
+	CHECK(outage.total().resets == 0);
+	CHECK(outage.total().lost == 4989);
+	CHECK(acceptRange(outage, 5001, 5010));
+	CHECK(balanced(outage));
+	// Then a packet from before the outage is too old to be late
+	CHECK(outage.accept(11));
+	CHECK(outage.total().resets == 1);
+}
+
+/// The window sums the last slots, and rotating clears the oldest one
+void testWindow()
+{
+	SequenceTracker tracker;
+	CHECK(acceptRange(tracker, 1, 10));
+	CHECK(tracker.accept(13));
+	CHECK(sameCounters(tracker.window(), tracker.total()));
+
+	// The late packet fills a hole counted in a previous slot
+	tracker.rotate();
+	CHECK(!tracker.accept(12));
+	CHECK(sameCounters(tracker.window(), tracker.total()));
+	CHECK(tracker.window().lost == 1 && tracker.window().late == 1);
+
+	for (unsigned int i = 1; i < SequenceTracker::windowSlots - 1; i++) {
+		tracker.rotate();
+	}
+	CHECK(sameCounters(tracker.window(), tracker.total()));
+	// The slot of the first packets goes away, the late packet of the next
+	// slot still takes back its loss
+	tracker.rotate();
+	CHECK(tracker.window().received == 0);
+	CHECK(tracker.window().lost == -1 && tracker.window().late == 1);
+	tracker.rotate();
+	CHECK(sameCounters(tracker.window(), Counters()));
+
+	// The total is not affected
+	CHECK(tracker.total().received == 11);
+	CHECK(tracker.total().lost == 1 && tracker.total().late == 1);
+	CHECK(acceptRange(tracker, 14, 20));
+	CHECK(tracker.window().received == 7);
+	CHECK(balanced(tracker));
+}
+
+} // namespace
+
+int main()
+{
+	RUN_TEST(testGaps);
+	RUN_TEST(testStart);
+	RUN_TEST(testDuplicates);
+	RUN_TEST(testLongShifts);
+	RUN_TEST(testResets);
+	RUN_TEST(testWindow);
+	return testsDone();
+}